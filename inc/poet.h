@@ -32,6 +32,21 @@ typedef double real_t;
  */
 #define POET_DISABLE_IDLE "POET_DISABLE_IDLE"
 
+/**
+ * Setting this environment variable tells POET to check all pairs of states
+ * when translating a speedup or powerup into system states, instead of using
+ * the convex hull index built in poet_init().
+ * This is much slower, but is useful for verifying the indexed results.
+ */
+#define POET_TRANSLATE_N2 "POET_TRANSLATE_N2"
+
+/**
+ * Setting this environment variable when calling poet_init() makes it write
+ * a compact binary log instead of a text log.
+ * Use bard_logdump to convert binary logs to text or CSV.
+ */
+#define POET_LOG_BINARY "POET_LOG_BINARY"
+
 typedef enum {
   PERFORMANCE,
   POWER,
@@ -58,6 +73,16 @@ typedef int (* poet_curr_state_func) (const void* states,
                                       unsigned int num_states,
                                       unsigned int* curr_state_id);
 
+/**
+ * The switching cost function returns the time in seconds that is lost when
+ * the system changes from one state to another, e.g. to migrate threads when
+ * the core allocation changes. The states pointer is the one passed to
+ * poet_set_switch_cost().
+ */
+typedef real_t (* poet_switch_cost_func) (const void* states,
+                                          unsigned int from_id,
+                                          unsigned int to_id);
+
 /**
  * Defines properties of system states.
  * Speedup and cost (e.g. power) are normalized to the lowest state, which
@@ -74,6 +99,114 @@ typedef struct {
   unsigned int idle_partner_id;
 } poet_control_state_t;
 
+/**
+ * Pole and zero placement of the controller that computes the speedup or
+ * powerup needed to meet the goal.
+ * Poles closer to 0 react to changes faster; poles closer to 1 filter out
+ * more noise in the performance and power measurements.
+ */
+typedef struct {
+  real_t p1;
+  real_t p2;
+  real_t z1;
+  real_t mu;
+} poet_controller_params;
+
+typedef enum {
+  // deadbeat control: p1=0, p2=0, z1=0, mu=1 (the default)
+  POET_CONTROLLER_FAST,
+  // smoother control: p1=0.1, p2=0.8, z1=0.7, mu=1
+  POET_CONTROLLER_SLOW,
+} poet_controller_preset_t;
+
+/**
+ * The Kalman filters that estimate the base workload from the measured
+ * performance and power.
+ */
+typedef enum {
+  POET_FILTER_PERFORMANCE,
+  POET_FILTER_POWER,
+} poet_filter_t;
+
+/**
+ * Process noise (q) and measurement noise (r) of a Kalman filter.
+ * A larger q relative to r makes the filter follow workload changes faster,
+ * at the cost of following measurement noise more closely.
+ * With adaptive set, q and r are minimums: r is raised to the measurement
+ * variance estimated from the filter's innovations, and q is raised while the
+ * innovations are biased, i.e. after the workload changes. Innovations far
+ * outside the estimated noise reset the estimate in a single period.
+ * In fixed point builds, squared innovations must fit in real_t.
+ */
+typedef struct {
+  real_t q;
+  real_t r;
+  int adaptive;
+} poet_filter_params;
+
+/**
+ * Activity of the apply thread enabled with poet_set_async_apply().
+ */
+typedef struct {
+  // apply requests made by the controller
+  unsigned long long posted;
+  // requests applied
+  unsigned long long applied;
+  // requests replaced by a newer one before they were applied
+  unsigned long long superseded;
+  // the state applied last, and when its apply call returned
+  // (CLOCK_MONOTONIC nanoseconds)
+  unsigned int applied_id;
+  unsigned long long applied_ns;
+} poet_async_apply_stats;
+
+/**
+ * Phases of poet_apply_control() timed by poet_set_stats().
+ */
+typedef enum {
+  // estimating the performance and power workloads with the Kalman filters
+  POET_PHASE_ESTIMATE = 0,
+  // calculating the speedup or powerup
+  POET_PHASE_XUP,
+  // translating the xup into a schedule of states
+  POET_PHASE_TRANSLATE,
+  // writing log and telemetry records
+  POET_PHASE_LOG,
+  // calling the apply function (or posting to the apply thread)
+  POET_PHASE_APPLY,
+  POET_NUM_PHASES
+} poet_phase;
+
+#define POET_STATS_BUCKETS 32
+
+/**
+ * Timing of one phase, in ticks (see poet_stats).
+ */
+typedef struct {
+  unsigned long long count;
+  unsigned long long total_ticks;
+  unsigned long long min_ticks;
+  unsigned long long max_ticks;
+  // buckets[i] counts durations of [2^i, 2^(i+1)) ticks, buckets[0] also
+  // counts 0, and the last bucket counts everything longer
+  unsigned long long buckets[POET_STATS_BUCKETS];
+} poet_phase_stats;
+
+/**
+ * Timing of each phase since poet_set_stats() enabled it.
+ */
+typedef struct {
+  // nanoseconds per tick, measured while stats were enabled
+  double ns_per_tick;
+  poet_phase_stats phases[POET_NUM_PHASES];
+} poet_stats;
+
+/**
+ * Reads a cumulative energy counter in microjoules for poet_heartbeat(), e.g.
+ * rapl_energy_read() from poet_config.h. The counter must not wrap.
+ */
+typedef unsigned long long (*poet_energy_func) (void * arg);
+
 /**
  * Initializes a poet_state struct which is needed to call other functions.
  *
@@ -82,6 +215,9 @@ typedef struct {
  * allowed to be NULL, in which case the apply function must know where to
  * access the appropriate data structures to apply system changes.
  *
+ * The control_states are indexed when this function is called, so they must
+ * not be modified while the poet_state is in use.
+ *
  * Default values for state variables are located in src/poet_constants.h
  *
  * @param goal
@@ -97,8 +233,12 @@ typedef struct {
  * @param period
  *   Must be > 0
  * @param buffer_depth
- *   Must be > 0 if log_filename is specified
+ *   Number of log records that can be queued for the log writer thread.
+ *   Must be > 0 if log_filename is specified. If the writer falls this far
+ *   behind, records are dropped after waiting 10 ms (see poet_get_log_stats())
  * @param log_filename
+ *   Records are written by a background thread, which writes any queued
+ *   records when poet_destroy() is called
  *
  * @return poet_state pointer, or NULL on failure (errno will be set)
  */
@@ -131,6 +271,340 @@ void poet_set_constraint_type(poet_state * state,
                               poet_tradeoff_type_t constraint,
                               real_t goal);
 
+/**
+ * Get the parameters of a predefined controller.
+ *
+ * @param preset
+ * @param params
+ */
+void poet_get_controller_preset(poet_controller_preset_t preset,
+                                poet_controller_params * params);
+
+/**
+ * Change the controller parameters at runtime.
+ * The coefficients derived from them are computed once here rather than on
+ * every control decision. The controller history is kept, so the change takes
+ * effect smoothly from the next decision.
+ *
+ * @param state
+ * @param params
+ *   p1, p2, and z1 must be in (-1, 1), and mu must be > 0
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_controller_params(poet_state * state,
+                               const poet_controller_params * params);
+
+/**
+ * Get the current controller parameters.
+ *
+ * @param state
+ * @param params
+ */
+void poet_get_controller_params(const poet_state * state,
+                                poet_controller_params * params);
+
+/**
+ * Change the noise parameters of a Kalman filter at runtime.
+ * The filter estimate is kept, but any adapted noise estimates are reset.
+ * Defaults are Q and R in src/poet_constants.h, not adaptive.
+ *
+ * @param state
+ * @param filter
+ * @param params
+ *   q must be >= 0 and r must be > 0
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_filter_params(poet_state * state,
+                           poet_filter_t filter,
+                           const poet_filter_params * params);
+
+/**
+ * Get the noise parameters of a Kalman filter.
+ *
+ * @param state
+ * @param filter
+ * @param params
+ */
+void poet_get_filter_params(const poet_state * state,
+                            poet_filter_t filter,
+                            poet_filter_params * params);
+
+/**
+ * Get the noise a Kalman filter will use in its next estimate, which differs
+ * from its parameters if it is adaptive.
+ *
+ * @param state
+ * @param filter
+ * @param q
+ *   may be NULL
+ * @param r
+ *   may be NULL
+ */
+void poet_get_filter_noise(const poet_state * state,
+                           poet_filter_t filter,
+                           real_t * q,
+                           real_t * r);
+
+/**
+ * Enable a cache of translation results, so that the search for the best
+ * pair of system states can be skipped when the target speedup or powerup
+ * and the workload estimate are steady.
+ * Entries are keyed on the constraint type, the target xup, and the workload,
+ * with the latter two quantized by the given amounts. Results are reused for
+ * all inputs within the same quanta, so larger quanta give more cache hits
+ * but coarser decisions.
+ * Enabling the cache again clears it and resets its statistics.
+ *
+ * @param state
+ * @param num_entries
+ *   Number of cache entries, 0 disables the cache
+ * @param xup_quantum
+ *   Must be > 0 if num_entries > 0
+ * @param workload_quantum
+ *   Must be > 0 if num_entries > 0
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_translation_cache(poet_state * state,
+                               unsigned int num_entries,
+                               real_t xup_quantum,
+                               real_t workload_quantum);
+
+/**
+ * Get the number of translation cache hits and misses since the cache was
+ * enabled.
+ *
+ * @param state
+ * @param hits
+ *   may be NULL
+ * @param misses
+ *   may be NULL
+ */
+void poet_get_translation_cache_stats(const poet_state * state,
+                                      unsigned long long * hits,
+                                      unsigned long long * misses);
+
+/**
+ * Get the number of times the log writer thread had fallen buffer_depth
+ * records behind, so poet_apply_control() had to wait for it, and the number
+ * of records dropped because no space was freed within 10 ms.
+ * Both are 0 if there is no log.
+ *
+ * @param state
+ * @param stalls
+ *   may be NULL
+ * @param dropped
+ *   may be NULL
+ */
+void poet_get_log_stats(const poet_state * state,
+                        unsigned long long * stalls,
+                        unsigned long long * dropped);
+
+/**
+ * Account for the time lost switching between states when translating a
+ * speedup or powerup into system states.
+ * Time-dividing between two states switches between them twice per period.
+ * The time lost is charged at the xup cost of the state being switched to:
+ * as power spent without progress when minimizing power, or as performance
+ * lost when maximizing performance. This lets a schedule that stays in one
+ * state win over a slightly better pair when switching is expensive.
+ * Setting the cost clears the translation cache.
+ *
+ * @param state
+ * @param cost
+ *   NULL disables switching costs (the default)
+ * @param cost_states
+ *   passed to the cost function, may be NULL
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_switch_cost(poet_state * state,
+                         poet_switch_cost_func cost,
+                         const void * cost_states);
+
+/**
+ * Publish a record of each control decision (the same data as the log) to a
+ * ring of records in a memory-mapped file, so monitors like bard_top can read
+ * live decisions from another process.
+ * Readers never block the controller; a seqlock lets them detect records that
+ * were overwritten while being read.
+ * Use a path in /dev/shm for a POSIX shared memory ring that is not backed by
+ * storage. An existing file is replaced, and the file is not removed.
+ *
+ * @param state
+ * @param path
+ *   NULL disables telemetry
+ * @param num_records
+ *   Number of records in the ring, must be > 0 if path is not NULL
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_telemetry(poet_state * state,
+                       const char * path,
+                       unsigned int num_records);
+
+/**
+ * Measure performance and power with poet_heartbeat() instead of passing them
+ * to poet_apply_control().
+ * The heart rate and power are computed over a sliding window of the last
+ * window_size heartbeats in constant time per beat. Using the period passed to
+ * poet_init() as the window size makes each control decision see exactly the
+ * beats since the last one.
+ *
+ * @param state
+ * @param window_size
+ *   0 disables sensing
+ * @param energy
+ *   reads the energy counter, may be NULL if the constraint is PERFORMANCE
+ *   (power is then not measured and always passed as 1 W)
+ * @param energy_arg
+ *   passed to energy
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_sensing(poet_state * state,
+                     unsigned int window_size,
+                     poet_energy_func energy,
+                     void * energy_arg);
+
+/**
+ * Let many threads report completed work and energy concurrently, e.g. the
+ * workers of a thread pool, and run the controller from poet_control_step().
+ * Each producer adds to its own counters on its own cache line, so recording
+ * work never takes a lock or writes memory shared with other producers.
+ * Must not be called while producers or poet_control_step() use the state.
+ *
+ * @param state
+ * @param num_producers
+ *   0 disables producers
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_producers(poet_state * state,
+                       unsigned int num_producers);
+
+/**
+ * Time each phase of poet_apply_control() into log-scale histograms.
+ * Only available if bard is built with POET_STATS; otherwise the phases are
+ * not instrumented at all. When built in but disabled, each phase costs one
+ * branch. Enabling resets the stats.
+ * poet_apply_control_batch() only times the translate, log, and apply
+ * phases, since it estimates workloads and xups for all instances at once.
+ *
+ * @param state
+ * @param enable
+ *
+ * @return 0 on success, -1 on failure (errno will be set to ENOSYS if stats
+ * are not built in)
+ */
+int poet_set_stats(poet_state * state,
+                   int enable);
+
+/**
+ * Get the timing of each phase since stats were enabled.
+ *
+ * @param state
+ * @param stats
+ *
+ * @return 0 on success, -1 if stats are not enabled (errno will be set)
+ */
+int poet_get_stats(const poet_state * state,
+                   poet_stats * stats);
+
+/**
+ * Let worker threads idle themselves at safe points instead of having the
+ * apply function idle the whole process.
+ * While enabled, the apply function is always passed idle_ns=0. Instead, when
+ * the controller idles, each of the num_threads worker threads is assigned the
+ * full idle time, which it takes with poet_take_idle_ns() or sleeps in
+ * poet_idle_point(). Idle time a thread has not yet taken is replaced by the
+ * next assignment, not accumulated.
+ * Must not be called while worker threads use the state.
+ *
+ * @param state
+ * @param num_threads
+ *   0 disables cooperative idling
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_idle_threads(poet_state * state,
+                          unsigned int num_threads);
+
+/**
+ * Take the idle time assigned to a worker thread, which the thread is then
+ * expected to spend idle. Lock-free, so it may be called from any thread
+ * concurrently with poet_apply_control().
+ *
+ * @param state
+ * @param thread
+ *   the worker's index, must be < the num_threads set with
+ *   poet_set_idle_threads()
+ *
+ * @return the idle time in nanoseconds, 0 if none is assigned
+ */
+unsigned long long poet_take_idle_ns(poet_state * state,
+                                     unsigned int thread);
+
+/**
+ * Take the idle time assigned to a worker thread and sleep for it.
+ * Worker threads should call this where they hold no locks, e.g. between
+ * tasks.
+ *
+ * @param state
+ * @param thread
+ *   the worker's index, must be < the num_threads set with
+ *   poet_set_idle_threads()
+ *
+ * @return the idle time in nanoseconds that was taken
+ */
+unsigned long long poet_idle_point(poet_state * state,
+                                   unsigned int thread);
+
+/**
+ * Call the apply function from a dedicated thread instead of from
+ * poet_apply_control(), so system changes and idling never delay the
+ * application.
+ * Requests go through a single-slot mailbox: a request that has not been
+ * applied yet is replaced by the next one, including its idle time.
+ * The apply thread records when each state takes effect, see
+ * poet_get_async_apply_stats() and poet_get_time_in_states().
+ * Disabling (or poet_destroy()) applies any pending request first.
+ * Must not be called concurrently with poet_apply_control().
+ *
+ * @param state
+ * @param enable
+ *
+ * @return 0 on success, -1 on failure (errno will be set)
+ */
+int poet_set_async_apply(poet_state * state,
+                         int enable);
+
+/**
+ * Get the activity of the apply thread.
+ *
+ * @param state
+ * @param stats
+ *
+ * @return 0 on success, -1 if async apply is not enabled (errno will be set)
+ */
+int poet_get_async_apply_stats(const poet_state * state,
+                               poet_async_apply_stats * stats);
+
+/**
+ * Get the time spent in each state since async apply was enabled, measured
+ * from when each state's apply call returned, up to now.
+ *
+ * @param state
+ * @param time_ns
+ *   must have an entry for each system state
+ *
+ * @return 0 on success, -1 if async apply is not enabled (errno will be set)
+ */
+int poet_get_time_in_states(const poet_state * state,
+                            unsigned long long * time_ns);
+
 /**
  * Runs POET decision engine and requests system changes by calling the apply
  * function provided in poet_init().
@@ -148,6 +622,88 @@ void poet_apply_control(poet_state * state,
                         real_t perf,
                         real_t pwr);
 
+/**
+ * Records a heartbeat and runs poet_apply_control() with the heart rate
+ * (beats/s) and power (W) over the window set with poet_set_sensing().
+ * If the energy counter has not advanced over the window, the last measured
+ * power is used instead. Until power has been measured, beats only advance
+ * the schedule of the last control decision.
+ * Does nothing if sensing is not enabled.
+ *
+ * @param state
+ * @param id
+ *   user-specified identifier for current iteration
+ */
+void poet_heartbeat(poet_state * state,
+                    unsigned long id);
+
+/**
+ * Record work completed by a producer thread and the energy it used.
+ * Lock-free and wait-free, so it may be called from any thread concurrently
+ * with other producers and poet_control_step(), but each producer index must
+ * only be used by one thread at a time.
+ *
+ * @param state
+ * @param producer
+ *   the producer's index, must be < the num_producers set with
+ *   poet_set_producers()
+ * @param work
+ *   units of work completed, e.g. requests served
+ * @param energy_uj
+ *   energy used since the producer's last call in microjoules, may always be 0
+ *   if the constraint is PERFORMANCE (power is then passed as 1 W)
+ */
+void poet_produce(poet_state * state,
+                  unsigned int producer,
+                  unsigned long long work,
+                  unsigned long long energy_uj);
+
+/**
+ * Aggregate the work and energy of all producers since the last step and run
+ * poet_apply_control() with their total rate (work/s) and power (W).
+ * Each step is one iteration of poet_apply_control(), so with a period of 1
+ * the controller makes a decision on every step, e.g. from a timer thread.
+ * If no work was completed since the last step, or producers report energy
+ * but none was used since the last step, the controller does not run and the
+ * next step also covers this one's time, work, and energy.
+ * Any thread may call it; if another thread is already stepping, it returns
+ * immediately without waiting.
+ *
+ * @param state
+ * @param id
+ *   user-specified identifier for current iteration
+ *
+ * @return 1 if the controller ran, 0 if producers are not enabled, the step
+ * was carried over, or another thread was stepping
+ */
+int poet_control_step(poet_state * state,
+                      unsigned long id);
+
+/**
+ * Runs poet_apply_control() for many independent poet_state instances.
+ *
+ * The result is the same as calling poet_apply_control() for each instance in
+ * order, but environment variables are only read once and the filter and
+ * speedup/powerup calculations for all instances run as loops over
+ * structure-of-arrays copies of their state.
+ * Each state may appear at most once.
+ *
+ * @param states
+ *   NULL entries are skipped
+ * @param ids
+ *   user-specified identifiers for the instances' current iterations
+ * @param perf
+ *   the actual achieved performance of each instance
+ * @param pwr
+ *   the actual achieved power of each instance
+ * @param num_states
+ */
+void poet_apply_control_batch(poet_state * const * states,
+                              const unsigned long * ids,
+                              const real_t * perf,
+                              const real_t * pwr,
+                              unsigned int num_states);
+
 #ifdef __cplusplus
 }
 #endif
@@ -51,6 +51,8 @@ typedef struct {
 /**
  * Change the CPU configuration on the system by setting the frequency and
  * number of cores to be used as configured in the state with the provided id.
+ * The core mask is applied to all threads of this process and its child
+ * processes.
  *
  * Compatible with the poet_apply_func definition.
  *
@@ -68,6 +70,461 @@ void apply_cpu_config(void* states,
                       unsigned long long idle_ns,
                       unsigned int is_first_apply);
 
+/**
+ * A CPU table holds CPU states compiled once: each state's cores as a CPU set
+ * and its frequencies as numbers, so applying a state or finding the current
+ * one does not parse strings on every transition.
+ * CPU sets are sized for the highest CPU any state uses, so tables are not
+ * limited to POET_MAX_CORES. Frequencies are stored once per frequency domain,
+ * a group of CPUs that are always set to the same frequency, rather than once
+ * per CPU.
+ */
+typedef struct poet_cpu_table poet_cpu_table;
+
+/**
+ * Compile the given states into a CPU table. The states are not needed after
+ * this returns.
+ *
+ * @param states
+ * @param num_states
+ *
+ * @return the table, or NULL on failure (errno will be set)
+ */
+poet_cpu_table* cpu_table_init(const poet_cpu_state_t* states,
+                               unsigned int num_states);
+
+/**
+ * Free a CPU table.
+ *
+ * @param table
+ */
+void cpu_table_destroy(poet_cpu_table* table);
+
+/**
+ * Group the table's frequency domains by the kernel's cpufreq policies, read
+ * from each <sysfs_root>/cpufreq/policyN/related_cpus, so that each policy's
+ * frequency is written once instead of once per CPU. Domains in the same
+ * policy are merged unless a state sets different frequencies for them.
+ * Without any policies, the table is unchanged.
+ *
+ * @param table
+ * @param sysfs_root - the cpu directory, or NULL for /sys/devices/system/cpu
+ *
+ * @return the number of policies found, or -1 on failure (errno will be set)
+ */
+int cpu_table_discover_domains(poet_cpu_table* table,
+                               const char* sysfs_root);
+
+/**
+ * Same as apply_cpu_config, but using the table's compiled states.
+ *
+ * Compatible with the poet_apply_func definition.
+ *
+ * @param states - must be a poet_cpu_table*.
+ * @param num_states
+ * @param id
+ * @param last_id
+ * @param idle_ns
+ * @param is_first_apply
+ */
+void apply_cpu_table(void* states,
+                     unsigned int num_states,
+                     unsigned int id,
+                     unsigned int last_id,
+                     unsigned long long idle_ns,
+                     unsigned int is_first_apply);
+
+/**
+ * Time lost switching between CPU states, for use with poet_set_switch_cost()
+ * and get_cpu_switch_cost(). Changing the cores costs core_switch_sec, e.g. to
+ * migrate threads between clusters, and setting a different frequency in any
+ * frequency domain costs freq_switch_sec; a switch that does both costs both.
+ * States are compared as compiled in the table, so the same cores or
+ * frequencies written differently are not a change.
+ */
+typedef struct {
+  const poet_cpu_table* table;
+  real_t core_switch_sec;
+  real_t freq_switch_sec;
+} poet_cpu_switch_cost;
+
+/**
+ * Get the time lost switching between two CPU states.
+ *
+ * Compatible with the poet_switch_cost_func definition.
+ *
+ * @param states - must be a poet_cpu_switch_cost*.
+ * @param from_id
+ * @param to_id
+ */
+real_t get_cpu_switch_cost(const void* states,
+                           unsigned int from_id,
+                           unsigned int to_id);
+
+/**
+ * Idle this process for the given time without forking a helper process.
+ * All other threads of the process are paused by a signal
+ * (POET_CONFIG_IDLE_SIGNAL, SIGRTMIN + 3 by default) while the calling thread
+ * sleeps. Threads that block the signal keep running.
+ * Build with POET_CONFIG_IDLE_EXTERNAL to idle with the bard_idle binary
+ * instead when applying states.
+ *
+ * @param idle_ns
+ * @param achieved_ns - the measured idle time, may be NULL
+ *
+ * @return 0 on success, -1 if not all threads could be paused (errno will be
+ *         set); the calling thread idles either way
+ */
+int idle_process(unsigned long long idle_ns, unsigned long long* achieved_ns);
+
+/**
+ * A CPU actuator keeps the DVFS file of each CPU open, so applying a state
+ * writes its frequencies directly instead of running a shell for each CPU.
+ * Core masks are parsed once, and only this process's threads get the new
+ * affinity unless cpu_actuator_set_follow_children() is used.
+ * The actuator remembers the frequencies and cores it last applied, and only
+ * writes those that change. It periodically checks them against the system
+ * in case something else changed them (see
+ * cpu_actuator_set_revalidate_period()).
+ */
+typedef struct poet_cpu_actuator poet_cpu_actuator;
+
+/**
+ * Create a CPU actuator for the given states, opening the DVFS file of one
+ * CPU in each cpufreq policy whose frequency is set by any state (see
+ * cpu_table_discover_domains()).
+ * The states are compiled into a CPU table, so they are not needed after this
+ * returns.
+ *
+ * @param states
+ * @param num_states
+ * @param sysfs_root - the cpu directory, or NULL for /sys/devices/system/cpu
+ *
+ * @return the actuator, or NULL on failure (errno will be set)
+ */
+poet_cpu_actuator* cpu_actuator_init(const poet_cpu_state_t* states,
+                                     unsigned int num_states,
+                                     const char* sysfs_root);
+
+/**
+ * Close the actuator's files and free it.
+ *
+ * @param actuator
+ */
+void cpu_actuator_destroy(poet_cpu_actuator* actuator);
+
+/**
+ * Same as apply_cpu_config, but frequencies are written through the
+ * actuator's open files. Failed writes are reported with the error they
+ * returned and counted.
+ *
+ * Compatible with the poet_apply_func definition.
+ *
+ * @param states - must be a poet_cpu_actuator*.
+ * @param num_states
+ * @param id
+ * @param last_id
+ * @param idle_ns
+ * @param is_first_apply
+ */
+void apply_cpu_actuator(void* states,
+                        unsigned int num_states,
+                        unsigned int id,
+                        unsigned int last_id,
+                        unsigned long long idle_ns,
+                        unsigned int is_first_apply);
+
+/**
+ * Choose whether core masks are also applied to child processes (and their
+ * descendants) of this process, not just its threads. Off by default.
+ * Without CONFIG_PROC_CHILDREN, children are found by scanning /proc,
+ * which is much slower.
+ *
+ * @param actuator
+ * @param follow_children
+ */
+void cpu_actuator_set_follow_children(poet_cpu_actuator* actuator,
+                                      int follow_children);
+
+/**
+ * Get the number of times the actuator idled the process, and the total idle
+ * time requested and achieved.
+ *
+ * @param actuator
+ * @param num_idles - may be NULL
+ * @param requested_ns - may be NULL
+ * @param achieved_ns - may be NULL
+ */
+void cpu_actuator_get_idle_stats(const poet_cpu_actuator* actuator,
+                                 unsigned long* num_idles,
+                                 unsigned long long* requested_ns,
+                                 unsigned long long* achieved_ns);
+
+/**
+ * Set how often the actuator checks the frequencies and cores it last applied
+ * against sysfs and this process's affinity, rewriting any that changed.
+ * The default is every POET_CONFIG_REVALIDATE_PERIOD (100) applies.
+ *
+ * @param actuator
+ * @param applies - applies between checks, or 0 to never check
+ */
+void cpu_actuator_set_revalidate_period(poet_cpu_actuator* actuator,
+                                        unsigned int applies);
+
+/**
+ * Get the number of frequency writes, of writes skipped because the domain
+ * was already at the frequency, and of applied values found to be stale when
+ * revalidating.
+ *
+ * @param actuator
+ * @param num_writes - may be NULL
+ * @param num_skipped - may be NULL
+ * @param num_stale - may be NULL
+ */
+void cpu_actuator_get_write_stats(const poet_cpu_actuator* actuator,
+                                  unsigned long* num_writes,
+                                  unsigned long* num_skipped,
+                                  unsigned long* num_stale);
+
+/**
+ * Get the number of failed frequency writes and core mask changes.
+ *
+ * @param actuator
+ * @param last_errno - the error of the last failure, may be NULL
+ */
+unsigned long cpu_actuator_get_errors(const poet_cpu_actuator* actuator,
+                                      int* last_errno);
+
+/**
+ * A cgroup actuator applies states to a cgroup v2 group instead of to this
+ * process's threads: a state's core mask is written to the group's
+ * cpuset.cpus, which moves all its threads at once, and idle time throttles
+ * the group with cpu.max. Frequencies are not set, since the DVFS files are
+ * usually not writable from containers.
+ * Idle periods of at least 2 ms set cpu.max to a 1 ms quota per idle period
+ * (at most 1 s) and restore it when the idle ends; shorter ones fall back to
+ * idle_process(). The group may still use its quota, so idling is less exact
+ * than with idle_process().
+ */
+typedef struct poet_cgroup_actuator poet_cgroup_actuator;
+
+/**
+ * Create a cgroup actuator for the given states, opening the group's
+ * cpuset.cpus and cpu.max files.
+ * The states are compiled into a CPU table, so they are not needed after this
+ * returns.
+ *
+ * @param states
+ * @param num_states
+ * @param cgroup - the group directory, or NULL for this process's group under
+ *                 /sys/fs/cgroup
+ *
+ * @return the actuator, or NULL on failure (errno will be set)
+ */
+poet_cgroup_actuator* cgroup_actuator_init(const poet_cpu_state_t* states,
+                                           unsigned int num_states,
+                                           const char* cgroup);
+
+/**
+ * Close the actuator's files and free it.
+ *
+ * @param actuator
+ */
+void cgroup_actuator_destroy(poet_cgroup_actuator* actuator);
+
+/**
+ * Same as apply_cpu_config, but cores are assigned to the actuator's cgroup
+ * and idle time throttles it. Failed writes are reported with the error they
+ * returned and counted.
+ *
+ * Compatible with the poet_apply_func definition.
+ *
+ * @param states - must be a poet_cgroup_actuator*.
+ * @param num_states
+ * @param id
+ * @param last_id
+ * @param idle_ns
+ * @param is_first_apply
+ */
+void apply_cgroup_actuator(void* states,
+                           unsigned int num_states,
+                           unsigned int id,
+                           unsigned int last_id,
+                           unsigned long long idle_ns,
+                           unsigned int is_first_apply);
+
+/**
+ * Get the number of times the actuator idled the cgroup, and the total idle
+ * time requested and achieved.
+ *
+ * @param actuator
+ * @param num_idles - may be NULL
+ * @param requested_ns - may be NULL
+ * @param achieved_ns - may be NULL
+ */
+void cgroup_actuator_get_idle_stats(const poet_cgroup_actuator* actuator,
+                                    unsigned long* num_idles,
+                                    unsigned long long* requested_ns,
+                                    unsigned long long* achieved_ns);
+
+/**
+ * Get the number of failed cpuset.cpus and cpu.max writes.
+ *
+ * @param actuator
+ * @param last_errno - the error of the last failure, may be NULL
+ */
+unsigned long cgroup_actuator_get_errors(const poet_cgroup_actuator* actuator,
+                                         int* last_errno);
+
+/**
+ * Determine the current state from the cgroup's cpuset.cpus, returning the
+ * first state with the same cores. Returns 0 on success, -1 otherwise.
+ *
+ * Compatible with the poet_curr_state_func definition.
+ *
+ * @param states - must be a poet_cgroup_actuator*.
+ * @param num_states
+ * @param curr_state_id
+ */
+int get_current_cgroup_actuator_state(const void* states,
+                                      unsigned int num_states,
+                                      unsigned int* curr_state_id);
+
+/**
+ * An actuator backend sets one kind of knob for the states of a CPU table.
+ * Backends are registered by name, and an actuator combines any of them, so a
+ * state can set cores, frequencies, a power limit, and idle time at once.
+ * The built-in backends are:
+ *  - "cores": sets this process's affinity to the state's cores
+ *  - "dvfs": writes the state's frequencies like a CPU actuator
+ *  - "rapl": writes the state's power limits to
+ *    <sysfs_root>/class/powercap/intel-rapl:N/constraint_0_power_limit_uw,
+ *    restoring the original limits when the actuator is destroyed
+ *  - "idle": idles this process like idle_process()
+ */
+typedef struct poet_actuator_backend {
+  const char* name;
+  // create the backend's state; the table outlives it. Returns NULL on
+  // failure (errno will be set)
+  void* (*init)(poet_cpu_table* table, const char* sysfs_root);
+  // apply a state, returns 0 or an errno value
+  int (*apply)(void* backend, unsigned int id, unsigned int last_id,
+               unsigned long long idle_ns, unsigned int is_first_apply);
+  void (*destroy)(void* backend);
+} poet_actuator_backend;
+
+/**
+ * Register a backend, which must outlive all actuators using it.
+ *
+ * @param backend
+ *
+ * @return 0 on success, -1 on failure (errno is EEXIST if the name is taken,
+ * ENOSPC if there are too many backends)
+ */
+int actuator_register_backend(const poet_actuator_backend* backend);
+
+/**
+ * Find a registered backend by name.
+ *
+ * @param name
+ *
+ * @return the backend, or NULL if there is none
+ */
+const poet_actuator_backend* actuator_get_backend(const char* name);
+
+/**
+ * An actuator applies each state through a list of backends, in order.
+ */
+typedef struct poet_actuator poet_actuator;
+
+/**
+ * Create an actuator that applies the table's states with the given backends.
+ * The table must outlive the actuator. The "dvfs" backend groups the table's
+ * frequency domains by cpufreq policy (see cpu_table_discover_domains()).
+ *
+ * @param table
+ * @param backends - comma-separated backend names, e.g. "cores,dvfs,rapl",
+ *                   or NULL for "cores", "idle", and "dvfs" and "rapl" if the
+ *                   table has frequencies and power limits
+ * @param sysfs_root - the sysfs directory, or NULL for /sys
+ *
+ * @return the actuator, or NULL on failure (errno will be set)
+ */
+poet_actuator* actuator_init(poet_cpu_table* table,
+                             const char* backends,
+                             const char* sysfs_root);
+
+/**
+ * Destroy the actuator's backends in reverse order and free it.
+ *
+ * @param actuator
+ */
+void actuator_destroy(poet_actuator* actuator);
+
+/**
+ * Apply a state through each of the actuator's backends. Failures are
+ * counted.
+ *
+ * Compatible with the poet_apply_func definition.
+ *
+ * @param states - must be a poet_actuator*.
+ * @param num_states
+ * @param id
+ * @param last_id
+ * @param idle_ns
+ * @param is_first_apply
+ */
+void apply_actuator(void* states,
+                    unsigned int num_states,
+                    unsigned int id,
+                    unsigned int last_id,
+                    unsigned long long idle_ns,
+                    unsigned int is_first_apply);
+
+/**
+ * Get the number of failed backend applies.
+ *
+ * @param actuator
+ * @param last_errno - the error of the last failure, may be NULL
+ */
+unsigned long actuator_get_errors(const poet_actuator* actuator,
+                                  int* last_errno);
+
+/**
+ * Reads the energy counters of all RAPL packages in
+ * <sysfs_root>/class/powercap/intel-rapl:N/energy_uj, accounting for counter
+ * wraparound, to measure power with poet_set_sensing().
+ */
+typedef struct poet_rapl_energy poet_rapl_energy;
+
+/**
+ * Open the energy counters of all RAPL packages.
+ *
+ * @param sysfs_root - the sysfs directory, or NULL for /sys
+ *
+ * @return the reader, or NULL on failure (errno will be set)
+ */
+poet_rapl_energy* rapl_energy_init(const char* sysfs_root);
+
+/**
+ * Get the energy used by all packages since rapl_energy_init(), in
+ * microjoules. Counter wraparounds are accounted for; if a package's
+ * max_energy_range_uj could not be read, the energy it used between the
+ * reads around a wraparound is dropped. Not thread safe.
+ *
+ * Compatible with the poet_energy_func definition.
+ *
+ * @param rapl - must be a poet_rapl_energy*
+ */
+unsigned long long rapl_energy_read(void* rapl);
+
+/**
+ * Close the energy counters and free the reader.
+ *
+ * @param rapl
+ */
+void rapl_energy_destroy(poet_rapl_energy* rapl);
+
 /**
  * Read the control states from the file at the provided path and store in the
  * states pointer (states* is assigned). The number of states found is stored
@@ -98,6 +555,28 @@ int get_cpu_states(const char* path,
                    poet_cpu_state_t** states,
                    unsigned int* num_states);
 
+/**
+ * Same as get_cpu_states, but compile the states into a CPU table (table* is
+ * assigned). Returns 0 on success.
+ * Besides hex core masks and per-CPU frequency lists, states may list their
+ * cores like "0-3,8" and frequencies per group of CPUs like
+ * "0-3:1400000;4-7:2000000". Groups of different states must be equal or
+ * disjoint. Lines are not limited in length, so states may use any number of
+ * CPUs.
+ * An optional fourth column lists the RAPL power limit of each package in
+ * microwatts, like per-CPU frequencies ("15000000,-" limits intel-rapl:0 and
+ * leaves intel-rapl:1 alone), for use with actuator_init().
+ *
+ * The caller is responsible for destroying the table with cpu_table_destroy.
+ *
+ * @param path
+ * @param table
+ * @param num_states
+ */
+int get_cpu_table(const char* path,
+                  poet_cpu_table** table,
+                  unsigned int* num_states);
+
 /**
  * Attempt to determine the current system state and return the id.
  * Set curr_state_id if possible and return 0, otherwise return -1.
@@ -112,6 +591,32 @@ int get_current_cpu_state(const void* states,
                           unsigned int num_states,
                           unsigned int* curr_state_id);
 
+/**
+ * Same as get_current_cpu_state, for use with apply_cpu_table.
+ *
+ * Compatible with the poet_curr_state_func definition.
+ *
+ * @param states - must be a poet_cpu_table*.
+ * @param num_states
+ * @param curr_state_id
+ */
+int get_current_cpu_table_state(const void* states,
+                                unsigned int num_states,
+                                unsigned int* curr_state_id);
+
+/**
+ * Same as get_current_cpu_state, for use with apply_cpu_actuator.
+ *
+ * Compatible with the poet_curr_state_func definition.
+ *
+ * @param states - must be a poet_cpu_actuator*.
+ * @param num_states
+ * @param curr_state_id
+ */
+int get_current_cpu_actuator_state(const void* states,
+                                   unsigned int num_states,
+                                   unsigned int* curr_state_id);
+
 #ifdef __cplusplus
 }
 #endif
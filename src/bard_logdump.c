@@ -0,0 +1,98 @@
+/**
+ * Convert binary logs written with POET_LOG_BINARY to the text log format.
+ */
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "poet_log.h"
+#include "poet_math.h"
+
+#define RECORDS_PER_READ 1024
+
+static inline void usage(char* cmd) {
+  printf("Usage:\n");
+  printf("\t%s [-c] [-s] <log_file>\n", cmd);
+  printf("\t-c: write CSV instead of columns\n");
+  printf("\t-s: write the control states in control config format instead of records\n");
+}
+
+static void write_states(const poet_log_header* header,
+                         const poet_control_state_t* states) {
+  unsigned int i;
+  printf("# period: %u\n", header->period);
+  printf("#id\tspeedup\tpowerup\tidle_partner_id\n");
+  for (i = 0; i < header->num_states; i++) {
+    printf("%u\t%f\t%f\t%u\n", states[i].id, real_to_db(states[i].speedup),
+           real_to_db(states[i].cost), states[i].idle_partner_id);
+  }
+}
+
+int main(int argc, char** argv) {
+  int c;
+  int csv = 0;
+  int show_states = 0;
+  int ret = 0;
+  size_t n;
+  size_t i;
+  FILE* f;
+  poet_log_header header;
+  poet_control_state_t* states;
+  poet_record* records;
+
+  while ((c = getopt(argc, argv, "csh")) != -1) {
+    switch (c) {
+      case 'c':
+        csv = 1;
+        break;
+      case 's':
+        show_states = 1;
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  f = fopen(argv[optind], "rb");
+  if (f == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (poet_log_read_binary_header(f, &header, &states)) {
+    fclose(f);
+    return 1;
+  }
+
+  if (show_states) {
+    write_states(&header, states);
+  } else {
+    records = malloc(RECORDS_PER_READ * sizeof(poet_record));
+    if (records == NULL) {
+      perror("malloc");
+      ret = 1;
+    } else {
+      poet_log_write_text_header(stdout, csv);
+      while ((n = fread(records, sizeof(poet_record), RECORDS_PER_READ, f)) > 0) {
+        for (i = 0; i < n; i++) {
+          poet_log_write_text_record(stdout, &records[i], csv);
+        }
+      }
+      if (ferror(f)) {
+        perror(argv[optind]);
+        ret = 1;
+      }
+      free(records);
+    }
+  }
+
+  free(states);
+  fclose(f);
+  return ret;
+}
@@ -0,0 +1,130 @@
+/**
+ * Print live control decisions from a telemetry ring enabled with
+ * poet_set_telemetry().
+ */
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "poet_telemetry.h"
+#include "poet_math.h"
+
+#define DEFAULT_INTERVAL_MS 100
+#define ONE_MILLION 1000000
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig) {
+  (void) sig;
+  running = 0;
+}
+
+static inline void usage(char* cmd) {
+  printf("Usage:\n");
+  printf("\t%s [-i <interval_ms>] [-n <count>] <telemetry_file>\n", cmd);
+  printf("\t-i: how often to check for new records (default: %d ms)\n", DEFAULT_INTERVAL_MS);
+  printf("\t-n: exit after printing count records, starting with the oldest\n");
+}
+
+static void print_header(const poet_telemetry_header* header) {
+  printf("# pid: %" PRIu64 ", period: %u, ring: %u records\n",
+         header->pid, header->period, header->num_slots);
+  printf("%12s %12s %8s %8s %10s %12s %12s %12s %12s %12s\n",
+         "TAG", "CONSTRAINT", "LOWER_ID", "UPPER_ID", "LOW_ITERS", "IDLE_NS",
+         "P_X_HAT", "C_X_HAT", "SPEEDUP", "POWERUP");
+}
+
+static void print_record(const poet_record* record) {
+  printf("%12lu %12s %8d %8d %10d %12llu %12f %12f %12f %12f\n",
+         record->tag, record->constraint == POWER ? "POWER" : "PERFORMANCE",
+         record->lower_id, record->upper_id, record->low_state_iters,
+         record->idle_ns, real_to_db(record->pfs.x_hat),
+         real_to_db(record->cfs.x_hat), real_to_db(record->scs.u),
+         real_to_db(record->pcs.u));
+}
+
+int main(int argc, char** argv) {
+  int c;
+  long interval_ms = DEFAULT_INTERVAL_MS;
+  long long count = -1;
+  size_t size;
+  uint64_t next;
+  uint64_t head;
+  uint64_t oldest;
+  uint64_t missed = 0;
+  struct timespec ts;
+  poet_record record;
+  const poet_telemetry_header* header;
+
+  while ((c = getopt(argc, argv, "i:n:h")) != -1) {
+    switch (c) {
+      case 'i':
+        interval_ms = atol(optarg);
+        break;
+      case 'n':
+        count = atoll(optarg);
+        break;
+      case 'h':
+        usage(argv[0]);
+        return 0;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc - 1 || interval_ms <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  header = poet_telemetry_open(argv[optind], &size);
+  if (header == NULL) {
+    return 1;
+  }
+  signal(SIGINT, handle_signal);
+  signal(SIGTERM, handle_signal);
+  print_header(header);
+
+  // start with the oldest record still in the ring
+  head = poet_telemetry_get_head(header);
+  next = head > header->num_slots ? head - header->num_slots : 0;
+  ts.tv_sec = interval_ms / 1000;
+  ts.tv_nsec = (interval_ms % 1000) * ONE_MILLION;
+  while (running && count != 0) {
+    switch (poet_telemetry_read(header, next, &record)) {
+      case 0:
+        print_record(&record);
+        next++;
+        if (count > 0) {
+          count--;
+        }
+        break;
+      case 1:
+        // a torn read only loses the record if the controller lapped us,
+        // otherwise read it again
+        head = poet_telemetry_get_head(header);
+        if (head < next + header->num_slots) {
+          break;
+        }
+        // skip to the oldest record in the ring (the oldest slot may already
+        // be being overwritten too)
+        oldest = head - header->num_slots + 1;
+        missed += oldest - next;
+        next = oldest;
+        break;
+      default:
+        // caught up
+        fflush(stdout);
+        nanosleep(&ts, NULL);
+    }
+  }
+  fflush(stdout);
+  if (missed > 0) {
+    fprintf(stderr, "%" PRIu64 " records were overwritten before they could be read\n", missed);
+  }
+
+  poet_telemetry_close(header, size);
+  return 0;
+}
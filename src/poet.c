@@ -2,8 +2,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "poet.h"
+#include "poet_apply_thread.h"
 #include "poet_constants.h"
+#include "poet_kernels.h"
+#include "poet_log.h"
+#include "poet_sensing.h"
+#include "poet_stats.h"
+#include "poet_telemetry.h"
 #include "poet_math.h"
 
 #ifdef FIXED_POINT
@@ -18,50 +25,147 @@
 ##################################################
 */
 
-// Represents state of kalman filter used in estimate_workload
+// Control states as seen by one tradeoff type, in structure-of-arrays layout
+// so the translation loops stream contiguous memory without switching on the
+// constraint. Arrays are indexed by state id.
+// The hull is the lower (PERFORMANCE) or upper (POWER) convex hull of the
+// non-idle states in (1 / xup, xup cost / xup) space - time and cost per
+// iteration - sorted by increasing xup.
+// Time-dividing between two states moves along the line between them in that
+// space, so before rounding the optimal pair for a target xup is the hull
+// edge that brackets 1 / target.
 typedef struct {
-  real_t x_hat_minus;
-  real_t x_hat;
-  real_t p_minus;
-  real_t h;
-  real_t k;
-  real_t p;
-} filter_state;
-
-// Container for old speedup/powerup values and old errors
+  real_t * xup;
+  real_t * xup_cost;
+  real_t * partner_xup;
+  real_t * partner_xup_cost;
+  // POWER maximizes its cost (performance), PERFORMANCE minimizes it (power)
+  int maximize;
+  unsigned int * hull_ids;
+  unsigned int hull_len;
+  // idle states (xup < 1) are evaluated separately
+  unsigned int * idle_ids;
+  unsigned int idle_len;
+  // non-idle states sorted by xup, and the state with the best cost per xup
+  // among each suffix, for schedules that stay in one state
+  unsigned int * stay_ids;
+  unsigned int * stay_best_ids;
+  unsigned int stay_len;
+} xup_table;
+
+// The result of translating an xup into a pair of states
 typedef struct {
-  real_t u;
-  real_t uo;
-  real_t uoo;
-  real_t e;
-  real_t eo;
-  real_t umin;
-  real_t umax;
-} calc_xup_state;
-
-// Container for log records
-typedef struct {
-  unsigned long tag;
-  poet_tradeoff_type_t constraint;
-  real_t act_rate;
-  real_t act_power;
-  filter_state pfs;
-  calc_xup_state scs;
-  filter_state cfs;
-  calc_xup_state pcs;
-  real_t time_workload;
-  real_t energy_workload;
   int lower_id;
   int upper_id;
   int low_state_iters;
   unsigned long long idle_ns;
-} poet_record;
+  real_t cost;
+  real_t cost_xup;
+} translation;
+
+// A translation result, keyed on its quantized inputs
+typedef struct {
+  unsigned int valid;
+  poet_tradeoff_type_t constraint;
+  // TRANSLATE_FLAG_* values used for the translation
+  unsigned int flags;
+  long long xup_key;
+  long long workload_key;
+  translation result;
+} translation_cache_entry;
+
+// Kalman filter noise, kept out of filter_state so log records don't change
+typedef struct {
+  poet_filter_params params;
+  // noise for the next estimate, adapted from params if enabled
+  real_t q;
+  real_t r;
+  // running mean and mean absolute deviation of the innovations
+  real_t bias;
+  real_t mad;
+} filter_noise;
+
+// calculate_xup coefficients, which only depend on the controller parameters
+// F is folded into the others, and c and d are scaled by the workload w
+typedef struct {
+  real_t a;
+  real_t b;
+  real_t c;
+  real_t d;
+} xup_coefficients;
+
+#define TRANSLATE_FLAG_DISABLE_IDLE 0x1
+#define TRANSLATE_FLAG_N2           0x2
+
+// filter_state of up to BATCH_CHUNK instances, in structure-of-arrays layout
+typedef struct {
+  real_t x_hat_minus[BATCH_CHUNK];
+  real_t x_hat[BATCH_CHUNK];
+  real_t p_minus[BATCH_CHUNK];
+  real_t h[BATCH_CHUNK];
+  real_t k[BATCH_CHUNK];
+  real_t p[BATCH_CHUNK];
+  real_t q[BATCH_CHUNK];
+  real_t r[BATCH_CHUNK];
+  // NULL unless the filter is adaptive
+  filter_noise * noise[BATCH_CHUNK];
+} filter_batch;
+
+// calc_xup_state of up to BATCH_CHUNK instances, in structure-of-arrays layout
+typedef struct {
+  real_t u[BATCH_CHUNK];
+  real_t uo[BATCH_CHUNK];
+  real_t uoo[BATCH_CHUNK];
+  real_t e[BATCH_CHUNK];
+  real_t eo[BATCH_CHUNK];
+  real_t umin[BATCH_CHUNK];
+  real_t umax[BATCH_CHUNK];
+  real_t a[BATCH_CHUNK];
+  real_t b[BATCH_CHUNK];
+  real_t c[BATCH_CHUNK];
+  real_t d[BATCH_CHUNK];
+} calc_xup_batch;
+
+// Idle time assigned to a cooperative worker thread
+typedef struct {
+  unsigned long long idle_ns;
+  char pad[IDLE_SLOT_SIZE - sizeof(unsigned long long)];
+} idle_slot;
+
+// Cumulative work and energy of a producer thread, written only by its owner
+typedef struct {
+  unsigned long long work;
+  unsigned long long energy_uj;
+  char pad[PRODUCER_SLOT_SIZE - 2 * sizeof(unsigned long long)];
+} producer_slot;
 
 struct poet_internal_state {
-  // log file and log buffer
+  // log file and its writer thread
   FILE * log_file;
-  unsigned int buffer_depth;
-  poet_record * lb;
+  poet_log_writer * log_writer;
+  // live telemetry ring, may be NULL
+  poet_telemetry * telemetry;
+  // heartbeat window for poet_heartbeat(), may be NULL
+  poet_sensor * sensor;
+  int sensor_has_energy;
+  // last power measured by the sensor, 0 until there is one
+  real_t sensor_last_pwr;
+  // multi-producer ingestion, disabled when num_producers is 0
+  producer_slot * producer_slots;
+  // totals at the last step, only touched by the stepping thread
+  unsigned long long * producer_seen;
+  unsigned int num_producers;
+  unsigned long long producer_step_ns;
+  // work and energy of steps that could not be controlled yet
+  unsigned long long producer_pending_work;
+  unsigned long long producer_pending_uj;
+  // whether producers have ever reported energy
+  int producer_has_energy;
+  int stepping;
+  // phase timing, NULL when disabled
+  poet_stats * stats;
+  unsigned long long stats_start_ticks;
+  unsigned long long stats_start_ns;
 
   // constraint type
   poet_tradeoff_type_t constraint;
@@ -73,12 +177,20 @@ struct poet_internal_state {
   // cost filter state
   filter_state cfs;
 
+  // performance and cost filter noise
+  filter_noise pfn;
+  filter_noise cfn;
+
   // speedup calculation state
   calc_xup_state scs;
 
   // powerup calculation state
   calc_xup_state pcs;
 
+  // speedup/powerup controller
+  poet_controller_params controller;
+  xup_coefficients xc;
+
   // general
   int current_action;
 
@@ -94,6 +206,32 @@ struct poet_internal_state {
   unsigned int num_system_states;
   poet_apply_func apply;
   poet_control_state_t * control_states;
+  // indexed by poet_tradeoff_type_t
+  xup_table tables[2];
+  // table for the current constraint
+  const xup_table * table;
+  // pair evaluation kernel for the exhaustive search
+  const poet_kernel * kernel;
+
+  // direct-mapped translation cache, disabled when num_entries is 0
+  translation_cache_entry * tc;
+  unsigned int tc_num_entries;
+  real_t tc_xup_quantum;
+  real_t tc_workload_quantum;
+  unsigned long long tc_hits;
+  unsigned long long tc_misses;
+
+  // time lost switching between states, disabled when NULL
+  poet_switch_cost_func switch_cost;
+  const void * switch_cost_states;
+
+  // cooperative idle, disabled when num_idle_threads is 0
+  idle_slot * idle_slots;
+  unsigned int num_idle_threads;
+
+  // calls apply asynchronously, may be NULL
+  poet_apply_thread * apply_thread;
+
   void * apply_states;
   // track if we've ever applied a state
   // (assumption of initial state could be incorrect)
@@ -106,6 +244,187 @@ struct poet_internal_state {
 ##################################################
 */
 
+static inline real_t get_state_xup(const poet_control_state_t * cstate,
+                                   poet_tradeoff_type_t constraint) {
+  switch (constraint) {
+    case POWER:
+      return cstate->cost;
+    case PERFORMANCE:
+    default:
+      return cstate->speedup;
+  }
+}
+
+static inline real_t get_state_xup_cost(const poet_control_state_t * cstate,
+                                        poet_tradeoff_type_t constraint) {
+  switch (constraint) {
+    case POWER:
+      return cstate->speedup;
+    case PERFORMANCE:
+    default:
+      return cstate->cost;
+  }
+}
+
+static void free_xup_table(xup_table * table) {
+  // all real_t arrays share one allocation
+  free(table->xup);
+  free(table->hull_ids);
+  free(table->idle_ids);
+  free(table->stay_ids);
+  free(table->stay_best_ids);
+  memset(table, 0, sizeof(xup_table));
+}
+
+/*
+ * Build the state table and convex hull index used by translation.
+ * The hull is over time and cost per iteration. PERFORMANCE minimizes cost,
+ * so it keeps the lower hull; POWER maximizes performance, so it keeps the
+ * upper hull.
+ * Returns -1 on allocation failure.
+ */
+static int build_xup_table(xup_table * table,
+                           poet_tradeoff_type_t constraint,
+                           const poet_control_state_t * control_states,
+                           unsigned int num_system_states) {
+  unsigned int i;
+  unsigned int j;
+  unsigned int n = 0;
+  // pad each array to a cache line so they all stay aligned
+  size_t stride = (num_system_states * sizeof(real_t) + TABLE_ALIGNMENT - 1) /
+                  TABLE_ALIGNMENT * TABLE_ALIGNMENT / sizeof(real_t);
+  void * arrays;
+  // states are visited by decreasing time per iteration, so minimizing cost
+  // means we turn right along the hull, maximizing turns left
+  double turn;
+
+  memset(table, 0, sizeof(xup_table));
+  if (posix_memalign(&arrays, TABLE_ALIGNMENT, 4 * stride * sizeof(real_t))) {
+    return -1;
+  }
+  table->xup = (real_t *) arrays;
+  table->xup_cost = table->xup + stride;
+  table->partner_xup = table->xup_cost + stride;
+  table->partner_xup_cost = table->partner_xup + stride;
+  table->maximize = constraint == POWER ? 1 : 0;
+  table->hull_ids = malloc(num_system_states * sizeof(unsigned int));
+  table->idle_ids = malloc(num_system_states * sizeof(unsigned int));
+  table->stay_ids = malloc(num_system_states * sizeof(unsigned int));
+  table->stay_best_ids = malloc(num_system_states * sizeof(unsigned int));
+  if (table->hull_ids == NULL || table->idle_ids == NULL ||
+      table->stay_ids == NULL || table->stay_best_ids == NULL) {
+    free_xup_table(table);
+    return -1;
+  }
+  turn = table->maximize ? 1.0 : -1.0;
+
+  for (i = 0; i < num_system_states; i++) {
+    const poet_control_state_t * partner =
+      &control_states[control_states[i].idle_partner_id];
+    table->xup[i] = get_state_xup(&control_states[i], constraint);
+    table->xup_cost[i] = get_state_xup_cost(&control_states[i], constraint);
+    table->partner_xup[i] = get_state_xup(partner, constraint);
+    table->partner_xup_cost[i] = get_state_xup_cost(partner, constraint);
+  }
+
+  // insertion sort non-idle states by xup, then by preferred cost
+  for (i = 0; i < num_system_states; i++) {
+    if (table->xup[i] < R_ONE) {
+      table->idle_ids[table->idle_len++] = i;
+      continue;
+    }
+    for (j = n; j > 0; j--) {
+      unsigned int prev = table->hull_ids[j - 1];
+      if (table->xup[prev] < table->xup[i] ||
+          (table->xup[prev] <= table->xup[i] &&
+           (table->maximize ? table->xup_cost[prev] >= table->xup_cost[i] :
+                              table->xup_cost[prev] <= table->xup_cost[i]))) {
+        break;
+      }
+      table->hull_ids[j] = prev;
+    }
+    table->hull_ids[j] = i;
+    n++;
+  }
+
+  // best cost per xup from each sorted state on, preferring lower ids on ties
+  memcpy(table->stay_ids, table->hull_ids, n * sizeof(unsigned int));
+  table->stay_len = n;
+  for (i = n; i > 0; i--) {
+    unsigned int p = table->stay_ids[i - 1];
+    unsigned int b = i < n ? table->stay_best_ids[i] : p;
+    double pr = real_to_db(table->xup_cost[p]) / real_to_db(table->xup[p]);
+    double br = real_to_db(table->xup_cost[b]) / real_to_db(table->xup[b]);
+    if ((table->maximize ? pr > br : pr < br) || (pr <= br && pr >= br && p < b)) {
+      b = p;
+    }
+    table->stay_best_ids[i - 1] = b;
+  }
+
+  // monotone chain - states with a duplicate xup can never beat the first
+  for (i = 0; i < n; i++) {
+    unsigned int p = table->hull_ids[i];
+    double px = 1.0 / real_to_db(table->xup[p]);
+    double py = real_to_db(table->xup_cost[p]) * px;
+    if (table->hull_len > 0 &&
+        table->xup[table->hull_ids[table->hull_len - 1]] >= table->xup[p]) {
+      continue;
+    }
+    while (table->hull_len >= 2) {
+      unsigned int o = table->hull_ids[table->hull_len - 2];
+      unsigned int a = table->hull_ids[table->hull_len - 1];
+      double ox = 1.0 / real_to_db(table->xup[o]);
+      double oy = real_to_db(table->xup_cost[o]) * ox;
+      double ax = 1.0 / real_to_db(table->xup[a]);
+      double ay = real_to_db(table->xup_cost[a]) * ax;
+      double cross = (ax - ox) * (py - oy) - (ay - oy) * (px - ox);
+      if (cross * turn > 0) {
+        break;
+      }
+      table->hull_len--;
+    }
+    table->hull_ids[table->hull_len++] = p;
+  }
+
+  return 0;
+}
+
+/*
+ * Start (or restart) a filter's noise from its parameters.
+ */
+static void reset_filter_noise(filter_noise * noise) {
+  noise->q = noise->params.q;
+  noise->r = noise->params.r;
+  noise->bias = R_ZERO;
+  noise->mad = R_ZERO;
+}
+
+/*
+ * Compute the calculate_xup coefficients for the given controller parameters.
+ */
+static void compute_xup_coefficients(const poet_controller_params * params,
+                                     xup_coefficients * xc) {
+  real_t P1 = params->p1;
+  real_t P2 = params->p2;
+  real_t Z1 = params->z1;
+  real_t MU = params->mu;
+  // A   = -(-P1*Z1 - P2*Z1 + MU*P1*P2 - MU*P2 + P2 - MU*P1 + P1 + MU)
+  // B   = -(-MU*P1*P2*Z1 + P1*P2*Z1 + MU*P2*Z1 + MU*P1*Z1 - MU*Z1 - P1*P2)
+  // C   = ((MU - MU*P1)*P2 + MU*P1 - MU)*w
+  // D   = ((MU*P1-MU)*P2 - MU*P1 + MU)*w*Z1
+  // F   = 1.0/(Z1-1.0)
+  real_t A   = -(-mult(P1, Z1) - mult(P2, Z1) + mult3(MU, P1, P2) - mult(MU, P2) + P2 - mult(MU, P1) + P1 + MU);
+  real_t B   = -(-mult4(MU, P1, P2, Z1) + mult3(P1, P2, Z1) + mult3(MU, P2, Z1) + mult3(MU, P1, Z1) - mult(MU, Z1) - mult(P1, P2));
+  real_t C_W = mult(MU - mult(MU, P1), P2) + mult(MU, P1) - MU;
+  real_t D_W = mult(mult(MU, P1)-MU, P2) - mult(MU, P1) + MU;
+  real_t F   = div(R_ONE, Z1 - R_ONE);
+
+  xc->a = mult(F, A);
+  xc->b = mult(F, B);
+  xc->c = mult(F, C_W);
+  xc->d = mult3(F, D_W, Z1);
+}
+
 // Allocates and initializes a new poet state variable
 poet_state * poet_init(real_t goal,
                        poet_tradeoff_type_t constraint,
@@ -118,8 +437,11 @@ poet_state * poet_init(real_t goal,
                        unsigned int buffer_depth,
                        const char * log_filename) {
   unsigned int i;
+  int binary_log;
+  int log_err = 0;
 
-  if (goal <= R_ZERO || num_system_states == 0 || control_states == NULL || period == 0 ||
+  if (goal <= R_ZERO || (constraint != PERFORMANCE && constraint != POWER) ||
+      num_system_states == 0 || control_states == NULL || period == 0 ||
       (buffer_depth == 0 && log_filename != NULL)) {
     errno = EINVAL;
     return NULL;
@@ -131,8 +453,23 @@ poet_state * poet_init(real_t goal,
     return NULL;
   }
 
+  // Index the states for each tradeoff type
+  if (build_xup_table(&state->tables[PERFORMANCE], PERFORMANCE,
+                      control_states, num_system_states)) {
+    free(state);
+    return NULL;
+  }
+  if (build_xup_table(&state->tables[POWER], POWER,
+                      control_states, num_system_states)) {
+    free_xup_table(&state->tables[PERFORMANCE]);
+    free(state);
+    return NULL;
+  }
+
   // Remember constraint type
   state->constraint = constraint;
+  state->table = &state->tables[constraint];
+  state->kernel = poet_kernel_select();
 
   // Remember the constraint goal
   state->constraint_goal = goal;
@@ -140,38 +477,39 @@ poet_state * poet_init(real_t goal,
   // Remember the period
   state->period = period;
 
-  // Allocate memory for log buffer
-  state->buffer_depth = buffer_depth;
-  if (buffer_depth > 0) {
-    state->lb = malloc(buffer_depth * sizeof(poet_record));
-    if (state->lb == NULL) {
-      free(state);
-      return NULL;
-    }
-  } else {
-    state->lb = NULL;
-  }
-
-  // Open log file
+  // Open log file and start its writer
   if (log_filename == NULL) {
     state->log_file = NULL;
+    state->log_writer = NULL;
   } else {
     state->log_file = fopen(log_filename, "w");
     if (state->log_file == NULL) {
       perror(log_filename);
-      free(state->lb);
+      free_xup_table(&state->tables[PERFORMANCE]);
+      free_xup_table(&state->tables[POWER]);
+      free(state);
+      return NULL;
+    }
+    binary_log = getenv(POET_LOG_BINARY) == NULL ? 0 : 1;
+    if (binary_log) {
+      // records are written in large blocks
+      setvbuf(state->log_file, NULL, _IOFBF, LOG_BINARY_BUFFER_SIZE);
+      log_err = poet_log_write_binary_header(state->log_file, period,
+                                             num_system_states, control_states);
+    } else {
+      poet_log_write_text_header(state->log_file, 0);
+    }
+    if (!log_err) {
+      state->log_writer = poet_log_writer_create(state->log_file, buffer_depth,
+                                                 binary_log);
+    }
+    if (log_err || state->log_writer == NULL) {
+      fclose(state->log_file);
+      free_xup_table(&state->tables[PERFORMANCE]);
+      free_xup_table(&state->tables[POWER]);
       free(state);
       return NULL;
     }
-    fprintf(state->log_file,
-            "%16s %16s "
-            "%16s %16s %16s %16s %16s %16s %16s %16s %16s "
-            "%16s %16s %16s %16s %16s %16s %16s %16s %16s "
-            "%16s %16s %16s %16s %16s %16s\n",
-            "TAG", "CONSTRAINT",
-            "ACTUAL_RATE", "P_X_HAT_MINUS", "P_X_HAT", "P_P_MINUS", "P_H", "P_K", "P_P", "P_SPEEDUP", "P_ERROR",
-            "ACTUAL_POWER", "C_X_HAT_MINUS", "C_X_HAT", "C_P_MINUS", "C_H", "C_K", "C_P", "C_POWERUP", "C_ERROR",
-            "TIME_WORKLOAD", "ENERGY_WORKLOAD", "LOWER_ID", "UPPER_ID", "LOW_STATE_ITERS", "IDLE_NS");
   }
 
   // initialize variables used in the performance filter
@@ -201,6 +539,44 @@ poet_state * poet_init(real_t goal,
   state->upper_id = -1;
   state->lower_id = -1;
 
+  state->telemetry = NULL;
+  state->sensor = NULL;
+  state->sensor_has_energy = 0;
+  state->sensor_last_pwr = R_ZERO;
+  state->producer_slots = NULL;
+  state->producer_seen = NULL;
+  state->num_producers = 0;
+  state->producer_step_ns = 0;
+  state->producer_pending_work = 0;
+  state->producer_pending_uj = 0;
+  state->producer_has_energy = 0;
+  state->stepping = 0;
+  state->stats = NULL;
+
+  state->pfn.params.q = Q;
+  state->pfn.params.r = R;
+  state->pfn.params.adaptive = 0;
+  reset_filter_noise(&state->pfn);
+  state->cfn.params = state->pfn.params;
+  reset_filter_noise(&state->cfn);
+
+  poet_get_controller_preset(POET_CONTROLLER_FAST, &state->controller);
+  compute_xup_coefficients(&state->controller, &state->xc);
+
+  state->tc = NULL;
+  state->tc_num_entries = 0;
+  state->tc_xup_quantum = R_ZERO;
+  state->tc_workload_quantum = R_ZERO;
+  state->tc_hits = 0;
+  state->tc_misses = 0;
+
+  state->switch_cost = NULL;
+  state->switch_cost_states = NULL;
+
+  state->idle_slots = NULL;
+  state->num_idle_threads = 0;
+  state->apply_thread = NULL;
+
   // try to get the initial system state
   if (current == NULL || current(state->apply_states, state->num_system_states, &state->last_id)) {
     // default to the highest state id
@@ -254,10 +630,22 @@ poet_state * poet_init(real_t goal,
 // Destroys poet state variable
 void poet_destroy(poet_state * state) {
   if (state != NULL) {
+    // applies any pending request
+    poet_apply_thread_destroy(state->apply_thread);
+    // writes any remaining log records
+    poet_log_writer_destroy(state->log_writer);
     if (state->log_file != NULL) {
       fclose(state->log_file);
     }
-    free(state->lb);
+    poet_telemetry_destroy(state->telemetry);
+    poet_sensor_destroy(state->sensor);
+    free(state->producer_slots);
+    free(state->producer_seen);
+    free(state->stats);
+    free_xup_table(&state->tables[PERFORMANCE]);
+    free_xup_table(&state->tables[POWER]);
+    free(state->tc);
+    free(state->idle_slots);
     free(state);
   }
 }
@@ -266,86 +654,502 @@ void poet_destroy(poet_state * state) {
 void poet_set_constraint_type(poet_state * state,
                               poet_tradeoff_type_t constraint,
                               real_t goal) {
-  if (state != NULL && goal > R_ZERO) {
+  // unknown constraints would index past the xup tables
+  if (state != NULL && goal > R_ZERO && (constraint == PERFORMANCE || constraint == POWER)) {
     state->constraint = constraint;
+    state->table = &state->tables[constraint];
     state->constraint_goal = goal;
   }
 }
 
+// Get the parameters of a predefined controller
+void poet_get_controller_preset(poet_controller_preset_t preset,
+                                poet_controller_params * params) {
+  if (params == NULL) {
+    return;
+  }
+  switch (preset) {
+    case POET_CONTROLLER_SLOW:
+      params->p1 = P1_SLOW;
+      params->p2 = P2_SLOW;
+      params->z1 = Z1_SLOW;
+      params->mu = MU_SLOW;
+      break;
+    case POET_CONTROLLER_FAST:
+    default:
+      params->p1 = P1_FAST;
+      params->p2 = P2_FAST;
+      params->z1 = Z1_FAST;
+      params->mu = MU_FAST;
+  }
+}
+
+// Change the controller parameters at runtime
+int poet_set_controller_params(poet_state * state,
+                               const poet_controller_params * params) {
+  if (state == NULL || params == NULL ||
+      params->p1 <= -R_ONE || params->p1 >= R_ONE ||
+      params->p2 <= -R_ONE || params->p2 >= R_ONE ||
+      params->z1 <= -R_ONE || params->z1 >= R_ONE ||
+      params->mu <= R_ZERO) {
+    errno = EINVAL;
+    return -1;
+  }
+  state->controller = *params;
+  compute_xup_coefficients(&state->controller, &state->xc);
+  return 0;
+}
+
+// Get the current controller parameters
+void poet_get_controller_params(const poet_state * state,
+                                poet_controller_params * params) {
+  if (state != NULL && params != NULL) {
+    *params = state->controller;
+  }
+}
+
+static inline filter_noise * get_filter_noise(poet_state * state,
+                                              poet_filter_t filter) {
+  return filter == POET_FILTER_POWER ? &state->cfn : &state->pfn;
+}
+
+// Change a Kalman filter's noise parameters at runtime
+int poet_set_filter_params(poet_state * state,
+                           poet_filter_t filter,
+                           const poet_filter_params * params) {
+  filter_noise * noise;
+  if (state == NULL || params == NULL || params->q < R_ZERO || params->r <= R_ZERO) {
+    errno = EINVAL;
+    return -1;
+  }
+  noise = get_filter_noise(state, filter);
+  noise->params = *params;
+  reset_filter_noise(noise);
+  return 0;
+}
+
+// Get a Kalman filter's noise parameters
+void poet_get_filter_params(const poet_state * state,
+                            poet_filter_t filter,
+                            poet_filter_params * params) {
+  if (state != NULL && params != NULL) {
+    *params = filter == POET_FILTER_POWER ? state->cfn.params : state->pfn.params;
+  }
+}
+
+// Get the noise a Kalman filter will use next
+void poet_get_filter_noise(const poet_state * state,
+                           poet_filter_t filter,
+                           real_t * q,
+                           real_t * r) {
+  const filter_noise * noise;
+  if (state != NULL) {
+    noise = filter == POET_FILTER_POWER ? &state->cfn : &state->pfn;
+    if (q != NULL) {
+      *q = noise->q;
+    }
+    if (r != NULL) {
+      *r = noise->r;
+    }
+  }
+}
+
+// Enable or disable the translation cache
+int poet_set_translation_cache(poet_state * state,
+                               unsigned int num_entries,
+                               real_t xup_quantum,
+                               real_t workload_quantum) {
+  translation_cache_entry * tc = NULL;
+
+  if (state == NULL ||
+      (num_entries > 0 && (xup_quantum <= R_ZERO || workload_quantum <= R_ZERO))) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (num_entries > 0) {
+    // calloc marks all entries invalid
+    tc = calloc(num_entries, sizeof(translation_cache_entry));
+    if (tc == NULL) {
+      return -1;
+    }
+  }
+  free(state->tc);
+  state->tc = tc;
+  state->tc_num_entries = num_entries;
+  state->tc_xup_quantum = xup_quantum;
+  state->tc_workload_quantum = workload_quantum;
+  state->tc_hits = 0;
+  state->tc_misses = 0;
+  return 0;
+}
+
+// Get translation cache hit and miss counts
+void poet_get_translation_cache_stats(const poet_state * state,
+                                      unsigned long long * hits,
+                                      unsigned long long * misses) {
+  if (state != NULL) {
+    if (hits != NULL) {
+      *hits = state->tc_hits;
+    }
+    if (misses != NULL) {
+      *misses = state->tc_misses;
+    }
+  }
+}
+
+void poet_get_log_stats(const poet_state * state,
+                        unsigned long long * stalls,
+                        unsigned long long * dropped) {
+  if (stalls != NULL) {
+    *stalls = 0;
+  }
+  if (dropped != NULL) {
+    *dropped = 0;
+  }
+  if (state != NULL && state->log_writer != NULL) {
+    poet_log_writer_get_stats(state->log_writer, stalls, dropped);
+  }
+}
+
+// Set the time lost switching between states
+int poet_set_switch_cost(poet_state * state,
+                         poet_switch_cost_func cost,
+                         const void * cost_states) {
+  if (state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  state->switch_cost = cost;
+  state->switch_cost_states = cost_states;
+  // cached translations did not account for the new cost
+  if (state->tc_num_entries > 0) {
+    memset(state->tc, 0, state->tc_num_entries * sizeof(translation_cache_entry));
+  }
+  return 0;
+}
+
+// Enable or disable publishing records to a telemetry ring
+int poet_set_telemetry(poet_state * state,
+                       const char * path,
+                       unsigned int num_records) {
+  poet_telemetry * telemetry = NULL;
+
+  if (state == NULL || (path != NULL && num_records == 0)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (path != NULL) {
+    telemetry = poet_telemetry_create(path, num_records, state->period);
+    if (telemetry == NULL) {
+      return -1;
+    }
+  }
+  poet_telemetry_destroy(state->telemetry);
+  state->telemetry = telemetry;
+  return 0;
+}
+
+// Enable or disable measuring performance and power from heartbeats
+int poet_set_sensing(poet_state * state,
+                     unsigned int window_size,
+                     poet_energy_func energy,
+                     void * energy_arg) {
+  poet_sensor * sensor = NULL;
+
+  if (state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (window_size > 0) {
+    sensor = poet_sensor_create(window_size, energy, energy_arg);
+    if (sensor == NULL) {
+      return -1;
+    }
+  }
+  poet_sensor_destroy(state->sensor);
+  state->sensor = sensor;
+  state->sensor_has_energy = energy != NULL;
+  state->sensor_last_pwr = R_ZERO;
+  return 0;
+}
+
+// Enable or disable multi-producer ingestion
+int poet_set_producers(poet_state * state,
+                       unsigned int num_producers) {
+  void * slots = NULL;
+  unsigned long long * seen = NULL;
+  struct timespec ts;
+
+  if (state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (num_producers > 0) {
+    if (posix_memalign(&slots, PRODUCER_SLOT_SIZE, num_producers * sizeof(producer_slot))) {
+      errno = ENOMEM;
+      return -1;
+    }
+    // seen work and energy of each producer
+    seen = calloc(2 * num_producers, sizeof(unsigned long long));
+    if (seen == NULL) {
+      free(slots);
+      return -1;
+    }
+    memset(slots, 0, num_producers * sizeof(producer_slot));
+  }
+  free(state->producer_slots);
+  free(state->producer_seen);
+  state->producer_slots = (producer_slot *) slots;
+  state->producer_seen = seen;
+  state->num_producers = num_producers;
+  state->producer_pending_work = 0;
+  state->producer_pending_uj = 0;
+  state->producer_has_energy = 0;
+  // the first step's interval starts now
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  state->producer_step_ns = (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+  return 0;
+}
+
+// Enable or disable per-phase timing
+int poet_set_stats(poet_state * state,
+                   int enable) {
+  if (state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+#ifdef POET_STATS
+  free(state->stats);
+  state->stats = NULL;
+  if (enable) {
+    state->stats = calloc(1, sizeof(poet_stats));
+    if (state->stats == NULL) {
+      return -1;
+    }
+    state->stats_start_ticks = poet_stats_ticks();
+    state->stats_start_ns = poet_stats_ns();
+  }
+  return 0;
+#else
+  (void) enable;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+int poet_get_stats(const poet_state * state,
+                   poet_stats * stats) {
+  unsigned long long ticks;
+#ifndef POET_STATS
+  (void) state;
+  (void) stats;
+  (void) ticks;
+  errno = ENOSYS;
+  return -1;
+#else
+  if (state == NULL || stats == NULL || state->stats == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  *stats = *state->stats;
+  ticks = poet_stats_ticks() - state->stats_start_ticks;
+  stats->ns_per_tick = ticks == 0 ? 1.0 :
+                       (double) (poet_stats_ns() - state->stats_start_ns) / (double) ticks;
+  return 0;
+#endif
+}
+
+// Enable or disable cooperative idling by worker threads
+int poet_set_idle_threads(poet_state * state,
+                          unsigned int num_threads) {
+  void * slots = NULL;
+
+  if (state == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (num_threads > 0) {
+    if (posix_memalign(&slots, IDLE_SLOT_SIZE, num_threads * sizeof(idle_slot))) {
+      errno = ENOMEM;
+      return -1;
+    }
+    memset(slots, 0, num_threads * sizeof(idle_slot));
+  }
+  free(state->idle_slots);
+  state->idle_slots = (idle_slot *) slots;
+  state->num_idle_threads = num_threads;
+  return 0;
+}
+
+// Take the idle time assigned to a worker thread
+unsigned long long poet_take_idle_ns(poet_state * state,
+                                     unsigned int thread) {
+  unsigned long long * idle_ns;
+  if (state == NULL || thread >= state->num_idle_threads) {
+    return 0;
+  }
+  idle_ns = &state->idle_slots[thread].idle_ns;
+  // a plain load avoids writing the cache line when there is nothing to take
+  if (__atomic_load_n(idle_ns, __ATOMIC_RELAXED) == 0) {
+    return 0;
+  }
+  return __atomic_exchange_n(idle_ns, 0, __ATOMIC_RELAXED);
+}
+
+// Take the idle time assigned to a worker thread and sleep for it
+unsigned long long poet_idle_point(poet_state * state,
+                                   unsigned int thread) {
+  struct timespec ts;
+  unsigned long long idle_ns = poet_take_idle_ns(state, thread);
+  if (idle_ns > 0) {
+    ts.tv_sec = (time_t) (idle_ns / 1000000000ULL);
+    ts.tv_nsec = (long) (idle_ns % 1000000000ULL);
+    while (nanosleep(&ts, &ts) && errno == EINTR);
+  }
+  return idle_ns;
+}
+
+// Start or stop calling apply from a dedicated thread
+int poet_set_async_apply(poet_state * state,
+                         int enable) {
+  if (state == NULL || (enable && state->apply == NULL)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (enable && state->apply_thread == NULL) {
+    state->apply_thread = poet_apply_thread_create(state->apply, state->apply_states,
+                                                   state->num_system_states,
+                                                   state->last_id);
+    if (state->apply_thread == NULL) {
+      return -1;
+    }
+  } else if (!enable) {
+    poet_apply_thread_destroy(state->apply_thread);
+    state->apply_thread = NULL;
+  }
+  return 0;
+}
+
+int poet_get_async_apply_stats(const poet_state * state,
+                               poet_async_apply_stats * stats) {
+  if (state == NULL || state->apply_thread == NULL || stats == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  poet_apply_thread_get_stats(state->apply_thread, stats);
+  return 0;
+}
+
+int poet_get_time_in_states(const poet_state * state,
+                            unsigned long long * time_ns) {
+  if (state == NULL || state->apply_thread == NULL || time_ns == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  poet_apply_thread_get_time_in_states(state->apply_thread, time_ns);
+  return 0;
+}
+
+// Assign the idle time to each cooperative worker thread
+static inline void assign_idle_threads(poet_state * state) {
+  unsigned int i;
+  for (i = 0; i < state->num_idle_threads; i++) {
+    __atomic_store_n(&state->idle_slots[i].idle_ns, state->idle_ns, __ATOMIC_RELAXED);
+  }
+}
+
+static inline void fill_record(const poet_state * state,
+                               poet_record * record,
+                               unsigned long id,
+                               real_t act_rate, real_t act_power,
+                               real_t time_workload, real_t energy_workload) {
+  record->tag = id;
+  record->constraint = state->constraint;
+  record->act_rate = act_rate;
+  record->act_power = act_power;
+  // performance data
+  memcpy(&record->pfs, &state->pfs, sizeof(filter_state));
+  memcpy(&record->scs, &state->scs, sizeof(calc_xup_state));
+  // power data
+  memcpy(&record->cfs, &state->cfs, sizeof(filter_state));
+  memcpy(&record->pcs, &state->pcs, sizeof(calc_xup_state));
+  // other data
+  record->time_workload = time_workload;
+  record->energy_workload = energy_workload;
+  record->lower_id = state->lower_id;
+  record->upper_id = state->upper_id;
+  record->low_state_iters = state->low_state_iters;
+  record->idle_ns = state->idle_ns;
+}
+
 static inline void logger(const poet_state * state, unsigned long id,
                           real_t act_rate, real_t act_power,
                           real_t time_workload, real_t energy_workload) {
-  unsigned int index;
-  unsigned int i;
-
-  if (state->log_file != NULL) {
-    index = (id / state->period) % state->buffer_depth;
-    // copy to log buffer
-    state->lb[index].tag = id;
-    state->lb[index].constraint = state->constraint;
-    state->lb[index].act_rate = act_rate;
-    state->lb[index].act_power = act_power;
-    // performance data
-    memcpy(&state->lb[index].pfs, &state->pfs, sizeof(filter_state));
-    memcpy(&state->lb[index].scs, &state->scs, sizeof(calc_xup_state));
-    // power data
-    memcpy(&state->lb[index].cfs, &state->cfs, sizeof(filter_state));
-    memcpy(&state->lb[index].pcs, &state->pcs, sizeof(calc_xup_state));
-    // other data
-    state->lb[index].time_workload = time_workload;
-    state->lb[index].energy_workload = energy_workload;
-    state->lb[index].lower_id = state->lower_id;
-    state->lb[index].upper_id = state->upper_id;
-    state->lb[index].low_state_iters = state->low_state_iters;
-    state->lb[index].idle_ns = state->idle_ns;
-
-    if (index == state->buffer_depth - 1) {
-      for (i = 0; i < state->buffer_depth; i++) {
-        const char* constraint;
-        switch (state->constraint) {
-          case POWER:
-            constraint = "POWER";
-            break;
-          case PERFORMANCE:
-          default:
-            constraint = "PERFORMANCE";
-        }
-        fprintf(state->log_file, "%16lu %16s "
-                "%16f %16f %16f %16f %16f %16f %16f %16f %16f "
-                "%16f %16f %16f %16f %16f %16f %16f %16f %16f "
-                "%16f %16f %16d %16d %16d %16llu\n",
-                state->lb[i].tag,
-                constraint,
-                // performance data
-                real_to_db(state->lb[i].act_rate),
-                real_to_db(state->lb[i].pfs.x_hat_minus),
-                real_to_db(state->lb[i].pfs.x_hat),
-                real_to_db(state->lb[i].pfs.p_minus),
-                real_to_db(state->lb[i].pfs.h),
-                real_to_db(state->lb[i].pfs.k),
-                real_to_db(state->lb[i].pfs.p),
-                real_to_db(state->lb[i].scs.u),
-                real_to_db(state->lb[i].scs.e),
-                // power data
-                real_to_db(state->lb[i].act_power),
-                real_to_db(state->lb[i].cfs.x_hat_minus),
-                real_to_db(state->lb[i].cfs.x_hat),
-                real_to_db(state->lb[i].cfs.p_minus),
-                real_to_db(state->lb[i].cfs.h),
-                real_to_db(state->lb[i].cfs.k),
-                real_to_db(state->lb[i].cfs.p),
-                real_to_db(state->lb[i].pcs.u),
-                real_to_db(state->lb[i].pcs.e),
-                // other data
-                real_to_db(state->lb[i].time_workload),
-                real_to_db(state->lb[i].energy_workload),
-                state->lb[i].lower_id,
-                state->lb[i].upper_id,
-                state->lb[i].low_state_iters,
-                state->lb[i].idle_ns);
-      }
+  poet_record * record;
+  if (state->log_writer != NULL) {
+    // the writer thread formats and writes the record, unless it is too far
+    // behind and the record is dropped
+    record = poet_log_writer_next(state->log_writer);
+    if (record != NULL) {
+      fill_record(state, record, id, act_rate, act_power, time_workload, energy_workload);
+      poet_log_writer_commit(state->log_writer);
     }
   }
+  if (state->telemetry != NULL) {
+    fill_record(state, poet_telemetry_begin(state->telemetry), id,
+                act_rate, act_power, time_workload, energy_workload);
+    poet_telemetry_end(state->telemetry);
+  }
+}
+
+/*
+ * Adaptive filters only: if the innovation is far too large to be measurement
+ * noise, the workload changed, so raise the prior covariance until the
+ * innovation is expected and the estimate jumps to the new workload.
+ */
+static inline real_t inflate_p_minus(real_t innovation,
+                                     real_t h,
+                                     real_t p_minus,
+                                     real_t r) {
+  real_t innovation_sq = mult(innovation, innovation);
+  real_t expected_sq = mult3(h, p_minus, h) + r;
+  if (innovation_sq > mult(NOISE_JUMP_GATE, expected_sq)) {
+    p_minus += div(innovation_sq - expected_sq, mult(h, h));
+  }
+  return p_minus;
+}
+
+/*
+ * Adaptive filters only: estimate the measurement noise from the deviation
+ * of the innovations, and raise the process noise while the innovations have
+ * a significant bias, which means the estimate is lagging a workload change.
+ */
+static inline void adapt_filter_noise(filter_noise * noise,
+                                      real_t innovation,
+                                      real_t h) {
+  real_t deviation;
+  real_t bias_sq;
+  real_t r;
+
+  noise->bias += mult(NOISE_GAIN, innovation - noise->bias);
+  deviation = innovation - noise->bias;
+  deviation = deviation < R_ZERO ? -deviation : deviation;
+  noise->mad += mult(NOISE_GAIN, deviation - noise->mad);
+
+  r = mult3(NOISE_MAD_TO_VAR, noise->mad, noise->mad);
+  noise->r = r > noise->params.r ? r : noise->params.r;
+  bias_sq = mult(noise->bias, noise->bias);
+  if (bias_sq > mult(NOISE_BIAS_GATE, noise->r)) {
+    noise->q = div(bias_sq, mult(h, h));
+  } else {
+    noise->q = noise->params.q;
+  }
 }
 
 /*
@@ -358,18 +1162,26 @@ static inline void logger(const poet_state * state, unsigned long id,
  */
 static inline real_t estimate_base_workload(real_t current_workload,
                                             real_t last_xup,
+                                            filter_noise * noise,
                                             filter_state * state) {
   real_t _w;
+  real_t innovation;
 
   state->x_hat_minus = state->x_hat;
-  state->p_minus = state->p + Q;
+  state->p_minus = state->p + noise->q;
 
   state->h = last_xup;
+  innovation = current_workload - mult(state->h, state->x_hat_minus);
+  if (noise->params.adaptive) {
+    state->p_minus = inflate_p_minus(innovation, state->h, state->p_minus, noise->r);
+  }
   state->k = div(mult(state->p_minus, state->h),
-                 mult3(state->h, state->p_minus, state->h) + R);
-  state->x_hat = state->x_hat_minus + mult(state->k,
-                  (current_workload - mult(state->h, state->x_hat_minus)));
+                 mult3(state->h, state->p_minus, state->h) + noise->r);
+  state->x_hat = state->x_hat_minus + mult(state->k, innovation);
   state->p = mult(R_ONE - mult(state->k, state->h), state->p_minus);
+  if (noise->params.adaptive) {
+    adapt_filter_noise(noise, innovation, state->h);
+  }
 
   _w = div(R_ONE, state->x_hat);
 
@@ -383,22 +1195,14 @@ static inline real_t estimate_base_workload(real_t current_workload,
 static inline void calculate_xup(real_t current_rate,
                                  real_t desired_rate,
                                  real_t w,
+                                 const xup_coefficients * xc,
                                  calc_xup_state * state) {
-  // A   = -(-P1*Z1 - P2*Z1 + MU*P1*P2 - MU*P2 + P2 - MU*P1 + P1 + MU)
-  // B   = -(-MU*P1*P2*Z1 + P1*P2*Z1 + MU*P2*Z1 + MU*P1*Z1 - MU*Z1 - P1*P2)
-  // C   = ((MU - MU*P1)*P2 + MU*P1 - MU)*w
-  // D   = ((MU*P1-MU)*P2 - MU*P1 + MU)*w*Z1
-  // F   = 1.0/(Z1-1.0)
-  real_t A   = -(-mult(P1, Z1) - mult(P2, Z1) + mult3(MU, P1, P2) - mult(MU, P2) + P2 - mult(MU, P1) + P1 + MU);
-  real_t B   = -(-mult4(MU, P1, P2, Z1) + mult3(P1, P2, Z1) + mult3(MU, P2, Z1) + mult3(MU, P1, Z1) - mult(MU, Z1) - mult(P1, P2));
-  real_t C   = mult(mult(MU - mult(MU, P1), P2) + mult(MU, P1) - MU, w);
-  real_t D   = mult3(mult(mult(MU, P1)-MU, P2) - mult(MU, P1) + MU, w, Z1);
-  real_t F   = div(R_ONE, Z1 - R_ONE);
-
   state->e = desired_rate - current_rate;
 
   // Calculate speedup or powerup
-  state->u = mult(F , mult(A, state->uo) + mult(B, state->uoo) + mult(C, state->e) + mult(D, state->eo));
+  // u = F*(A*uo + B*uoo + C*e + D*eo), see compute_xup_coefficients
+  state->u = mult(xc->a, state->uo) + mult(xc->b, state->uoo) +
+             mult(w, mult(xc->c, state->e) + mult(xc->d, state->eo));
 
   // Speedups/powerups less than the minimum have no effect
   if (state->u < state->umin) {
@@ -441,38 +1245,26 @@ static inline void calculate_cost_xup(poet_state* state) {
 /*
  * Calculate the time division between the two system configuration states
  */
-static inline void calculate_time_division(poet_state * state,
-                                           real_t workload) {
+static inline void calculate_time_division(const xup_table * table,
+                                           real_t r_period,
+                                           real_t target_xup,
+                                           real_t workload,
+                                           unsigned int lower_id,
+                                           unsigned int upper_id,
+                                           translation * result) {
   real_t cost;
   real_t cost_xup;
-  real_t low_state_iters;
+  // must be integral, real_to_int does not truncate doubles
+  int low_state_iters;
   real_t idle_ns;
 
-  real_t lower_xup, partner_xup, upper_xup, target_xup;
-  real_t lower_xup_cost, partner_xup_cost, upper_xup_cost;
-  unsigned int partner_id = state->control_states[state->lower_id].idle_partner_id;
-  switch (state->constraint) {
-    case POWER:
-      lower_xup = state->control_states[state->lower_id].cost;
-      partner_xup = state->control_states[partner_id].cost;
-      upper_xup = state->control_states[state->upper_id].cost;
-      lower_xup_cost = state->control_states[state->lower_id].speedup;
-      partner_xup_cost = state->control_states[partner_id].speedup;
-      upper_xup_cost = state->control_states[state->upper_id].speedup;
-      target_xup = state->pcs.u;
-      break;
-    case PERFORMANCE:
-    default:
-      lower_xup = state->control_states[state->lower_id].speedup;
-      partner_xup = state->control_states[partner_id].speedup;
-      upper_xup = state->control_states[state->upper_id].speedup;
-      lower_xup_cost = state->control_states[state->lower_id].cost;
-      partner_xup_cost = state->control_states[partner_id].cost;
-      upper_xup_cost = state->control_states[state->upper_id].cost;
-      target_xup = state->scs.u;
-  }
+  real_t lower_xup = table->xup[lower_id];
+  real_t partner_xup = table->partner_xup[lower_id];
+  real_t upper_xup = table->xup[upper_id];
+  real_t lower_xup_cost = table->xup_cost[lower_id];
+  real_t partner_xup_cost = table->partner_xup_cost[lower_id];
+  real_t upper_xup_cost = table->xup_cost[upper_id];
 
-  real_t r_period = int_to_real(state->period);
   if (lower_xup < R_ONE) {
     // this is an idle state
 
@@ -516,126 +1308,441 @@ static inline void calculate_time_division(poet_state * state,
     }
   } else {
     // Calculate the time division between the upper and lower state
-    // If lower rate and upper rate are equal, no need for time division
-    real_t r_low_state_iters;
-    if (upper_xup <= lower_xup && upper_xup >= lower_xup) {
-      r_low_state_iters = R_ZERO;
-    } else {
-      // x represents the percentage of iterations spent in the first (lower)
-      // configuration
-      // Conversely, (1 - x) is the percentage of iterations in the second
-      // (upper) configuration
-      // This equation ensures the time period of the combined rates is equal
-      // to the time period of the target rate
-      // 1 / Target rate = X / (lower rate) + (1 - X) / (upper rate)
-      // Solve for X
-      real_t x = div(mult(upper_xup, lower_xup) - mult(target_xup, lower_xup),
-                     mult(upper_xup, target_xup) - mult(target_xup, lower_xup));
-
-      // Num of iterations (in lower state) = x * (controller period)
-      r_low_state_iters = mult(r_period, x);
-    }
-    low_state_iters = real_to_int(r_low_state_iters);
+    low_state_iters = kernel_low_state_iters(lower_xup, upper_xup,
+                                             target_xup, r_period);
     idle_ns = 0;
-    r_low_state_iters = int_to_real(low_state_iters); // calculate actual cost
-    cost = mult(div(r_low_state_iters, lower_xup), lower_xup_cost) +
-           mult(div(r_period - r_low_state_iters, upper_xup), upper_xup_cost);
+    real_t r_low_state_iters = int_to_real(low_state_iters); // calculate actual cost
+    cost = kernel_pair_cost(lower_xup, lower_xup_cost, upper_xup, upper_xup_cost,
+                            r_period, r_low_state_iters);
     cost_xup = div(mult(r_low_state_iters, lower_xup_cost) + mult(r_period - r_low_state_iters, upper_xup_cost), r_period);
   }
 
-  state->low_state_iters = low_state_iters;
-  state->idle_ns = idle_ns;
-  state->cost_estimate = cost;
-  state->cost_xup_estimate = cost_xup;
+  result->lower_id = lower_id;
+  result->upper_id = upper_id;
+  result->low_state_iters = low_state_iters;
+  result->idle_ns = idle_ns;
+  result->cost = cost;
+  result->cost_xup = cost_xup;
+}
+
+/*
+ * Charge the time lost switching between the pair's states in each period,
+ * in base iterations at the xup cost of the state being switched to.
+ */
+static inline void add_switch_cost(const poet_state * state,
+                                   const xup_table * table,
+                                   real_t workload,
+                                   translation * t) {
+  real_t lost;
+  unsigned int lower_id = (unsigned int) t->lower_id;
+  unsigned int upper_id = (unsigned int) t->upper_id;
+  if (state->switch_cost == NULL || lower_id == upper_id || workload <= R_ZERO ||
+      t->low_state_iters <= 0 || (unsigned int) t->low_state_iters >= state->period) {
+    return;
+  }
+  lost = mult(state->switch_cost(state->switch_cost_states, upper_id, lower_id),
+              table->xup_cost[lower_id]) +
+         mult(state->switch_cost(state->switch_cost_states, lower_id, upper_id),
+              table->xup_cost[upper_id]);
+  lost = div(lost, workload);
+  t->cost = table->maximize ? t->cost - lost : t->cost + lost;
+}
+
+static inline int is_better_translation(const xup_table * table,
+                                        const translation * t,
+                                        const translation * best) {
+  return table->maximize ? t->cost > best->cost : t->cost < best->cost;
 }
 
-static inline real_t get_control_xup(poet_state * state, int id) {
+/*
+ * Evaluate the (lower, upper) pair and remember it if it is the best
+ * configuration so far.
+ */
+static inline void consider_pair(const poet_state * state,
+                                 const xup_table * table,
+                                 real_t r_period,
+                                 real_t target_xup,
+                                 real_t workload,
+                                 unsigned int lower_id,
+                                 unsigned int upper_id,
+                                 translation * best) {
+  translation t;
+
+  // find time for both states
+  calculate_time_division(table, r_period, target_xup, workload,
+                          lower_id, upper_id, &t);
+  add_switch_cost(state, table, workload, &t);
+  // if this is the best configuration so far, remember it
+  if (is_better_translation(table, &t, best)) {
+    *best = t;
+  }
+}
+
+static inline void init_translation(const xup_table * table,
+                                    translation * best) {
+  best->lower_id = -1;
+  best->upper_id = -1;
+  best->low_state_iters = -1;
+  best->idle_ns = 0;
+  best->cost = table->maximize ? R_ZERO : BIG_REAL_T;
+  best->cost_xup = -1;
+}
+
+static inline void use_translation(poet_state * state,
+                                   const translation * best) {
+  state->lower_id = best->lower_id;
+  state->upper_id = best->upper_id;
+  state->low_state_iters = best->low_state_iters;
+  state->idle_ns = best->idle_ns;
+  state->cost_estimate = best->cost;
+  state->cost_xup_estimate = best->cost_xup;
+}
+
+static inline real_t get_target_xup(const poet_state * state) {
   switch (state->constraint) {
     case POWER:
-      return state->control_states[id].cost;
+      return state->pcs.u;
     case PERFORMANCE:
     default:
-      return state->control_states[id].speedup;
+      return state->scs.u;
   }
 }
 
+/*
+ * Whether to consider staying in a single state that exceeds the target.
+ * Below the slowest non-idle state only idling meets the target, so staying
+ * there is only worth it to avoid switching.
+ */
+static inline int can_stay(const poet_state * state,
+                           const xup_table * table,
+                           real_t target_xup,
+                           int disable_idle) {
+  return table->stay_len > 0 &&
+         (state->switch_cost != NULL || disable_idle || table->idle_len == 0 ||
+          target_xup >= table->xup[table->stay_ids[0]]);
+}
+
 /**
  * Check all pairs of states that can achieve the target and choose the pair
  * with the lowest cost. Uses an n^2 algorithm.
+ * Non-idle lower states are evaluated by the pair evaluation kernel.
+ * Kept to verify the results of translate_hull_with_time.
  */
 static inline void translate_n2_with_time(poet_state * state,
-                                          real_t workload) {
+                                          real_t workload,
+                                          int disable_idle) {
   unsigned int i;
   unsigned int j;
-  real_t target_xup;
-  real_t best_cost;
-  real_t best_cost_xup = -1;
-  int best_lower_id = -1;
-  int best_upper_id = -1;
-  int best_low_state_iters = -1;
-  unsigned long long best_idle_ns = 0;
-  real_t lower_xup;
-  real_t upper_xup;
-  int is_best;
-  int disable_idle = getenv(POET_DISABLE_IDLE) == NULL ? 0 : 1;
+  int kernel_id;
+  const xup_table * table = state->table;
+  const real_t * xup = table->xup;
+  real_t r_period = int_to_real(state->period);
+  real_t target_xup = get_target_xup(state);
+  int stay = can_stay(state, table, target_xup, disable_idle);
+  translation best;
+  translation row_best;
+  translation t;
 
-  switch (state->constraint) {
-    case POWER:
-      target_xup = state->pcs.u;
-      best_cost = R_ZERO;
-      break;
-    case PERFORMANCE:
-    default:
-      target_xup = state->scs.u;
-      best_cost = BIG_REAL_T;
-  }
+  init_translation(table, &best);
 
   for (i = 0; i < state->num_system_states; i++) {
-    upper_xup = get_control_xup(state, i);
-    if (upper_xup < target_xup || upper_xup < R_ONE) {
+    if (xup[i] < target_xup || xup[i] < R_ONE) {
       // upper_id cannot be an idle state
       continue;
     }
-    state->upper_id = i;
-    for (j = 0; j < state->num_system_states; j++) {
-      lower_xup = get_control_xup(state, j);
-      if (lower_xup > target_xup ||
-          (lower_xup < R_ONE && disable_idle > 0)) {
-        continue;
+    init_translation(table, &row_best);
+    if (stay) {
+      consider_pair(state, table, r_period, target_xup, workload, i, i, &row_best);
+    }
+    if (state->switch_cost != NULL) {
+      // the kernel doesn't know switching costs, so check each lower state
+      for (j = 0; j < state->num_system_states; j++) {
+        if (xup[j] <= target_xup && xup[j] >= R_ONE) {
+          consider_pair(state, table, r_period, target_xup, workload, j, i, &row_best);
+        }
       }
-      state->lower_id = j;
-      // find time for both states
-      calculate_time_division(state, workload);
-      // if this is the best configuration so far, remember it
-      switch (state->constraint) {
-        case POWER:
-          // maximize performance
-          is_best = state->cost_estimate > best_cost ? 1 : 0;
-          break;
-        case PERFORMANCE:
-        default:
-          // minimize power
-          is_best = state->cost_estimate < best_cost ? 1 : 0;
+    } else {
+      state->kernel->find_best_lower(xup, table->xup_cost, state->num_system_states,
+                                     xup[i], table->xup_cost[i], target_xup,
+                                     r_period, table->maximize,
+                                     &kernel_id, &row_best.cost);
+      if (kernel_id >= 0) {
+        calculate_time_division(table, r_period, target_xup, workload,
+                                kernel_id, i, &row_best);
       }
-      if (is_best > 0) {
-        best_lower_id = j;
-        best_upper_id = i;
-        best_low_state_iters = state->low_state_iters;
-        best_idle_ns = state->idle_ns;
-        best_cost = state->cost_estimate;
-        best_cost_xup = state->cost_xup_estimate;
+    }
+    if (disable_idle == 0) {
+      for (j = 0; j < table->idle_len; j++) {
+        if (xup[table->idle_ids[j]] > target_xup) {
+          continue;
+        }
+        calculate_time_division(table, r_period, target_xup, workload,
+                                table->idle_ids[j], i, &t);
+        add_switch_cost(state, table, workload, &t);
+        // on a tie, the lowest id would have been found first
+        if (is_better_translation(table, &t, &row_best)) {
+          row_best = t;
+        } else if (row_best.lower_id >= 0 && t.lower_id < row_best.lower_id &&
+                   t.cost <= row_best.cost && t.cost >= row_best.cost) {
+          row_best = t;
+        }
+      }
+    }
+    if (row_best.lower_id >= 0 && is_better_translation(table, &row_best, &best)) {
+      best = row_best;
+    }
+  }
+
+  // use the best configuration
+  use_translation(state, &best);
+}
+
+/**
+ * Get the state with the best cost of those that achieve the target on their
+ * own. There must be such a state.
+ */
+static inline unsigned int get_best_stay_id(const xup_table * table,
+                                            real_t target_xup) {
+  unsigned int lo = 0;
+  unsigned int hi = table->stay_len;
+  unsigned int mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (table->xup[table->stay_ids[mid]] < target_xup) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return table->stay_best_ids[lo];
+}
+
+/**
+ * Use the convex hull index to find the pair of non-idle states that brackets
+ * the target with a binary search. Idle states are evaluated against the hull
+ * vertices that can achieve the target.
+ * O(log n) when there are no idle states.
+ */
+static inline void translate_hull_with_time(poet_state * state,
+                                            real_t workload,
+                                            int disable_idle) {
+  const xup_table * table = state->table;
+  const unsigned int * hull = table->hull_ids;
+  unsigned int lo = 0;
+  unsigned int hi = table->hull_len;
+  unsigned int mid;
+  unsigned int i;
+  unsigned int j;
+  unsigned int i_min;
+  unsigned int j_max;
+  real_t r_period = int_to_real(state->period);
+  real_t target_xup = get_target_xup(state);
+  translation best;
+
+  init_translation(table, &best);
+
+  // find the first hull vertex that can achieve the target
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (table->xup[hull[mid]] < target_xup) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo < table->hull_len) {
+    if (table->xup[hull[lo]] <= target_xup) {
+      // exact match, no need for time division
+      consider_pair(state, table, r_period, target_xup, workload, hull[lo], hull[lo], &best);
+    } else if (lo > 0) {
+      // the bracketing edge is optimal before low_state_iters is rounded;
+      // nearby vertices may round in our favor
+      i_min = lo > HULL_NEIGHBORS ? lo - HULL_NEIGHBORS : 1;
+      j_max = lo + HULL_NEIGHBORS < table->hull_len ? lo + HULL_NEIGHBORS : table->hull_len - 1;
+      for (i = i_min - 1; i < lo; i++) {
+        for (j = lo; j <= j_max; j++) {
+          consider_pair(state, table, r_period, target_xup, workload, hull[i], hull[j], &best);
+        }
+      }
+    }
+
+    if (can_stay(state, table, target_xup, disable_idle)) {
+      // staying in a faster state off the hull may be cheaper than
+      // time-dividing, and avoids switching
+      i = get_best_stay_id(table, target_xup);
+      consider_pair(state, table, r_period, target_xup, workload, i, i, &best);
+    }
+
+    if (disable_idle == 0) {
+      for (i = 0; i < table->idle_len; i++) {
+        if (table->xup[table->idle_ids[i]] > target_xup) {
+          continue;
+        }
+        for (j = lo; j < table->hull_len; j++) {
+          consider_pair(state, table, r_period, target_xup, workload,
+                        table->idle_ids[i], hull[j], &best);
+        }
       }
-      state->idle_ns = 0;
     }
   }
 
   // use the best configuration
-  state->lower_id = best_lower_id;
-  state->upper_id = best_upper_id;
-  state->low_state_iters = best_low_state_iters;
-  state->idle_ns = best_idle_ns;
-  state->cost_estimate = best_cost;
-  state->cost_xup_estimate = best_cost_xup;
+  use_translation(state, &best);
+}
+
+/*
+ * Translate the target xup into a pair of system states and a time division
+ * between them.
+ */
+static inline long long quantize(real_t value, real_t quantum) {
+#ifdef FIXED_POINT
+  // both are Q16, so integer division gives the number of quanta
+  return value / quantum;
+#else
+  return (long long) (value / quantum);
+#endif
+}
+
+static inline translation_cache_entry * get_cache_entry(poet_state * state,
+                                                        unsigned int flags,
+                                                        long long xup_key,
+                                                        long long workload_key) {
+  unsigned long long h = (unsigned long long) xup_key * 0x9E3779B97F4A7C15ULL;
+  h ^= (unsigned long long) workload_key * 0xC2B2AE3D27D4EB4FULL;
+  h ^= (unsigned long long) (state->constraint * 4 + flags) * 0x165667B19E3779F9ULL;
+  return &state->tc[(h ^ (h >> 32)) % state->tc_num_entries];
+}
+
+/*
+ * Get the TRANSLATE_FLAG_* values set by environment variables.
+ */
+static inline unsigned int get_translate_flags(void) {
+  return (getenv(POET_DISABLE_IDLE) == NULL ? 0 : TRANSLATE_FLAG_DISABLE_IDLE) |
+         (getenv(POET_TRANSLATE_N2) == NULL ? 0 : TRANSLATE_FLAG_N2);
+}
+
+/*
+ * Translate the target xup into a pair of system states and a time division
+ * between them, using the translation cache if it is enabled.
+ */
+static inline void translate(poet_state * state,
+                             real_t workload,
+                             unsigned int flags) {
+  translation_cache_entry * entry = NULL;
+  long long xup_key = 0;
+  long long workload_key = 0;
+  int disable_idle = (flags & TRANSLATE_FLAG_DISABLE_IDLE) ? 1 : 0;
+
+  if (state->tc_num_entries > 0) {
+    xup_key = quantize(get_target_xup(state), state->tc_xup_quantum);
+    workload_key = quantize(workload, state->tc_workload_quantum);
+    entry = get_cache_entry(state, flags, xup_key, workload_key);
+    if (entry->valid && entry->constraint == state->constraint &&
+        entry->flags == flags && entry->xup_key == xup_key &&
+        entry->workload_key == workload_key) {
+      state->tc_hits++;
+      use_translation(state, &entry->result);
+      return;
+    }
+    state->tc_misses++;
+  }
+
+  if (flags & TRANSLATE_FLAG_N2) {
+    translate_n2_with_time(state, workload, disable_idle);
+  } else {
+    translate_hull_with_time(state, workload, disable_idle);
+  }
+
+  if (entry != NULL) {
+    entry->valid = 1;
+    entry->constraint = state->constraint;
+    entry->flags = flags;
+    entry->xup_key = xup_key;
+    entry->workload_key = workload_key;
+    entry->result.lower_id = state->lower_id;
+    entry->result.upper_id = state->upper_id;
+    entry->result.low_state_iters = state->low_state_iters;
+    entry->result.idle_ns = state->idle_ns;
+    entry->result.cost = state->cost_estimate;
+    entry->result.cost_xup = state->cost_xup_estimate;
+  }
+}
+
+/*
+ * Translates the xup computed by calculate_xup into system states for the
+ * next period and logs the decision.
+ */
+static inline void finish_control_decision(poet_state * state,
+                                           unsigned long id,
+                                           real_t perf,
+                                           real_t pwr,
+                                           real_t time_workload,
+                                           real_t energy_workload,
+                                           unsigned int flags) {
+  real_t workload;
+  switch (state->constraint) {
+    case POWER:
+      workload = energy_workload;
+      break;
+    case PERFORMANCE:
+    default:
+      workload = time_workload;
+  }
+
+  // Xup is translated into a system configuration
+  // A certain amount of time is assigned to each system configuration
+  // in order to achieve the requested Xup
+  POET_PHASE_BEGIN(state, translate_start);
+  translate(state, workload, flags);
+  calculate_cost_xup(state);
+  POET_PHASE_END(state, translate_start, POET_PHASE_TRANSLATE);
+
+  POET_PHASE_BEGIN(state, log_start);
+  logger(state, id,
+         perf, pwr,
+         time_workload, energy_workload);
+  POET_PHASE_END(state, log_start, POET_PHASE_LOG);
+}
+
+/*
+ * Applies the lower or upper state for this iteration and advances to the
+ * next iteration in the period.
+ */
+static inline void apply_iteration(poet_state * state,
+                                   int disable_apply) {
+  // Check which speedup should be applied, upper or lower
+  int config_id = -1;
+  if (state->low_state_iters > 0) {
+    config_id = state->lower_id;
+    state->low_state_iters--;
+  } else if (state->upper_id >= 0) {
+    config_id = state->upper_id;
+  }
+
+  if (config_id >= 0 && ((unsigned int) config_id != state->last_id || state->is_first_apply > 0)) {
+    POET_PHASE_BEGIN(state, apply_start);
+    if (!disable_apply && state->num_idle_threads > 0 && state->idle_ns > 0) {
+      // worker threads idle themselves instead
+      assign_idle_threads(state);
+      state->idle_ns = 0;
+    }
+    if (state->apply_thread != NULL && !disable_apply) {
+      poet_apply_thread_post(state->apply_thread, (unsigned int) config_id,
+                             state->idle_ns, state->is_first_apply);
+      state->is_first_apply = 0;
+    } else if (state->apply != NULL && !disable_apply) {
+      state->apply(state->apply_states, state->num_system_states, config_id,
+                   state->last_id, state->idle_ns, state->is_first_apply);
+      state->is_first_apply = 0;
+    }
+    state->last_id = config_id;
+    // only allow idle once per period
+    state->idle_ns = 0;
+    POET_PHASE_END(state, apply_start, POET_PHASE_APPLY);
+  }
+
+  state->current_action = (state->current_action + 1) % state->period;
 }
 
 // Runs POET decision engine and requests system changes
@@ -648,60 +1755,363 @@ void poet_apply_control(poet_state * state,
   }
 
   if (state->current_action == 0) {
+    POET_PHASE_BEGIN(state, estimate_start);
     // Estimate the performance workload
     // estimate time between iterations given minimum amount of resources
     real_t time_workload = estimate_base_workload(perf,
                                                   state->scs.u,
+                                                  &state->pfn,
                                                   &state->pfs);
     // Estimate the cost workload
     // estimate energy between iterations given minimum amount of resources
     real_t energy_workload = estimate_base_workload(pwr,
                                                     state->pcs.u,
+                                                    &state->cfn,
                                                     &state->cfs);
+    POET_PHASE_END(state, estimate_start, POET_PHASE_ESTIMATE);
 
     // Get a new goal speedup or powerup to apply to the application
-    real_t workload;
+    POET_PHASE_BEGIN(state, xup_start);
     switch (state->constraint) {
       case POWER:
-        calculate_xup(pwr, state->constraint_goal, energy_workload, &state->pcs);
-        workload = energy_workload;
+        calculate_xup(pwr, state->constraint_goal, energy_workload, &state->xc, &state->pcs);
         break;
       case PERFORMANCE:
       default:
-        calculate_xup(perf, state->constraint_goal, time_workload, &state->scs);
-        workload = time_workload;
+        calculate_xup(perf, state->constraint_goal, time_workload, &state->xc, &state->scs);
     }
+    POET_PHASE_END(state, xup_start, POET_PHASE_XUP);
+
+    finish_control_decision(state, id, perf, pwr, time_workload,
+                            energy_workload, get_translate_flags());
+  }
 
-    // Xup is translated into a system configuration
-    // A certain amount of time is assigned to each system configuration
-    // in order to achieve the requested Xup
-    translate_n2_with_time(state, workload);
-    calculate_cost_xup(state);
+  apply_iteration(state, getenv(POET_DISABLE_APPLY) != NULL);
+}
 
-    logger(state, id,
-           perf, pwr,
-           time_workload, energy_workload);
+// Convert a measured rate or power. In fixed point, values beyond the range
+// saturate instead of overflowing, and tiny ones are rounded up instead of to
+// 0, which the filters divide by
+static inline real_t measured_to_real(double x) {
+#ifdef FIXED_POINT
+  if (x > 32767.0) {
+    return BIG_REAL_T;
+  }
+  if (x > 0.0 && x < 1.0 / 65536.0) {
+    return (real_t) 1;
   }
+#endif
+  return CONST(x);
+}
 
-  // Check which speedup should be applied, upper or lower
-  int config_id = -1;
-  if (state->low_state_iters > 0) {
-    config_id = state->lower_id;
-    state->low_state_iters--;
-  } else if (state->upper_id >= 0) {
-    config_id = state->upper_id;
+void poet_heartbeat(poet_state * state,
+                    unsigned long id) {
+  double perf;
+  double pwr;
+  real_t pwr_real;
+
+  if (state == NULL || state->sensor == NULL) {
+    return;
+  }
+  poet_sensor_beat(state->sensor, &perf, &pwr);
+  if (!state->sensor_has_energy) {
+    // the cost filter needs a non-zero power even if it is not measured
+    pwr_real = R_ONE;
+  } else if (pwr > 0.0) {
+    pwr_real = measured_to_real(pwr);
+    state->sensor_last_pwr = pwr_real;
+  } else if (state->sensor_last_pwr > R_ZERO) {
+    // the energy counter has not advanced yet
+    pwr_real = state->sensor_last_pwr;
+  } else {
+    // nothing to decide with yet, but keep the schedule in step with the beats
+    if (getenv(POET_DISABLE_CONTROL) == NULL) {
+      apply_iteration(state, getenv(POET_DISABLE_APPLY) != NULL);
+    }
+    return;
   }
+  poet_apply_control(state, id, measured_to_real(perf), pwr_real);
+}
 
-  if (config_id >= 0 && ((unsigned int) config_id != state->last_id || state->is_first_apply > 0)) {
-    if (state->apply != NULL && getenv(POET_DISABLE_APPLY) == NULL) {
-      state->apply(state->apply_states, state->num_system_states, config_id,
-                   state->last_id, state->idle_ns, state->is_first_apply);
-      state->is_first_apply = 0;
+// Record work from a producer thread
+void poet_produce(poet_state * state,
+                  unsigned int producer,
+                  unsigned long long work,
+                  unsigned long long energy_uj) {
+  producer_slot * slot;
+  if (state == NULL || producer >= state->num_producers) {
+    return;
+  }
+  slot = &state->producer_slots[producer];
+  // only the owner writes the slot, so there is no need for a locked add
+  __atomic_store_n(&slot->work, __atomic_load_n(&slot->work, __ATOMIC_RELAXED) + work,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->energy_uj, __atomic_load_n(&slot->energy_uj, __ATOMIC_RELAXED) + energy_uj,
+                   __ATOMIC_RELAXED);
+}
+
+// Aggregate producers and run the controller
+int poet_control_step(poet_state * state,
+                      unsigned long id) {
+  struct timespec ts;
+  unsigned long long now_ns;
+  unsigned long long elapsed_ns;
+  unsigned long long work;
+  unsigned long long energy_uj;
+  unsigned long long total;
+  real_t pwr;
+  unsigned int i;
+
+  if (state == NULL || state->num_producers == 0 ||
+      __atomic_exchange_n(&state->stepping, 1, __ATOMIC_ACQUIRE)) {
+    return 0;
+  }
+
+  // producers' totals only grow, so each step takes the difference from the
+  // last one without writing to the producers' cache lines
+  work = state->producer_pending_work;
+  energy_uj = state->producer_pending_uj;
+  for (i = 0; i < state->num_producers; i++) {
+    total = __atomic_load_n(&state->producer_slots[i].work, __ATOMIC_RELAXED);
+    work += total - state->producer_seen[2 * i];
+    state->producer_seen[2 * i] = total;
+    total = __atomic_load_n(&state->producer_slots[i].energy_uj, __ATOMIC_RELAXED);
+    energy_uj += total - state->producer_seen[2 * i + 1];
+    state->producer_seen[2 * i + 1] = total;
+  }
+  if (energy_uj > 0) {
+    state->producer_has_energy = 1;
+  }
+  // without work there is no rate to control, and once producers report
+  // energy, a step without any has no power yet, so the interval continues
+  if (work == 0 || (state->producer_has_energy && energy_uj == 0)) {
+    state->producer_pending_work = work;
+    state->producer_pending_uj = energy_uj;
+    __atomic_store_n(&state->stepping, 0, __ATOMIC_RELEASE);
+    return 0;
+  }
+  state->producer_pending_work = 0;
+  state->producer_pending_uj = 0;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now_ns = (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+  elapsed_ns = now_ns - state->producer_step_ns;
+  if (elapsed_ns == 0) {
+    elapsed_ns = 1;
+  }
+  state->producer_step_ns = now_ns;
+
+  // uJ / ns = 1000 W, and the cost filter needs a non-zero power even if
+  // producers don't measure it
+  pwr = state->producer_has_energy ?
+        measured_to_real((double) energy_uj * 1000.0 / (double) elapsed_ns) : R_ONE;
+  poet_apply_control(state, id,
+                     measured_to_real((double) work * 1000000000.0 / (double) elapsed_ns), pwr);
+
+  __atomic_store_n(&state->stepping, 0, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static inline void filter_batch_load(filter_batch * fb,
+                                     unsigned int i,
+                                     const filter_state * fs,
+                                     filter_noise * noise) {
+  fb->x_hat_minus[i] = fs->x_hat_minus;
+  fb->x_hat[i] = fs->x_hat;
+  fb->p_minus[i] = fs->p_minus;
+  fb->h[i] = fs->h;
+  fb->k[i] = fs->k;
+  fb->p[i] = fs->p;
+  fb->q[i] = noise->q;
+  fb->r[i] = noise->r;
+  fb->noise[i] = noise->params.adaptive ? noise : NULL;
+}
+
+static inline void filter_batch_store(const filter_batch * fb,
+                                      unsigned int i,
+                                      filter_state * fs) {
+  fs->x_hat_minus = fb->x_hat_minus[i];
+  fs->x_hat = fb->x_hat[i];
+  fs->p_minus = fb->p_minus[i];
+  fs->h = fb->h[i];
+  fs->k = fb->k[i];
+  fs->p = fb->p[i];
+}
+
+static inline void calc_xup_batch_load(calc_xup_batch * xb,
+                                       unsigned int i,
+                                       const calc_xup_state * xs,
+                                       const xup_coefficients * xc) {
+  xb->u[i] = xs->u;
+  xb->uo[i] = xs->uo;
+  xb->uoo[i] = xs->uoo;
+  xb->e[i] = xs->e;
+  xb->eo[i] = xs->eo;
+  xb->umin[i] = xs->umin;
+  xb->umax[i] = xs->umax;
+  xb->a[i] = xc->a;
+  xb->b[i] = xc->b;
+  xb->c[i] = xc->c;
+  xb->d[i] = xc->d;
+}
+
+static inline void calc_xup_batch_store(const calc_xup_batch * xb,
+                                        unsigned int i,
+                                        calc_xup_state * xs) {
+  xs->u = xb->u[i];
+  xs->uo = xb->uo[i];
+  xs->uoo = xb->uoo[i];
+  xs->e = xb->e[i];
+  xs->eo = xb->eo[i];
+}
+
+/*
+ * estimate_base_workload for n instances.
+ * Performs the same operations so results are identical.
+ */
+static inline void estimate_base_workload_batch(unsigned int n,
+                                                const real_t * restrict current_workload,
+                                                const real_t * restrict last_xup,
+                                                filter_batch * restrict fb,
+                                                real_t * restrict w) {
+  unsigned int i;
+  real_t innovation;
+  for (i = 0; i < n; i++) {
+    fb->x_hat_minus[i] = fb->x_hat[i];
+    fb->p_minus[i] = fb->p[i] + fb->q[i];
+
+    fb->h[i] = last_xup[i];
+    innovation = current_workload[i] - mult(fb->h[i], fb->x_hat_minus[i]);
+    if (fb->noise[i] != NULL) {
+      fb->p_minus[i] = inflate_p_minus(innovation, fb->h[i], fb->p_minus[i], fb->r[i]);
     }
-    state->last_id = config_id;
-    // only allow idle once per period
-    state->idle_ns = 0;
+    fb->k[i] = div(mult(fb->p_minus[i], fb->h[i]),
+                   mult3(fb->h[i], fb->p_minus[i], fb->h[i]) + fb->r[i]);
+    fb->x_hat[i] = fb->x_hat_minus[i] + mult(fb->k[i], innovation);
+    fb->p[i] = mult(R_ONE - mult(fb->k[i], fb->h[i]), fb->p_minus[i]);
+    if (fb->noise[i] != NULL) {
+      adapt_filter_noise(fb->noise[i], innovation, fb->h[i]);
+    }
+
+    w[i] = div(R_ONE, fb->x_hat[i]);
   }
+}
 
-  state->current_action = (state->current_action + 1) % state->period;
+/*
+ * calculate_xup for n instances.
+ * Performs the same operations so results are identical.
+ */
+static inline void calculate_xup_batch(unsigned int n,
+                                       const real_t * restrict current_rate,
+                                       const real_t * restrict desired_rate,
+                                       const real_t * restrict w,
+                                       calc_xup_batch * restrict xb) {
+  unsigned int i;
+  real_t u;
+
+  for (i = 0; i < n; i++) {
+    xb->e[i] = desired_rate[i] - current_rate[i];
+
+    u = mult(xb->a[i], xb->uo[i]) + mult(xb->b[i], xb->uoo[i]) +
+        mult(w[i], mult(xb->c[i], xb->e[i]) + mult(xb->d[i], xb->eo[i]));
+    u = u < xb->umin[i] ? xb->umin[i] : u;
+    u = u > xb->umax[i] ? xb->umax[i] : u;
+    xb->u[i] = u;
+
+    xb->uoo[i] = xb->uo[i];
+    xb->uo[i]  = u;
+    xb->eo[i]  = xb->e[i];
+  }
+}
+
+// Runs POET decision engine for many instances
+void poet_apply_control_batch(poet_state * const * states,
+                              const unsigned long * ids,
+                              const real_t * perf,
+                              const real_t * pwr,
+                              unsigned int num_states) {
+  unsigned int start;
+  unsigned int end;
+  unsigned int i;
+  unsigned int n;
+  unsigned int flags;
+  int disable_apply;
+  poet_state * state;
+  // indexes of the instances in this chunk that make a control decision
+  unsigned int due[BATCH_CHUNK];
+  real_t b_perf[BATCH_CHUNK];
+  real_t b_pwr[BATCH_CHUNK];
+  real_t last_speedup[BATCH_CHUNK];
+  real_t last_powerup[BATCH_CHUNK];
+  real_t time_workload[BATCH_CHUNK];
+  real_t energy_workload[BATCH_CHUNK];
+  real_t rate[BATCH_CHUNK];
+  real_t goal[BATCH_CHUNK];
+  real_t workload[BATCH_CHUNK];
+  filter_batch pfb;
+  filter_batch cfb;
+  calc_xup_batch xb;
+
+  if (states == NULL || ids == NULL || perf == NULL || pwr == NULL ||
+      getenv(POET_DISABLE_CONTROL) != NULL) {
+    return;
+  }
+  flags = get_translate_flags();
+  disable_apply = getenv(POET_DISABLE_APPLY) != NULL;
+
+  for (start = 0; start < num_states; start += BATCH_CHUNK) {
+    end = num_states - start < BATCH_CHUNK ? num_states : start + BATCH_CHUNK;
+
+    // gather the filter states of instances at the start of a period
+    for (i = start, n = 0; i < end; i++) {
+      state = states[i];
+      if (state != NULL && state->current_action == 0) {
+        due[n] = i;
+        b_perf[n] = perf[i];
+        b_pwr[n] = pwr[i];
+        last_speedup[n] = state->scs.u;
+        last_powerup[n] = state->pcs.u;
+        filter_batch_load(&pfb, n, &state->pfs, &state->pfn);
+        filter_batch_load(&cfb, n, &state->cfs, &state->cfn);
+        n++;
+      }
+    }
+
+    estimate_base_workload_batch(n, b_perf, last_speedup, &pfb, time_workload);
+    estimate_base_workload_batch(n, b_pwr, last_powerup, &cfb, energy_workload);
+
+    // gather the xup state of each instance's constraint
+    for (i = 0; i < n; i++) {
+      state = states[due[i]];
+      goal[i] = state->constraint_goal;
+      switch (state->constraint) {
+        case POWER:
+          calc_xup_batch_load(&xb, i, &state->pcs, &state->xc);
+          rate[i] = b_pwr[i];
+          workload[i] = energy_workload[i];
+          break;
+        case PERFORMANCE:
+        default:
+          calc_xup_batch_load(&xb, i, &state->scs, &state->xc);
+          rate[i] = b_perf[i];
+          workload[i] = time_workload[i];
+      }
+    }
+
+    calculate_xup_batch(n, rate, goal, workload, &xb);
+
+    for (i = 0; i < n; i++) {
+      state = states[due[i]];
+      filter_batch_store(&pfb, i, &state->pfs);
+      filter_batch_store(&cfb, i, &state->cfs);
+      calc_xup_batch_store(&xb, i, state->constraint == POWER ? &state->pcs : &state->scs);
+      finish_control_decision(state, ids[due[i]], b_perf[i], b_pwr[i],
+                              time_workload[i], energy_workload[i], flags);
+    }
+
+    for (i = start; i < end; i++) {
+      if (states[i] != NULL) {
+        apply_iteration(states[i], disable_apply);
+      }
+    }
+  }
 }
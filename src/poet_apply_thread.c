@@ -0,0 +1,176 @@
+/**
+ * Apply thread with a latest-wins mailbox.
+ *
+ * The controller only takes the mailbox lock to copy a request into the slot,
+ * and the thread only takes it to copy the request out and to record when it
+ * took effect, so the apply function never runs with the lock held.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "poet_apply_thread.h"
+
+struct poet_apply_thread {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  int stop;
+
+  // the mailbox slot
+  int pending;
+  unsigned int id;
+  unsigned long long idle_ns;
+  unsigned int is_first_apply;
+
+  // only written by the apply thread, with the lock held
+  unsigned int applied_id;
+  unsigned long long applied_ns;
+  unsigned long long * time_in_state;
+
+  unsigned long long posted;
+  unsigned long long applied;
+  unsigned long long superseded;
+
+  poet_apply_func apply;
+  void * apply_states;
+  unsigned int num_states;
+  pthread_t thread;
+};
+
+static inline unsigned long long get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static void * apply_thread_run(void * arg) {
+  poet_apply_thread * thread = (poet_apply_thread *) arg;
+  unsigned int id;
+  unsigned long long idle_ns;
+  unsigned int is_first_apply;
+  unsigned long long now;
+
+  pthread_mutex_lock(&thread->lock);
+  for (;;) {
+    while (!thread->pending && !thread->stop) {
+      pthread_cond_wait(&thread->wake, &thread->lock);
+    }
+    // pending requests are applied before stopping
+    if (!thread->pending) {
+      break;
+    }
+    id = thread->id;
+    idle_ns = thread->idle_ns;
+    is_first_apply = thread->is_first_apply;
+    thread->pending = 0;
+    pthread_mutex_unlock(&thread->lock);
+
+    thread->apply(thread->apply_states, thread->num_states, id,
+                  thread->applied_id, idle_ns, is_first_apply);
+    now = get_time_ns();
+
+    pthread_mutex_lock(&thread->lock);
+    thread->time_in_state[thread->applied_id] += now - thread->applied_ns;
+    thread->applied_id = id;
+    thread->applied_ns = now;
+    thread->applied++;
+  }
+  pthread_mutex_unlock(&thread->lock);
+  return NULL;
+}
+
+poet_apply_thread * poet_apply_thread_create(poet_apply_func apply,
+                                             void * apply_states,
+                                             unsigned int num_states,
+                                             unsigned int applied_id) {
+  int err;
+  poet_apply_thread * thread;
+
+  if (apply == NULL || applied_id >= num_states) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  thread = malloc(sizeof(poet_apply_thread));
+  if (thread == NULL) {
+    return NULL;
+  }
+  memset(thread, 0, sizeof(poet_apply_thread));
+  thread->time_in_state = calloc(num_states, sizeof(unsigned long long));
+  if (thread->time_in_state == NULL) {
+    free(thread);
+    return NULL;
+  }
+  thread->apply = apply;
+  thread->apply_states = apply_states;
+  thread->num_states = num_states;
+  thread->applied_id = applied_id;
+  thread->applied_ns = get_time_ns();
+  pthread_mutex_init(&thread->lock, NULL);
+  pthread_cond_init(&thread->wake, NULL);
+  err = pthread_create(&thread->thread, NULL, apply_thread_run, thread);
+  if (err) {
+    pthread_cond_destroy(&thread->wake);
+    pthread_mutex_destroy(&thread->lock);
+    free(thread->time_in_state);
+    free(thread);
+    errno = err;
+    return NULL;
+  }
+  return thread;
+}
+
+void poet_apply_thread_post(poet_apply_thread * thread,
+                            unsigned int id,
+                            unsigned long long idle_ns,
+                            unsigned int is_first_apply) {
+  pthread_mutex_lock(&thread->lock);
+  if (thread->pending) {
+    thread->superseded++;
+    // the replaced request may have been the first
+    is_first_apply |= thread->is_first_apply;
+  }
+  thread->id = id;
+  thread->idle_ns = idle_ns;
+  thread->is_first_apply = is_first_apply;
+  thread->pending = 1;
+  thread->posted++;
+  pthread_cond_signal(&thread->wake);
+  pthread_mutex_unlock(&thread->lock);
+}
+
+void poet_apply_thread_get_stats(poet_apply_thread * thread,
+                                 poet_async_apply_stats * stats) {
+  pthread_mutex_lock(&thread->lock);
+  stats->posted = thread->posted;
+  stats->applied = thread->applied;
+  stats->superseded = thread->superseded;
+  stats->applied_id = thread->applied_id;
+  stats->applied_ns = thread->applied_ns;
+  pthread_mutex_unlock(&thread->lock);
+}
+
+void poet_apply_thread_get_time_in_states(poet_apply_thread * thread,
+                                          unsigned long long * time_ns) {
+  unsigned long long now;
+  pthread_mutex_lock(&thread->lock);
+  now = get_time_ns();
+  memcpy(time_ns, thread->time_in_state, thread->num_states * sizeof(unsigned long long));
+  time_ns[thread->applied_id] += now - thread->applied_ns;
+  pthread_mutex_unlock(&thread->lock);
+}
+
+void poet_apply_thread_destroy(poet_apply_thread * thread) {
+  if (thread != NULL) {
+    pthread_mutex_lock(&thread->lock);
+    thread->stop = 1;
+    pthread_cond_signal(&thread->wake);
+    pthread_mutex_unlock(&thread->lock);
+    pthread_join(thread->thread, NULL);
+    pthread_cond_destroy(&thread->wake);
+    pthread_mutex_destroy(&thread->lock);
+    free(thread->time_in_state);
+    free(thread);
+  }
+}
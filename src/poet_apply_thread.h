@@ -0,0 +1,58 @@
+#ifndef _POET_APPLY_THREAD_H
+#define _POET_APPLY_THREAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "poet.h"
+
+/*
+ * Calls the apply function from a background thread, so system changes stay
+ * off the control path.
+ * Requests are passed through a single-slot mailbox: a request that has not
+ * been applied yet is replaced by the next one (along with its idle time)
+ * rather than queued, since only the latest decision matters.
+ */
+typedef struct poet_apply_thread poet_apply_thread;
+
+/*
+ * Start an apply thread. The system is assumed to be in state applied_id
+ * from now until the first request is applied.
+ * Returns NULL and sets errno on failure.
+ */
+poet_apply_thread * poet_apply_thread_create(poet_apply_func apply,
+                                             void * apply_states,
+                                             unsigned int num_states,
+                                             unsigned int applied_id);
+
+/*
+ * Post a request, replacing any request that has not been applied yet.
+ */
+void poet_apply_thread_post(poet_apply_thread * thread,
+                            unsigned int id,
+                            unsigned long long idle_ns,
+                            unsigned int is_first_apply);
+
+/*
+ * Get the request counts and the state that was applied last.
+ */
+void poet_apply_thread_get_stats(poet_apply_thread * thread,
+                                 poet_async_apply_stats * stats);
+
+/*
+ * Get the time spent in each of the num_states states, up to now.
+ */
+void poet_apply_thread_get_time_in_states(poet_apply_thread * thread,
+                                          unsigned long long * time_ns);
+
+/*
+ * Apply any pending request, stop the thread, and free it.
+ */
+void poet_apply_thread_destroy(poet_apply_thread * thread);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
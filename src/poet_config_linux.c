@@ -1,12 +1,22 @@
 #define _GNU_SOURCE
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 #include "poet.h"
 #include "poet_config.h"
+#include "poet_math.h"
 
 #ifndef POET_CONTROL_STATE_CONFIG_FILE
   #define POET_CONTROL_STATE_CONFIG_FILE "/etc/poet/control_config"
@@ -23,317 +33,2485 @@
   #define POET_CONFIG_DVFS_FILE "scaling_setspeed"
 #endif
 
-#ifndef POET_CONFIG_IDLE_PATH
-  // binary that enforces idling our process
-  #define POET_CONFIG_IDLE_PATH "bard_idle"
+#ifndef POET_CONFIG_CPU_SYSFS
+  #define POET_CONFIG_CPU_SYSFS "/sys/devices/system/cpu"
 #endif
 
+#ifdef POET_CONFIG_IDLE_EXTERNAL
+  #ifndef POET_CONFIG_IDLE_PATH
+    // binary that enforces idling our process
+    #define POET_CONFIG_IDLE_PATH "bard_idle"
+  #endif
+#endif
+
+#ifndef POET_CONFIG_IDLE_SIGNAL
+  // pauses this process's other threads while idling
+  #define POET_CONFIG_IDLE_SIGNAL (SIGRTMIN + 3)
+#endif
+
+#ifndef POET_CONFIG_POWERCAP_SYSFS
+  #define POET_CONFIG_POWERCAP_SYSFS "/sys/class/powercap"
+#endif
+
+#ifndef POET_CONFIG_RAPL_CONSTRAINT
+  // the RAPL constraint whose power limit is set, 0 is the long term limit
+  #define POET_CONFIG_RAPL_CONSTRAINT 0
+#endif
+
+#ifndef POET_CONFIG_MAX_ACTUATOR_BACKENDS
+  #define POET_CONFIG_MAX_ACTUATOR_BACKENDS 16
+#endif
+
+#ifndef POET_CONFIG_REVALIDATE_PERIOD
+  // applies between checks of the CPU actuator's shadow state against sysfs
+  #define POET_CONFIG_REVALIDATE_PERIOD 100
+#endif
+
+#ifndef POET_CONFIG_CGROUP_ROOT
+  // cgroup v2 mount point
+  #define POET_CONFIG_CGROUP_ROOT "/sys/fs/cgroup"
+#endif
+
+#define IDLE_NS_PER_SEC 1000000000ULL
+
+// cpu.max quota a cgroup may use while idling (the kernel's minimum)
+#define CGROUP_IDLE_QUOTA_US 1000ULL
+// longest cpu.max period the kernel accepts
+#define CGROUP_MAX_PERIOD_US 1000000ULL
+// up to 5 digits and a comma for each CPU, plus a newline and terminating char
+#define LEN_CPU_LIST(num_cpus) ((size_t) (num_cpus) * 6 + 2)
+#define CGROUP_LEN_CPU_MAX 64
+
 /**
- * Get the current number of CPUs allocated for this process.
+ * Compare the current CPU governor state with the provided one.
+ * Returns -1 on failure.
  */
-static inline cpu_set_t* alloc_curr_cpu_assignment(unsigned long* num_cpus) {
-  cpu_set_t* cur_mask;
-  long num_configured_cpus = sysconf(_SC_NPROCESSORS_CONF);
-  if (num_configured_cpus <= 0) {
-    fprintf(stderr, "alloc_curr_cpu_assignment: Failed to get the number of "
-            "configured CPUs\n");
+static inline int cpu_governor_cmp(unsigned int cpu, const char* governor) {
+  FILE* fp;
+  char buffer[128];
+  int governor_cmp = -1;
+  size_t len;
+
+  snprintf(buffer, sizeof(buffer),
+           "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_governor", cpu);
+  fp = fopen(buffer, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "cpu_governor_cmp: Failed to open %s\n", buffer);
+    return -1;
+  }
+
+  if (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    // replace trailing newline
+    len = strlen(buffer);
+    if (len > 0 && buffer[len - 1] == '\n') {
+        buffer[len - 1] = '\0';
+    }
+    governor_cmp = strcmp(governor, buffer);
+  }
+  fclose(fp);
+
+  return governor_cmp;
+}
+
+/**
+ * Attempt to get the current frequency of the cpu.
+ */
+static inline unsigned long get_curr_cpu_frequency(unsigned long cpu) {
+  FILE* fp;
+  char buffer[128];
+  unsigned long curr_freq = 0;
+
+  snprintf(buffer, sizeof(buffer),
+           "/sys/devices/system/cpu/cpu%lu/cpufreq/scaling_cur_freq", cpu);
+  fp = fopen(buffer, "r");
+  if (fp == NULL) {
+    fprintf(stderr, "get_curr_cpu_frequency: Failed to open %s\n", buffer);
+    return 0;
+  }
+
+  if (fgets(buffer, sizeof(buffer), fp) != NULL) {
+    curr_freq = strtoul(buffer, NULL, 0);
+  } else {
+    fprintf(stderr,
+            "get_curr_cpu_frequency: Failed to read frequency from core %lu\n",
+            cpu);
+  }
+  fclose(fp);
+
+  return curr_freq;
+}
+
+static inline unsigned int hex_digit(char c) {
+  return c >= '0' && c <= '9' ? (unsigned int) (c - '0') :
+         c >= 'a' && c <= 'f' ? (unsigned int) (c - 'a' + 10) :
+         c >= 'A' && c <= 'F' ? (unsigned int) (c - 'A' + 10) : 0;
+}
+
+// parse a hex core mask of any length into a CPU set of
+// CPU_ALLOC_SIZE(num_cpus) bytes, or only find its size if mask is NULL.
+// Returns the highest CPU in the mask + 1.
+static unsigned int parse_core_mask(const char* core_mask,
+                                    cpu_set_t* mask,
+                                    unsigned int num_cpus) {
+  const char* start = core_mask;
+  const char* c = core_mask + strlen(core_mask);
+  unsigned int cpu = 0;
+  unsigned int end = 0;
+  unsigned int digit;
+  unsigned int bit;
+  if (start[0] == '0' && (start[1] == 'x' || start[1] == 'X')) {
+    start += 2;
+  }
+  if (mask != NULL) {
+    CPU_ZERO_S(CPU_ALLOC_SIZE(num_cpus), mask);
+  }
+  // lowest CPUs last
+  while (c > start) {
+    digit = hex_digit(*--c);
+    for (bit = 0; bit < 4; bit++, cpu++) {
+      if (digit & (1U << bit)) {
+        end = cpu + 1;
+        if (mask != NULL && cpu < num_cpus) {
+          CPU_SET_S(cpu, CPU_ALLOC_SIZE(num_cpus), mask);
+        }
+      }
+    }
+  }
+  return end;
+}
+
+// parse a CPU list like "0-3,6" into a CPU set of CPU_ALLOC_SIZE(num_cpus)
+// bytes, or only find its size if mask is NULL. Stops at the first character
+// that is not part of the list, which is stored in end if not NULL.
+// Returns the highest CPU in the list + 1.
+static unsigned int parse_cpu_list(const char* list,
+                                   cpu_set_t* mask,
+                                   unsigned int num_cpus,
+                                   const char** end) {
+  char* next;
+  unsigned long first;
+  unsigned long last;
+  unsigned int max = 0;
+  if (mask != NULL) {
+    CPU_ZERO_S(CPU_ALLOC_SIZE(num_cpus), mask);
+  }
+  while (*list >= '0' && *list <= '9') {
+    first = strtoul(list, &next, 10);
+    last = *next == '-' ? strtoul(next + 1, &next, 10) : first;
+    if (last < first || last >= UINT_MAX) {
+      break;
+    }
+    if (last + 1 > max) {
+      max = (unsigned int) last + 1;
+    }
+    for (; mask != NULL && first <= last && first < num_cpus; first++) {
+      CPU_SET_S(first, CPU_ALLOC_SIZE(num_cpus), mask);
+    }
+    list = next;
+    if (*list != ',' || list[1] < '0' || list[1] > '9') {
+      break;
+    }
+    list++;
+  }
+  if (end != NULL) {
+    *end = list;
+  }
+  return max;
+}
+
+// parse the cores of a state, either a hex mask or a CPU list
+static inline unsigned int parse_cores(const char* cores,
+                                       cpu_set_t* mask,
+                                       unsigned int num_cpus) {
+  return cores[0] == '0' && (cores[1] == 'x' || cores[1] == 'X') ?
+         parse_core_mask(cores, mask, num_cpus) :
+         parse_cpu_list(cores, mask, num_cpus, NULL);
+}
+
+// parse a frequency list, returns the number of entries
+static unsigned int parse_freq_list(const char* list,
+                                    unsigned long* freqs,
+                                    unsigned int max_cpus) {
+  unsigned int n = 0;
+  while (n < max_cpus) {
+    freqs[n++] = list[0] == '-' ? 0 : strtoul(list, NULL, 0);
+    list = strchr(list, ',');
+    if (list == NULL) {
+      break;
+    }
+    list++;
+  }
+  return n;
+}
+
+// format a CPU set as a cpuset.cpus list, e.g. "0-3,6\n", into a buffer of
+// LEN_CPU_LIST(num_cpus) bytes
+static void format_cpu_list(const cpu_set_t* mask, unsigned int num_cpus, char* list) {
+  unsigned int cpu = 0;
+  unsigned int last;
+  size_t size = CPU_ALLOC_SIZE(num_cpus);
+  int len = 0;
+  while (cpu < num_cpus) {
+    if (!CPU_ISSET_S(cpu, size, mask)) {
+      cpu++;
+      continue;
+    }
+    for (last = cpu; last + 1 < num_cpus && CPU_ISSET_S(last + 1, size, mask); last++);
+    len += sprintf(&list[len], len > 0 ? ",%u" : "%u", cpu);
+    if (last > cpu) {
+      len += sprintf(&list[len], "-%u", last);
+    }
+    cpu = last + 1;
+  }
+  strcpy(&list[len], "\n");
+}
+
+// compare CPU sets of different sizes
+static int cpu_sets_equal(const cpu_set_t* a, size_t a_size,
+                          const cpu_set_t* b, size_t b_size) {
+  const unsigned char* longer = (const unsigned char*) (a_size > b_size ? a : b);
+  size_t min_size = a_size < b_size ? a_size : b_size;
+  size_t max_size = a_size > b_size ? a_size : b_size;
+  size_t i;
+  if (memcmp(a, b, min_size)) {
+    return 0;
+  }
+  for (i = min_size; i < max_size; i++) {
+    if (longer[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Iterates over the frequency groups of a state's frequency list, which is
+ * either one frequency per CPU ("f0,f1,-,f3") or one per group of CPUs
+ * ("0-3:f0;4-7:f1"). A '-' frequency doesn't matter.
+ */
+typedef struct {
+  const char* pos;
+  unsigned int cpu;
+  int groups;
+} freq_list_iter;
+
+static void freq_list_iter_init(freq_list_iter* it, const char* list) {
+  it->pos = list;
+  it->cpu = 0;
+  it->groups = strchr(list, ':') != NULL;
+}
+
+// get the next group's CPUs (if mask isn't NULL) and frequency (0 if it
+// doesn't matter). Returns the group's highest CPU + 1, 0 at the end of the
+// list, or -1 on a syntax error.
+static int freq_list_next(freq_list_iter* it,
+                          cpu_set_t* mask,
+                          unsigned int num_cpus,
+                          unsigned long* freq) {
+  const char* end;
+  unsigned int max;
+  if (*it->pos == '\0') {
+    return 0;
+  }
+  if (it->groups) {
+    max = parse_cpu_list(it->pos, mask, num_cpus, &end);
+    if (max == 0 || *end != ':') {
+      return -1;
+    }
+    it->pos = end + 1;
+  } else {
+    max = ++it->cpu;
+    if (mask != NULL) {
+      CPU_ZERO_S(CPU_ALLOC_SIZE(num_cpus), mask);
+      if (max - 1 < num_cpus) {
+        CPU_SET_S(max - 1, CPU_ALLOC_SIZE(num_cpus), mask);
+      }
+    }
+  }
+  *freq = it->pos[0] == '-' ? 0 : strtoul(it->pos, NULL, 0);
+  end = strchr(it->pos, it->groups ? ';' : ',');
+  it->pos = end == NULL ? it->pos + strlen(it->pos) : end + 1;
+  return max > INT_MAX ? -1 : (int) max;
+}
+
+// the cores, frequencies, and RAPL power limits (may be NULL) of a state
+typedef struct {
+  const char* cores;
+  const char* freqs;
+  const char* power_limits;
+} cpu_state_strings;
+
+struct poet_cpu_table {
+  unsigned int num_states;
+  // highest CPU used by any state + 1
+  unsigned int num_cpus;
+  // CPU_ALLOC_SIZE(num_cpus)
+  size_t mask_size;
+  // frequency domains are CPUs that are always set to the same frequency
+  unsigned int num_domains;
+  // CPUs of each domain: domain_cpus[domain_offsets[d]] up to
+  // domain_cpus[domain_offsets[d + 1]]
+  unsigned int* domain_offsets;
+  unsigned int* domain_cpus;
+  // frequency of each domain in each state, 0 if it doesn't matter
+  unsigned long* freqs;
+  // cores of each state, mask_size bytes each
+  char* masks;
+  // highest RAPL zone (intel-rapl:N) limited by any state + 1
+  unsigned int num_zones;
+  // power limit of each zone in each state in microwatts, 0 if it doesn't
+  // matter
+  unsigned long* power_limits;
+};
+
+static inline const cpu_set_t* get_cpu_table_mask(const poet_cpu_table* table,
+                                                  unsigned int id) {
+  return (const cpu_set_t*) (table->masks + id * table->mask_size);
+}
+
+static inline const unsigned long* get_cpu_table_freqs(const poet_cpu_table* table,
+                                                       unsigned int id) {
+  return &table->freqs[id * table->num_domains];
+}
+
+static inline const unsigned long* get_cpu_table_power_limits(const poet_cpu_table* table,
+                                                              unsigned int id) {
+  return &table->power_limits[id * table->num_zones];
+}
+
+static inline int cpu_table_cores_equal(const poet_cpu_table* table,
+                                        unsigned int id1,
+                                        unsigned int id2) {
+  return CPU_EQUAL_S(table->mask_size, get_cpu_table_mask(table, id1),
+                     get_cpu_table_mask(table, id2));
+}
+
+void cpu_table_destroy(poet_cpu_table* table) {
+  if (table != NULL) {
+    free(table->domain_offsets);
+    free(table->domain_cpus);
+    free(table->freqs);
+    free(table->masks);
+    free(table->power_limits);
+    free(table);
+  }
+}
+
+// find the domain with exactly these CPUs, returns num_domains if there is
+// none or -1 if the CPUs overlap another domain (only checked if tmp is set)
+static int find_domain(const char* domain_masks, unsigned int num_domains,
+                       size_t mask_size, const cpu_set_t* mask, cpu_set_t* tmp) {
+  unsigned int d;
+  const cpu_set_t* domain;
+  for (d = 0; d < num_domains; d++) {
+    domain = (const cpu_set_t*) (domain_masks + d * mask_size);
+    if (CPU_EQUAL_S(mask_size, domain, mask)) {
+      return (int) d;
+    }
+    if (tmp != NULL) {
+      CPU_AND_S(mask_size, tmp, domain, mask);
+      if (CPU_COUNT_S(mask_size, tmp) > 0) {
+        return -1;
+      }
+    }
+  }
+  return (int) num_domains;
+}
+
+// find the frequency domains, as masks of mask_size bytes
+static char* get_domains(const cpu_state_strings* states, unsigned int num_states,
+                         const poet_cpu_table* table, unsigned int* num_domains) {
+  freq_list_iter it;
+  unsigned long freq;
+  unsigned int i;
+  unsigned int capacity = 0;
+  int d;
+  char* masks = NULL;
+  char* tmp;
+  cpu_set_t* mask = CPU_ALLOC(table->num_cpus);
+  cpu_set_t* overlap = CPU_ALLOC(table->num_cpus);
+  *num_domains = 0;
+  if (mask == NULL || overlap == NULL) {
+    goto fail;
+  }
+  for (i = 0; i < num_states; i++) {
+    freq_list_iter_init(&it, states[i].freqs);
+    while (freq_list_next(&it, mask, table->num_cpus, &freq) > 0) {
+      if (freq == 0) {
+        continue;
+      }
+      d = find_domain(masks, *num_domains, table->mask_size, mask, overlap);
+      if (d < 0) {
+        fprintf(stderr, "cpu_table_init: State %u: frequency groups overlap\n", i);
+        errno = EINVAL;
+        goto fail;
+      }
+      if ((unsigned int) d < *num_domains) {
+        continue;
+      }
+      if (*num_domains == capacity) {
+        capacity = capacity == 0 ? 8 : capacity * 2;
+        tmp = realloc(masks, capacity * table->mask_size);
+        if (tmp == NULL) {
+          errno = ENOMEM;
+          goto fail;
+        }
+        masks = tmp;
+      }
+      memcpy(masks + *num_domains * table->mask_size, mask, table->mask_size);
+      (*num_domains)++;
+    }
+  }
+  CPU_FREE(mask);
+  CPU_FREE(overlap);
+  return masks == NULL ? calloc(1, table->mask_size) : masks;
+
+fail:
+  if (mask != NULL) {
+    CPU_FREE(mask);
+  }
+  if (overlap != NULL) {
+    CPU_FREE(overlap);
+  }
+  free(masks);
+  return NULL;
+}
+
+// set the power limits of each RAPL zone, listed like frequencies per CPU
+static int cpu_table_compile_power_limits(poet_cpu_table* table,
+                                          const cpu_state_strings* states) {
+  unsigned int i;
+  unsigned int z;
+  unsigned int n;
+  unsigned int max_zones = 1;
+  const char* c;
+  unsigned long* limits;
+  // the longest list has one more entry than commas
+  for (i = 0; i < table->num_states; i++) {
+    n = 1;
+    for (c = states[i].power_limits; c != NULL && *c != '\0'; c++) {
+      n += *c == ',';
+    }
+    if (n > max_zones) {
+      max_zones = n;
+    }
+  }
+  limits = malloc(max_zones * sizeof(unsigned long));
+  if (limits == NULL) {
+    return -1;
+  }
+  for (i = 0; i < table->num_states; i++) {
+    n = states[i].power_limits == NULL ? 0 :
+        parse_freq_list(states[i].power_limits, limits, max_zones);
+    for (z = 0; z < n; z++) {
+      if (limits[z] != 0 && z >= table->num_zones) {
+        table->num_zones = z + 1;
+      }
+    }
+  }
+  table->power_limits = calloc((size_t) table->num_states * table->num_zones + 1,
+                               sizeof(unsigned long));
+  if (table->power_limits == NULL) {
+    free(limits);
+    errno = ENOMEM;
+    return -1;
+  }
+  for (i = 0; i < table->num_states; i++) {
+    n = states[i].power_limits == NULL ? 0 :
+        parse_freq_list(states[i].power_limits, limits, table->num_zones);
+    memcpy(&table->power_limits[i * table->num_zones], limits, n * sizeof(unsigned long));
+  }
+  free(limits);
+  return 0;
+}
+
+// compile states into a table; a state's cores are a hex mask or CPU list,
+// its frequencies are per CPU or per group of CPUs
+static poet_cpu_table* cpu_table_compile(const cpu_state_strings* states,
+                                         unsigned int num_states) {
+  freq_list_iter it;
+  unsigned long freq;
+  unsigned int i;
+  unsigned int d;
+  unsigned int cpu;
+  unsigned int n;
+  int max;
+  int err;
+  char* domain_masks = NULL;
+  cpu_set_t* mask = NULL;
+  poet_cpu_table* table = calloc(1, sizeof(poet_cpu_table));
+  if (table == NULL) {
+    return NULL;
+  }
+  table->num_states = num_states;
+
+  // size the CPU sets
+  for (i = 0; i < num_states; i++) {
+    n = parse_cores(states[i].cores, NULL, 0);
+    if (n > table->num_cpus) {
+      table->num_cpus = n;
+    }
+    freq_list_iter_init(&it, states[i].freqs);
+    while ((max = freq_list_next(&it, NULL, 0, &freq)) > 0) {
+      if (freq != 0 && (unsigned int) max > table->num_cpus) {
+        table->num_cpus = (unsigned int) max;
+      }
+    }
+    if (max < 0) {
+      fprintf(stderr, "cpu_table_init: State %u: Syntax error in frequencies: %s\n",
+              i, states[i].freqs);
+      err = EINVAL;
+      goto fail;
+    }
+  }
+  if (table->num_cpus == 0) {
+    table->num_cpus = 1;
+  }
+  table->mask_size = CPU_ALLOC_SIZE(table->num_cpus);
+
+  domain_masks = get_domains(states, num_states, table, &table->num_domains);
+  if (domain_masks == NULL) {
+    err = errno;
+    goto fail;
+  }
+  mask = CPU_ALLOC(table->num_cpus);
+  table->domain_offsets = malloc((table->num_domains + 1) * sizeof(unsigned int));
+  table->masks = malloc(num_states * table->mask_size);
+  table->freqs = calloc((size_t) num_states * table->num_domains + 1, sizeof(unsigned long));
+  if (mask == NULL || table->domain_offsets == NULL || table->masks == NULL ||
+      table->freqs == NULL) {
+    err = ENOMEM;
+    goto fail;
+  }
+
+  // list the CPUs of each domain
+  table->domain_offsets[0] = 0;
+  for (d = 0; d < table->num_domains; d++) {
+    table->domain_offsets[d + 1] = table->domain_offsets[d] + (unsigned int)
+      CPU_COUNT_S(table->mask_size, (cpu_set_t*) (domain_masks + d * table->mask_size));
+  }
+  table->domain_cpus = malloc((table->domain_offsets[table->num_domains] + 1) * sizeof(unsigned int));
+  if (table->domain_cpus == NULL) {
+    err = ENOMEM;
+    goto fail;
+  }
+  for (d = 0, n = 0; d < table->num_domains; d++) {
+    for (cpu = 0; cpu < table->num_cpus; cpu++) {
+      if (CPU_ISSET_S(cpu, table->mask_size, (cpu_set_t*) (domain_masks + d * table->mask_size))) {
+        table->domain_cpus[n++] = cpu;
+      }
+    }
+  }
+
+  for (i = 0; i < num_states; i++) {
+    parse_cores(states[i].cores, (cpu_set_t*) (table->masks + i * table->mask_size),
+                table->num_cpus);
+    freq_list_iter_init(&it, states[i].freqs);
+    while (freq_list_next(&it, mask, table->num_cpus, &freq) > 0) {
+      if (freq != 0) {
+        d = (unsigned int) find_domain(domain_masks, table->num_domains, table->mask_size,
+                                       mask, NULL);
+        table->freqs[i * table->num_domains + d] = freq;
+      }
+    }
+  }
+  if (cpu_table_compile_power_limits(table, states)) {
+    err = errno;
+    goto fail;
+  }
+  CPU_FREE(mask);
+  free(domain_masks);
+  return table;
+
+fail:
+  if (mask != NULL) {
+    CPU_FREE(mask);
+  }
+  free(domain_masks);
+  cpu_table_destroy(table);
+  errno = err;
+  return NULL;
+}
+
+poet_cpu_table* cpu_table_init(const poet_cpu_state_t* states,
+                               unsigned int num_states) {
+  unsigned int i;
+  poet_cpu_table* table;
+  cpu_state_strings* strings;
+
+  if (states == NULL || num_states == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  strings = malloc(num_states * sizeof(cpu_state_strings));
+  if (strings == NULL) {
     return NULL;
   }
-
-  cur_mask = CPU_ALLOC(num_configured_cpus);
-  if (cur_mask == NULL) {
-    fprintf(stderr, "alloc_curr_cpu_assignment: Failed to alloc cpu_set_t\n");
-    return NULL;
+  for (i = 0; i < num_states; i++) {
+    strings[i].cores = states[i].core_mask;
+    strings[i].freqs = states[i].freqs;
+    strings[i].power_limits = NULL;
+  }
+  table = cpu_table_compile(strings, num_states);
+  free(strings);
+  return table;
+}
+
+// find the CPU that sets the frequency of each CPU's cpufreq policy, the first
+// of its policyN/related_cpus, or -1 without a policy. Returns the number of
+// policies.
+static int get_cpu_policies(const char* sysfs_root, int* policy_cpu, unsigned int num_cpus) {
+  char path[4096];
+  char line[4096];
+  char* pos;
+  char* end;
+  unsigned long cpu;
+  unsigned long first;
+  int num_policies = 0;
+  DIR* dir;
+  FILE* f;
+  struct dirent* entry;
+  for (cpu = 0; cpu < num_cpus; cpu++) {
+    policy_cpu[cpu] = -1;
+  }
+  snprintf(path, sizeof(path), "%s/cpufreq", sysfs_root);
+  dir = opendir(path);
+  if (dir == NULL) {
+    return 0;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "policy", 6)) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/cpufreq/%s/related_cpus", sysfs_root, entry->d_name);
+    f = fopen(path, "r");
+    if (f == NULL) {
+      continue;
+    }
+    // CPUs are listed in order, separated by spaces
+    if (fgets(line, sizeof(line), f) != NULL) {
+      first = strtoul(line, NULL, 10);
+      for (pos = line; (cpu = strtoul(pos, &end, 10)), end != pos; pos = end) {
+        if (cpu < num_cpus) {
+          policy_cpu[cpu] = (int) first;
+        }
+      }
+      num_policies++;
+    }
+    fclose(f);
+  }
+  closedir(dir);
+  return num_policies;
+}
+
+// the CPUs to write to set a domain's frequency, in order: one per cpufreq
+// policy, and each CPU without one
+static unsigned int get_domain_write_cpus(const poet_cpu_table* table, unsigned int d,
+                                          const int* policy_cpu, unsigned int* cpus) {
+  unsigned int i;
+  unsigned int j;
+  unsigned int cpu;
+  unsigned int n = 0;
+  for (i = table->domain_offsets[d]; i < table->domain_offsets[d + 1]; i++) {
+    cpu = table->domain_cpus[i];
+    cpu = policy_cpu[cpu] < 0 ? cpu : (unsigned int) policy_cpu[cpu];
+    for (j = n; j > 0 && cpus[j - 1] > cpu; j--);
+    if (j > 0 && cpus[j - 1] == cpu) {
+      continue;
+    }
+    memmove(&cpus[j + 1], &cpus[j], (n - j) * sizeof(unsigned int));
+    cpus[j] = cpu;
+    n++;
+  }
+  return n;
+}
+
+// whether every state sets a table domain to the same frequency as a merged
+// domain, or one of them doesn't care
+static int domain_freqs_compatible(const poet_cpu_table* table, unsigned int d,
+                                   const unsigned long* merged_freqs, unsigned int m) {
+  unsigned int i;
+  unsigned long f1;
+  unsigned long f2;
+  for (i = 0; i < table->num_states; i++) {
+    f1 = get_cpu_table_freqs(table, i)[d];
+    f2 = merged_freqs[i * table->num_domains + m];
+    if (f1 != 0 && f2 != 0 && f1 != f2) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int cpu_table_discover_domains(poet_cpu_table* table, const char* sysfs_root) {
+  unsigned int num_domains = 0;
+  unsigned int d;
+  unsigned int m;
+  unsigned int i;
+  unsigned int n;
+  unsigned int num_cpus;
+  int num_policies;
+  int* policy_cpu;
+  // write CPUs and frequencies of the merged domains
+  unsigned int* offsets = NULL;
+  unsigned int* cpus = NULL;
+  unsigned long* freqs = NULL;
+
+  if (table == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (sysfs_root == NULL) {
+    sysfs_root = POET_CONFIG_CPU_SYSFS;
+  }
+  if (table->num_domains == 0) {
+    return 0;
+  }
+  num_cpus = table->domain_offsets[table->num_domains];
+  policy_cpu = malloc(table->num_cpus * sizeof(int));
+  if (policy_cpu == NULL) {
+    return -1;
+  }
+  num_policies = get_cpu_policies(sysfs_root, policy_cpu, table->num_cpus);
+  if (num_policies == 0) {
+    // no policies to share, each CPU is set separately
+    free(policy_cpu);
+    return 0;
+  }
+  offsets = malloc((table->num_domains + 1) * sizeof(unsigned int));
+  cpus = malloc((num_cpus + 1) * sizeof(unsigned int));
+  freqs = calloc((size_t) table->num_states * table->num_domains + 1, sizeof(unsigned long));
+  if (offsets == NULL || cpus == NULL || freqs == NULL) {
+    goto fail;
+  }
+
+  offsets[0] = 0;
+  for (d = 0; d < table->num_domains; d++) {
+    n = get_domain_write_cpus(table, d, policy_cpu, &cpus[offsets[num_domains]]);
+    // join an earlier domain that writes the same CPUs, if no state conflicts
+    for (m = 0; m < num_domains; m++) {
+      if (offsets[m + 1] - offsets[m] == n &&
+          !memcmp(&cpus[offsets[m]], &cpus[offsets[num_domains]], n * sizeof(unsigned int))) {
+        if (domain_freqs_compatible(table, d, freqs, m)) {
+          break;
+        }
+        fprintf(stderr, "cpu_table_discover_domains: CPU %u shares a cpufreq policy, "
+                "but states set different frequencies for its CPUs\n", cpus[offsets[m]]);
+      }
+    }
+    if (m == num_domains) {
+      offsets[++num_domains] = offsets[m] + n;
+    }
+    for (i = 0; i < table->num_states; i++) {
+      if (get_cpu_table_freqs(table, i)[d] != 0) {
+        freqs[i * table->num_domains + m] = get_cpu_table_freqs(table, i)[d];
+      }
+    }
+  }
+
+  // compact the frequencies to the new number of domains
+  for (i = 0; i < table->num_states; i++) {
+    for (m = 0; m < num_domains; m++) {
+      table->freqs[i * num_domains + m] = freqs[i * table->num_domains + m];
+    }
+  }
+  free(table->domain_offsets);
+  free(table->domain_cpus);
+  table->domain_offsets = offsets;
+  table->domain_cpus = cpus;
+  table->num_domains = num_domains;
+  free(freqs);
+  free(policy_cpu);
+  return num_policies;
+
+fail:
+  free(offsets);
+  free(cpus);
+  free(freqs);
+  free(policy_cpu);
+  errno = ENOMEM;
+  return -1;
+}
+
+// Read the current frequency of each CPU in a domain, 0 for other CPUs.
+// Returns -1 if bad DVFS governor is found for an assigned core.
+static inline int get_cpu_frequencies(const poet_cpu_table* table,
+                                      const cpu_set_t* curr_cpu_mask,
+                                      size_t curr_mask_size,
+                                      unsigned long* curr_freq_assignment) {
+  unsigned int i;
+  for (i = 0; i < 8 * curr_mask_size; i++) {
+    // assigned cores must be in proper scaling governor,
+    // otherwise could get a false reading
+    if (CPU_ISSET_S(i, curr_mask_size, curr_cpu_mask) &&
+        cpu_governor_cmp(i, POET_CONFIG_DVFS_GOVERNOR)) {
+      fprintf(stderr,
+              "get_cpu_frequencies: Not all affected cores in "
+              POET_CONFIG_DVFS_GOVERNOR" governor\n");
+      return -1;
+    }
+  }
+  memset(curr_freq_assignment, 0, table->num_cpus * sizeof(unsigned long));
+  for (i = 0; i < table->domain_offsets[table->num_domains]; i++) {
+    curr_freq_assignment[table->domain_cpus[i]] = get_curr_cpu_frequency(table->domain_cpus[i]);
+  }
+  return 0;
+}
+
+static inline int dvfs_freqs_equal(const poet_cpu_table* table,
+                                   const unsigned long* curr_freq_assignment,
+                                   unsigned int id) {
+  unsigned int d;
+  unsigned int i;
+  const unsigned long* freqs = get_cpu_table_freqs(table, id);
+  for (d = 0; d < table->num_domains; d++) {
+    if (freqs[d] == 0) {
+      continue;
+    }
+    for (i = table->domain_offsets[d]; i < table->domain_offsets[d + 1]; i++) {
+      if (curr_freq_assignment[table->domain_cpus[i]] != freqs[d]) {
+        // we care about this core, but the frequencies don't match
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+// try to get current CPU configuration state
+static int get_cpu_state(const poet_cpu_table* table,
+                         unsigned int* curr_state_id) {
+  int ret = -1;
+  unsigned int i;
+  long num_configured_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  unsigned int num_cpus = num_configured_cpus > (long) table->num_cpus ?
+                          (unsigned int) num_configured_cpus : table->num_cpus;
+  size_t size = CPU_ALLOC_SIZE(num_cpus);
+  cpu_set_t* curr_cpu_mask = CPU_ALLOC(num_cpus);
+  unsigned long* curr_freq_assignment = malloc(table->num_cpus * sizeof(unsigned long));
+
+  if (curr_cpu_mask && curr_freq_assignment) {
+    // first determine the current core assignment
+    if (sched_getaffinity(getpid(), size, curr_cpu_mask)) {
+      fprintf(stderr, "get_cpu_state: Failed to get CPU affinity\n");
+    } else if (get_cpu_frequencies(table, curr_cpu_mask, size, curr_freq_assignment)) {
+      // now determine the frequency assignments for active cores
+      fprintf(stderr, "get_cpu_state: Failed to get CPU frequencies\n");
+    } else {
+      // search all states for a match
+      for (i = 0; i < table->num_states; i++) {
+        // compare current CPU and frequency assignments with this state
+        if (cpu_sets_equal(curr_cpu_mask, size, get_cpu_table_mask(table, i), table->mask_size) &&
+            dvfs_freqs_equal(table, curr_freq_assignment, i)) {
+          // all fields matched
+          *curr_state_id = i;
+          ret = 0;
+          // don't break yet - if this is an idle state, we actually want to
+          // find its partner state
+        }
+      }
+    }
+  } else {
+    fprintf(stderr, "get_cpu_state: Failed to malloc\n");
+  }
+
+  if (curr_cpu_mask) {
+    CPU_FREE(curr_cpu_mask);
+  }
+  free(curr_freq_assignment);
+  return ret;
+}
+
+int get_current_cpu_state(const void* states,
+                          unsigned int num_states,
+                          unsigned int* curr_state_id) {
+  int ret;
+  // compiled on every lookup - a poet_cpu_table avoids that
+  poet_cpu_table* table = cpu_table_init((const poet_cpu_state_t*) states, num_states);
+  if (table == NULL) {
+    fprintf(stderr, "get_current_cpu_state: Failed to parse states\n");
+    return -1;
+  }
+  ret = get_cpu_state(table, curr_state_id);
+  cpu_table_destroy(table);
+  return ret;
+}
+
+int get_current_cpu_table_state(const void* states,
+                                unsigned int num_states,
+                                unsigned int* curr_state_id) {
+  const poet_cpu_table* table = (const poet_cpu_table*) states;
+  if (table == NULL || num_states != table->num_states) {
+    return -1;
+  }
+  return get_cpu_state(table, curr_state_id);
+}
+
+real_t get_cpu_switch_cost(const void* states,
+                           unsigned int from_id,
+                           unsigned int to_id) {
+  const poet_cpu_switch_cost* cost = (const poet_cpu_switch_cost*) states;
+  const unsigned long* from_freqs;
+  const unsigned long* to_freqs;
+  real_t sec = CONST(0.0);
+  unsigned int d;
+  if (cost == NULL || cost->table == NULL || from_id >= cost->table->num_states ||
+      to_id >= cost->table->num_states) {
+    return sec;
+  }
+  if (!cpu_table_cores_equal(cost->table, from_id, to_id)) {
+    sec += cost->core_switch_sec;
+  }
+  // domains whose frequency doesn't matter in the new state are not written
+  from_freqs = get_cpu_table_freqs(cost->table, from_id);
+  to_freqs = get_cpu_table_freqs(cost->table, to_id);
+  for (d = 0; d < cost->table->num_domains; d++) {
+    if (to_freqs[d] != 0 && to_freqs[d] != from_freqs[d]) {
+      sec += cost->freq_switch_sec;
+      break;
+    }
+  }
+  return sec;
+}
+
+static inline unsigned long long get_monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * IDLE_NS_PER_SEC + (unsigned long long) ts.tv_nsec;
+}
+
+// odd while idling - paused threads wait for it to change
+static int idle_word = 0;
+static int idle_handler_errno = 0;
+static pthread_once_t idle_once = PTHREAD_ONCE_INIT;
+// one thread idles the process at a time
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void idle_signal_handler(int sig) {
+  int saved_errno = errno;
+  int word = __atomic_load_n(&idle_word, __ATOMIC_ACQUIRE);
+  (void) sig;
+  // returns immediately if the idle period already ended
+  while ((word & 1) && __atomic_load_n(&idle_word, __ATOMIC_ACQUIRE) == word) {
+    syscall(SYS_futex, &idle_word, FUTEX_WAIT_PRIVATE, word, NULL, NULL, 0);
+  }
+  errno = saved_errno;
+}
+
+static void install_idle_signal_handler(void) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = idle_signal_handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(POET_CONFIG_IDLE_SIGNAL, &sa, NULL)) {
+    idle_handler_errno = errno;
+  }
+}
+
+// List the other threads of this process, allocating tids
+static int get_other_threads(pid_t self, pid_t** tids, size_t* num_tids) {
+  size_t capacity = 16;
+  pid_t* buf;
+  pid_t tid;
+  DIR* dir;
+  struct dirent* entry;
+  int err;
+
+  *num_tids = 0;
+  *tids = malloc(capacity * sizeof(pid_t));
+  if (*tids == NULL) {
+    return -1;
+  }
+  dir = opendir("/proc/self/task");
+  if (dir == NULL) {
+    err = errno;
+    free(*tids);
+    *tids = NULL;
+    errno = err;
+    return -1;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+      continue;
+    }
+    tid = (pid_t) strtol(entry->d_name, NULL, 10);
+    if (tid == self) {
+      continue;
+    }
+    if (*num_tids == capacity) {
+      capacity *= 2;
+      buf = realloc(*tids, capacity * sizeof(pid_t));
+      if (buf == NULL) {
+        closedir(dir);
+        free(*tids);
+        *tids = NULL;
+        errno = ENOMEM;
+        return -1;
+      }
+      *tids = buf;
+    }
+    (*tids)[(*num_tids)++] = tid;
+  }
+  closedir(dir);
+  return 0;
+}
+
+int idle_process(unsigned long long idle_ns, unsigned long long* achieved_ns) {
+  struct timespec deadline;
+  unsigned long long start;
+  unsigned long long end;
+  pid_t pid = getpid();
+  pid_t self = (pid_t) syscall(SYS_gettid);
+  pid_t* tids;
+  size_t num_tids;
+  size_t i;
+  int err = 0;
+
+  pthread_once(&idle_once, install_idle_signal_handler);
+  if (idle_handler_errno) {
+    errno = idle_handler_errno;
+    return -1;
+  }
+  pthread_mutex_lock(&idle_lock);
+  // paused threads may hold the malloc or stdio locks, so nothing from the
+  // first signal until they are woken may allocate or use stdio
+  if (get_other_threads(self, &tids, &num_tids)) {
+    err = errno;
+    num_tids = 0;
+  }
+  start = get_monotonic_ns();
+  __atomic_add_fetch(&idle_word, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < num_tids; i++) {
+    if (syscall(SYS_tgkill, pid, tids[i], POET_CONFIG_IDLE_SIGNAL) && errno != ESRCH) {
+      err = errno;
+    }
+  }
+  // this thread idles too, even if others couldn't be paused
+  deadline.tv_sec = (time_t) ((start + idle_ns) / IDLE_NS_PER_SEC);
+  deadline.tv_nsec = (long) ((start + idle_ns) % IDLE_NS_PER_SEC);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+  // the woken threads may preempt this one, so the idle ends here
+  end = get_monotonic_ns();
+  __atomic_add_fetch(&idle_word, 1, __ATOMIC_RELEASE);
+  syscall(SYS_futex, &idle_word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+  pthread_mutex_unlock(&idle_lock);
+  free(tids);
+
+  if (achieved_ns != NULL) {
+    *achieved_ns = end - start;
+  }
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+// Idle this process, returns the achieved idle time
+static unsigned long long apply_cpu_idle_state(unsigned long long nanosec) {
+  unsigned long long achieved_ns = 0;
+#ifdef POET_CONFIG_IDLE_EXTERNAL
+  char command[4096];
+  unsigned long long start = get_monotonic_ns();
+  snprintf(command, sizeof(command), POET_CONFIG_IDLE_PATH" %llu %ld", nanosec, (long) getpid());
+  if (system(command)) {
+    fprintf(stderr, "apply_cpu_idle_state: ERROR idling process\n");
+  }
+  achieved_ns = get_monotonic_ns() - start;
+#else
+  if (idle_process(nanosec, &achieved_ns)) {
+    fprintf(stderr, "apply_cpu_idle_state: ERROR pausing threads: %s\n", strerror(errno));
+  }
+#endif
+  return achieved_ns;
+}
+
+// Set a CPU frequency by running a shell
+static void apply_cpu_frequency_system(const char* sysfs_root,
+                                       unsigned int cpu,
+                                       unsigned long freq) {
+  int retvalsyscall;
+  char command[4096];
+  snprintf(command, sizeof(command),
+          "echo %lu > %s/cpu%u/cpufreq/"POET_CONFIG_DVFS_FILE,
+          freq, sysfs_root, cpu);
+  retvalsyscall = system(command);
+  if (retvalsyscall != 0) {
+    fprintf(stderr, "apply_cpu_frequency_system: ERROR setting frequency of CPU %u: %d\n",
+            cpu, retvalsyscall);
+  }
+}
+
+// Set a table state's CPU frequencies by running a shell for each core
+static void apply_cpu_table_frequencies_system(const char* sysfs_root,
+                                               const poet_cpu_table* table,
+                                               unsigned int id) {
+  unsigned int d;
+  unsigned int i;
+  const unsigned long* freqs = get_cpu_table_freqs(table, id);
+  for (d = 0; d < table->num_domains; d++) {
+    for (i = table->domain_offsets[d]; freqs[d] != 0 && i < table->domain_offsets[d + 1]; i++) {
+      apply_cpu_frequency_system(sysfs_root, table->domain_cpus[i], freqs[d]);
+    }
+  }
+}
+
+
+static int set_process_affinity(pid_t pid, const cpu_set_t* mask, size_t mask_size,
+                                int follow_children);
+
+// Set the affinity of the child processes of a thread
+static int set_children_affinity(pid_t pid, pid_t tid, const cpu_set_t* mask,
+                                 size_t mask_size) {
+  char path[64];
+  long child;
+  int ret = 0;
+  int err = 0;
+  FILE* fp;
+  snprintf(path, sizeof(path), "/proc/%ld/task/%ld/children", (long) pid, (long) tid);
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    // the thread exited
+    return errno == ENOENT ? 0 : -1;
+  }
+  while (fscanf(fp, "%ld", &child) == 1) {
+    if (set_process_affinity((pid_t) child, mask, mask_size, 1)) {
+      err = errno;
+      ret = -1;
+    }
+  }
+  fclose(fp);
+  errno = err;
+  return ret;
+}
+
+// Set the affinity of the child processes of a process by finding every
+// process whose parent it is, for kernels without CONFIG_PROC_CHILDREN
+static int set_children_affinity_scan(pid_t pid, const cpu_set_t* mask,
+                                      size_t mask_size) {
+  char path[64];
+  char buffer[512];
+  char* stat;
+  long ppid;
+  pid_t child;
+  int ret = 0;
+  int err = 0;
+  DIR* dir;
+  FILE* fp;
+  struct dirent* entry;
+  dir = opendir("/proc");
+  if (dir == NULL) {
+    return -1;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+      continue;
+    }
+    child = (pid_t) strtol(entry->d_name, NULL, 10);
+    snprintf(path, sizeof(path), "/proc/%ld/stat", (long) child);
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+      continue;
+    }
+    stat = fgets(buffer, sizeof(buffer), fp);
+    fclose(fp);
+    // the parent follows the state, which follows the command in parentheses
+    if (stat != NULL && (stat = strrchr(stat, ')')) != NULL &&
+        sscanf(stat, ") %*c %ld", &ppid) == 1 && ppid == (long) pid &&
+        set_process_affinity(child, mask, mask_size, 1)) {
+      err = errno;
+      ret = -1;
+    }
+  }
+  closedir(dir);
+  errno = err;
+  return ret;
+}
+
+// Set the affinity of all threads of a process, and optionally of all its
+// descendants. Threads and processes that exit in the meantime are skipped.
+static int set_process_affinity(pid_t pid, const cpu_set_t* mask, size_t mask_size,
+                                int follow_children) {
+  char path[64];
+  pid_t tid;
+  int ret = 0;
+  int err = 0;
+  int children_files;
+  DIR* dir;
+  struct dirent* entry;
+  snprintf(path, sizeof(path), "/proc/%ld/task", (long) pid);
+  dir = opendir(path);
+  if (dir == NULL) {
+    return errno == ENOENT ? 0 : -1;
+  }
+  children_files = follow_children && access("/proc/thread-self/children", F_OK) == 0;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] < '0' || entry->d_name[0] > '9') {
+      continue;
+    }
+    tid = (pid_t) strtol(entry->d_name, NULL, 10);
+    if (sched_setaffinity(tid, mask_size, mask) && errno != ESRCH) {
+      err = errno;
+      ret = -1;
+    }
+    if (children_files && set_children_affinity(pid, tid, mask, mask_size)) {
+      err = errno;
+      ret = -1;
+    }
+  }
+  closedir(dir);
+  if (follow_children && !children_files && set_children_affinity_scan(pid, mask, mask_size)) {
+    err = errno;
+    ret = -1;
+  }
+  errno = err;
+  return ret;
+}
+
+// Set the core assignment of this process's threads, and optionally of its
+// child processes. Returns 0 on success or an errno value.
+static int apply_cpu_core_mask(const cpu_set_t* mask, size_t mask_size,
+                               int follow_children) {
+  if (set_process_affinity(getpid(), mask, mask_size, follow_children)) {
+    fprintf(stderr, "apply_cpu_core_mask: ERROR setting CPU affinity: %s\n",
+            strerror(errno));
+    return errno;
+  }
+  return 0;
+}
+
+// Set the number of cores
+static void apply_cpu_config_taskset(const cpu_set_t* mask,
+                                     unsigned int num_cpus) {
+  // child processes have always been included
+  apply_cpu_core_mask(mask, CPU_ALLOC_SIZE(num_cpus), 1);
+}
+
+void apply_cpu_config(void* states,
+                      unsigned int num_states,
+                      unsigned int id,
+                      unsigned int last_id,
+                      unsigned long long idle_ns,
+                      unsigned int is_first_apply) {
+  unsigned long freqs[POET_MAX_CORES];
+  unsigned int num_cpus;
+  unsigned int i;
+  cpu_set_t* mask;
+  poet_cpu_state_t* cpu_states = (poet_cpu_state_t*) states;
+
+  if (id >= num_states || last_id >= num_states) {
+    fprintf(stderr, "apply_cpu_config: id '%u' or last_id '%u' are not "
+            "acceptable values, they must be less than the number of states, "
+            "'%u'.\n", id, last_id, num_states);
+    return;
+  }
+
+  if (cpu_states == NULL) {
+    fprintf(stderr, "apply_cpu_config: states cannot be null.\n");
+    return;
+  }
+
+  printf("apply_cpu_config: Applying state: %u\n", id);
+
+  // parsed on every apply - a poet_cpu_table avoids that
+  // only set affinity if the core assignment has changed
+  if (is_first_apply || strcmp(cpu_states[id].core_mask, cpu_states[last_id].core_mask)) {
+    mask = CPU_ALLOC(POET_MAX_CORES);
+    if (mask == NULL) {
+      fprintf(stderr, "apply_cpu_config: Failed to alloc cpu_set_t\n");
+    } else {
+      printf("apply_cpu_config: Applying core allocation: %s\n", cpu_states[id].core_mask);
+      parse_core_mask(cpu_states[id].core_mask, mask, POET_MAX_CORES);
+      apply_cpu_config_taskset(mask, POET_MAX_CORES);
+      CPU_FREE(mask);
+    }
+  }
+  num_cpus = parse_freq_list(cpu_states[id].freqs, freqs, POET_MAX_CORES);
+  for (i = 0; i < num_cpus; i++) {
+    if (freqs[i] != 0) {
+      apply_cpu_frequency_system(POET_CONFIG_CPU_SYSFS, i, freqs[i]);
+    }
+  }
+  // idle this process if desired
+  if (idle_ns > 0) {
+    printf("apply_cpu_config: Idled for %llu ns of %llu ns requested\n",
+           apply_cpu_idle_state(idle_ns), idle_ns);
+  }
+}
+
+void apply_cpu_table(void* states,
+                     unsigned int num_states,
+                     unsigned int id,
+                     unsigned int last_id,
+                     unsigned long long idle_ns,
+                     unsigned int is_first_apply) {
+  const poet_cpu_table* table = (const poet_cpu_table*) states;
+  if (table == NULL) {
+    fprintf(stderr, "apply_cpu_table: table cannot be null.\n");
+    return;
+  }
+  if (id >= num_states || last_id >= num_states || num_states != table->num_states) {
+    fprintf(stderr, "apply_cpu_table: id '%u' or last_id '%u' are not "
+            "acceptable values, they must be less than the number of states, "
+            "'%u'.\n", id, last_id, table->num_states);
+    return;
+  }
+
+  // only set affinity if the core assignment has changed
+  if (is_first_apply || !cpu_table_cores_equal(table, id, last_id)) {
+    apply_cpu_config_taskset(get_cpu_table_mask(table, id), table->num_cpus);
+  }
+  apply_cpu_table_frequencies_system(POET_CONFIG_CPU_SYSFS, table, id);
+  // idle this process if desired
+  if (idle_ns > 0) {
+    apply_cpu_idle_state(idle_ns);
+  }
+}
+
+struct poet_cpu_actuator {
+  poet_cpu_table* table;
+  // tables of actuator_init() backends belong to the caller
+  int owns_table;
+  char* sysfs_root;
+  // DVFS file of each CPU in a frequency domain, or -1
+  int* fds;
+  int follow_children;
+  // shadow of the last applied frequency of each domain (0 if unknown) and
+  // the state whose cores were applied (num_states if unknown)
+  unsigned long* applied_freqs;
+  unsigned int applied_cores;
+  unsigned int revalidate_period;
+  unsigned int applies_since_revalidate;
+  unsigned long num_writes;
+  unsigned long num_skipped;
+  unsigned long num_stale;
+  unsigned long num_errors;
+  int last_errno;
+  unsigned long num_idles;
+  unsigned long long idle_requested_ns;
+  unsigned long long idle_achieved_ns;
+};
+
+static void cpu_actuator_close(poet_cpu_actuator* actuator) {
+  unsigned int i;
+  if (actuator->fds != NULL) {
+    for (i = 0; i < actuator->table->num_cpus; i++) {
+      if (actuator->fds[i] >= 0) {
+        close(actuator->fds[i]);
+      }
+    }
+  }
+  free(actuator->fds);
+  free(actuator->applied_freqs);
+  free(actuator->sysfs_root);
+  if (actuator->owns_table) {
+    cpu_table_destroy(actuator->table);
+  }
+  free(actuator);
+}
+
+// create an actuator for a table, which it destroys if it owns it (also on
+// failure)
+static poet_cpu_actuator* cpu_actuator_create(poet_cpu_table* table,
+                                              int owns_table,
+                                              const char* sysfs_root) {
+  char path[4096];
+  unsigned int i;
+  unsigned int cpu;
+  int err;
+  poet_cpu_actuator* actuator;
+
+  if (sysfs_root == NULL) {
+    sysfs_root = POET_CONFIG_CPU_SYSFS;
+  }
+  actuator = calloc(1, sizeof(poet_cpu_actuator));
+  if (actuator == NULL) {
+    if (owns_table) {
+      cpu_table_destroy(table);
+    }
+    errno = ENOMEM;
+    return NULL;
+  }
+  actuator->table = table;
+  actuator->owns_table = owns_table;
+  if (cpu_table_discover_domains(table, sysfs_root) < 0) {
+    cpu_actuator_close(actuator);
+    errno = ENOMEM;
+    return NULL;
+  }
+  actuator->fds = malloc(table->num_cpus * sizeof(int));
+  actuator->applied_freqs = calloc(table->num_domains + 1, sizeof(unsigned long));
+  actuator->sysfs_root = strdup(sysfs_root);
+  if (actuator->fds == NULL || actuator->applied_freqs == NULL || actuator->sysfs_root == NULL) {
+    cpu_actuator_close(actuator);
+    errno = ENOMEM;
+    return NULL;
+  }
+  actuator->applied_cores = table->num_states;
+  actuator->revalidate_period = POET_CONFIG_REVALIDATE_PERIOD;
+  for (cpu = 0; cpu < table->num_cpus; cpu++) {
+    actuator->fds[cpu] = -1;
+  }
+
+  // only open the files of CPUs whose frequency we set
+  for (i = 0; i < table->domain_offsets[table->num_domains]; i++) {
+    cpu = table->domain_cpus[i];
+    snprintf(path, sizeof(path), "%s/cpu%u/cpufreq/"POET_CONFIG_DVFS_FILE, sysfs_root, cpu);
+    actuator->fds[cpu] = open(path, O_WRONLY | O_CLOEXEC);
+    if (actuator->fds[cpu] < 0) {
+      err = errno;
+      fprintf(stderr, "cpu_actuator_init: Failed to open %s: %s\n", path, strerror(err));
+      cpu_actuator_close(actuator);
+      errno = err;
+      return NULL;
+    }
+  }
+  return actuator;
+}
+
+poet_cpu_actuator* cpu_actuator_init(const poet_cpu_state_t* states,
+                                     unsigned int num_states,
+                                     const char* sysfs_root) {
+  poet_cpu_table* table = cpu_table_init(states, num_states);
+  return table == NULL ? NULL : cpu_actuator_create(table, 1, sysfs_root);
+}
+
+void cpu_actuator_destroy(poet_cpu_actuator* actuator) {
+  if (actuator != NULL) {
+    cpu_actuator_close(actuator);
+  }
+}
+
+void cpu_actuator_set_follow_children(poet_cpu_actuator* actuator,
+                                      int follow_children) {
+  if (actuator != NULL) {
+    actuator->follow_children = follow_children;
+  }
+}
+
+void cpu_actuator_set_revalidate_period(poet_cpu_actuator* actuator,
+                                        unsigned int applies) {
+  if (actuator != NULL) {
+    actuator->revalidate_period = applies;
+    actuator->applies_since_revalidate = 0;
+  }
+}
+
+void cpu_actuator_get_write_stats(const poet_cpu_actuator* actuator,
+                                  unsigned long* num_writes,
+                                  unsigned long* num_skipped,
+                                  unsigned long* num_stale) {
+  if (actuator == NULL) {
+    return;
+  }
+  if (num_writes != NULL) {
+    *num_writes = actuator->num_writes;
+  }
+  if (num_skipped != NULL) {
+    *num_skipped = actuator->num_skipped;
+  }
+  if (num_stale != NULL) {
+    *num_stale = actuator->num_stale;
+  }
+}
+
+unsigned long cpu_actuator_get_errors(const poet_cpu_actuator* actuator,
+                                      int* last_errno) {
+  if (actuator == NULL) {
+    return 0;
+  }
+  if (last_errno != NULL) {
+    *last_errno = actuator->last_errno;
+  }
+  return actuator->num_errors;
+}
+
+void cpu_actuator_get_idle_stats(const poet_cpu_actuator* actuator,
+                                 unsigned long* num_idles,
+                                 unsigned long long* requested_ns,
+                                 unsigned long long* achieved_ns) {
+  if (actuator == NULL) {
+    return;
+  }
+  if (num_idles != NULL) {
+    *num_idles = actuator->num_idles;
+  }
+  if (requested_ns != NULL) {
+    *requested_ns = actuator->idle_requested_ns;
+  }
+  if (achieved_ns != NULL) {
+    *achieved_ns = actuator->idle_achieved_ns;
+  }
+}
+
+// Set CPU frequencies by writing to the open DVFS files
+// write the frequencies of the domains that differ from the shadow state
+static void cpu_actuator_apply_frequencies(poet_cpu_actuator* actuator,
+                                           unsigned int id) {
+  char buf[32];
+  int len;
+  ssize_t written;
+  unsigned int cpu;
+  unsigned int d;
+  unsigned int i;
+  const poet_cpu_table* table = actuator->table;
+  const unsigned long* freqs = get_cpu_table_freqs(table, id);
+  for (d = 0; d < table->num_domains; d++) {
+    if (freqs[d] == 0) {
+      continue;
+    }
+    if (actuator->applied_freqs[d] == freqs[d]) {
+      actuator->num_skipped++;
+      continue;
+    }
+    len = snprintf(buf, sizeof(buf), "%lu\n", freqs[d]);
+    actuator->applied_freqs[d] = freqs[d];
+    for (i = table->domain_offsets[d]; i < table->domain_offsets[d + 1]; i++) {
+      cpu = table->domain_cpus[i];
+      written = pwrite(actuator->fds[cpu], buf, (size_t) len, 0);
+      actuator->num_writes++;
+      if (written != len) {
+        // a short write to sysfs means the value was not accepted
+        actuator->last_errno = written < 0 ? errno : EIO;
+        actuator->num_errors++;
+        // try again next time
+        actuator->applied_freqs[d] = 0;
+        fprintf(stderr, "apply_cpu_actuator: Failed to set CPU %u frequency to %lu: %s\n",
+                cpu, freqs[d], strerror(actuator->last_errno));
+      }
+    }
+  }
+}
+
+// read back the DVFS file of a CPU, 0 if it can't be read
+static unsigned long cpu_actuator_read_frequency(const poet_cpu_actuator* actuator,
+                                                 unsigned int cpu) {
+  char path[4096];
+  unsigned long freq = 0;
+  FILE* f;
+  snprintf(path, sizeof(path), "%s/cpu%u/cpufreq/"POET_CONFIG_DVFS_FILE,
+           actuator->sysfs_root, cpu);
+  f = fopen(path, "r");
+  if (f != NULL) {
+    if (fscanf(f, "%lu", &freq) != 1) {
+      freq = 0;
+    }
+    fclose(f);
+  }
+  return freq;
+}
+
+// forget shadow values that no longer match the system, e.g. after another
+// process changed a frequency or this process's affinity
+static void cpu_actuator_revalidate(poet_cpu_actuator* actuator) {
+  unsigned int d;
+  unsigned int i;
+  const poet_cpu_table* table = actuator->table;
+  long num_configured_cpus = sysconf(_SC_NPROCESSORS_CONF);
+  unsigned int num_cpus = num_configured_cpus > (long) table->num_cpus ?
+                          (unsigned int) num_configured_cpus : table->num_cpus;
+  size_t size = CPU_ALLOC_SIZE(num_cpus);
+  cpu_set_t* mask;
+
+  for (d = 0; d < table->num_domains; d++) {
+    for (i = table->domain_offsets[d];
+         actuator->applied_freqs[d] != 0 && i < table->domain_offsets[d + 1]; i++) {
+      if (cpu_actuator_read_frequency(actuator, table->domain_cpus[i]) !=
+          actuator->applied_freqs[d]) {
+        actuator->applied_freqs[d] = 0;
+        actuator->num_stale++;
+      }
+    }
+  }
+  if (actuator->applied_cores < table->num_states) {
+    mask = CPU_ALLOC(num_cpus);
+    if (mask == NULL || sched_getaffinity(0, size, mask) ||
+        !cpu_sets_equal(mask, size, get_cpu_table_mask(table, actuator->applied_cores),
+                        table->mask_size)) {
+      actuator->applied_cores = table->num_states;
+      actuator->num_stale++;
+    }
+    if (mask != NULL) {
+      CPU_FREE(mask);
+    }
+  }
+}
+
+// forget the shadow state on the first apply, or revalidate it periodically
+static void cpu_actuator_check_shadow(poet_cpu_actuator* actuator,
+                                      unsigned int is_first_apply) {
+  if (is_first_apply) {
+    // nothing is known about the system yet
+    memset(actuator->applied_freqs, 0, actuator->table->num_domains * sizeof(unsigned long));
+    actuator->applied_cores = actuator->table->num_states;
+    actuator->applies_since_revalidate = 0;
+  } else if (actuator->revalidate_period > 0 &&
+             ++actuator->applies_since_revalidate >= actuator->revalidate_period) {
+    cpu_actuator_revalidate(actuator);
+    actuator->applies_since_revalidate = 0;
+  }
+}
+
+// only set affinity if the core assignment has changed, returns 0 or an errno
+static int cpu_actuator_apply_cores(poet_cpu_actuator* actuator, unsigned int id) {
+  int err = 0;
+  if (actuator->applied_cores == actuator->table->num_states ||
+      !cpu_table_cores_equal(actuator->table, id, actuator->applied_cores)) {
+    err = apply_cpu_core_mask(get_cpu_table_mask(actuator->table, id),
+                              actuator->table->mask_size, actuator->follow_children);
+    actuator->applied_cores = err ? actuator->table->num_states : id;
+  }
+  return err;
+}
+
+void apply_cpu_actuator(void* states,
+                        unsigned int num_states,
+                        unsigned int id,
+                        unsigned int last_id,
+                        unsigned long long idle_ns,
+                        unsigned int is_first_apply) {
+  int err;
+  poet_cpu_actuator* actuator = (poet_cpu_actuator*) states;
+  if (actuator == NULL) {
+    fprintf(stderr, "apply_cpu_actuator: actuator cannot be null.\n");
+    return;
+  }
+  if (id >= num_states || last_id >= num_states || num_states != actuator->table->num_states) {
+    fprintf(stderr, "apply_cpu_actuator: id '%u' or last_id '%u' are not "
+            "acceptable values, they must be less than the number of states, "
+            "'%u'.\n", id, last_id, actuator->table->num_states);
+    return;
+  }
+  cpu_actuator_check_shadow(actuator, is_first_apply);
+  err = cpu_actuator_apply_cores(actuator, id);
+  if (err) {
+    actuator->last_errno = err;
+    actuator->num_errors++;
+  }
+  cpu_actuator_apply_frequencies(actuator, id);
+  // idle this process if desired
+  if (idle_ns > 0) {
+    actuator->idle_achieved_ns += apply_cpu_idle_state(idle_ns);
+    actuator->idle_requested_ns += idle_ns;
+    actuator->num_idles++;
+  }
+}
+
+int get_current_cpu_actuator_state(const void* states,
+                                   unsigned int num_states,
+                                   unsigned int* curr_state_id) {
+  const poet_cpu_actuator* actuator = (const poet_cpu_actuator*) states;
+  if (actuator == NULL) {
+    return -1;
+  }
+  return get_current_cpu_table_state(actuator->table, num_states, curr_state_id);
+}
+
+struct poet_cgroup_actuator {
+  poet_cpu_table* table;
+  int cpuset_fd;
+  int cpu_max_fd;
+  // cpuset.cpus list of each state, LEN_CPU_LIST(table->num_cpus) bytes each
+  char* cpu_lists;
+  // cpu.max before idling, restored after each idle
+  char cpu_max[CGROUP_LEN_CPU_MAX];
+  unsigned long num_errors;
+  int last_errno;
+  unsigned long num_idles;
+  unsigned long long idle_requested_ns;
+  unsigned long long idle_achieved_ns;
+};
+
+
+// find the cgroup v2 directory of this process
+static int get_own_cgroup(char* path, size_t len) {
+  char line[4096];
+  int ret = -1;
+  FILE* f = fopen("/proc/self/cgroup", "r");
+  if (f == NULL) {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    // the unified hierarchy is "0::/path"
+    if (strncmp(line, "0::", 3) == 0) {
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(path, len, "%s%s", POET_CONFIG_CGROUP_ROOT, &line[3]);
+      ret = 0;
+      break;
+    }
+  }
+  fclose(f);
+  if (ret) {
+    errno = ENOENT;
+  }
+  return ret;
+}
+
+static void cgroup_actuator_close(poet_cgroup_actuator* actuator) {
+  if (actuator->cpuset_fd >= 0) {
+    close(actuator->cpuset_fd);
+  }
+  if (actuator->cpu_max_fd >= 0) {
+    close(actuator->cpu_max_fd);
+  }
+  free(actuator->cpu_lists);
+  cpu_table_destroy(actuator->table);
+  free(actuator);
+}
+
+static int open_cgroup_file(const char* cgroup, const char* file) {
+  char path[4096];
+  int err;
+  int fd;
+  snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+  fd = open(path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    err = errno;
+    fprintf(stderr, "cgroup_actuator_init: Failed to open %s: %s\n", path, strerror(err));
+    errno = err;
+  }
+  return fd;
+}
+
+poet_cgroup_actuator* cgroup_actuator_init(const poet_cpu_state_t* states,
+                                           unsigned int num_states,
+                                           const char* cgroup) {
+  char own_cgroup[4096];
+  unsigned int i;
+  ssize_t len;
+  int err;
+  poet_cgroup_actuator* actuator;
+
+  if (states == NULL || num_states == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (cgroup == NULL) {
+    if (get_own_cgroup(own_cgroup, sizeof(own_cgroup))) {
+      return NULL;
+    }
+    cgroup = own_cgroup;
+  }
+  actuator = calloc(1, sizeof(poet_cgroup_actuator));
+  if (actuator == NULL) {
+    return NULL;
+  }
+  actuator->cpuset_fd = -1;
+  actuator->cpu_max_fd = -1;
+  actuator->table = cpu_table_init(states, num_states);
+  if (actuator->table == NULL) {
+    err = errno;
+    cgroup_actuator_close(actuator);
+    errno = err;
+    return NULL;
+  }
+  actuator->cpu_lists = malloc(num_states * LEN_CPU_LIST(actuator->table->num_cpus));
+  if (actuator->cpu_lists == NULL) {
+    cgroup_actuator_close(actuator);
+    errno = ENOMEM;
+    return NULL;
+  }
+  for (i = 0; i < num_states; i++) {
+    format_cpu_list(get_cpu_table_mask(actuator->table, i), actuator->table->num_cpus,
+                    &actuator->cpu_lists[i * LEN_CPU_LIST(actuator->table->num_cpus)]);
+  }
+
+  actuator->cpuset_fd = open_cgroup_file(cgroup, "cpuset.cpus");
+  if (actuator->cpuset_fd >= 0) {
+    actuator->cpu_max_fd = open_cgroup_file(cgroup, "cpu.max");
+  }
+  if (actuator->cpu_max_fd < 0) {
+    err = errno;
+    cgroup_actuator_close(actuator);
+    errno = err;
+    return NULL;
+  }
+  len = pread(actuator->cpu_max_fd, actuator->cpu_max, sizeof(actuator->cpu_max) - 1, 0);
+  if (len <= 0) {
+    err = len < 0 ? errno : EIO;
+    fprintf(stderr, "cgroup_actuator_init: Failed to read cpu.max: %s\n", strerror(err));
+    cgroup_actuator_close(actuator);
+    errno = err;
+    return NULL;
+  }
+  actuator->cpu_max[len] = '\0';
+  return actuator;
+}
+
+void cgroup_actuator_destroy(poet_cgroup_actuator* actuator) {
+  if (actuator != NULL) {
+    cgroup_actuator_close(actuator);
+  }
+}
+
+unsigned long cgroup_actuator_get_errors(const poet_cgroup_actuator* actuator,
+                                         int* last_errno) {
+  if (actuator == NULL) {
+    return 0;
+  }
+  if (last_errno != NULL) {
+    *last_errno = actuator->last_errno;
+  }
+  return actuator->num_errors;
+}
+
+void cgroup_actuator_get_idle_stats(const poet_cgroup_actuator* actuator,
+                                    unsigned long* num_idles,
+                                    unsigned long long* requested_ns,
+                                    unsigned long long* achieved_ns) {
+  if (actuator == NULL) {
+    return;
+  }
+  if (num_idles != NULL) {
+    *num_idles = actuator->num_idles;
+  }
+  if (requested_ns != NULL) {
+    *requested_ns = actuator->idle_requested_ns;
+  }
+  if (achieved_ns != NULL) {
+    *achieved_ns = actuator->idle_achieved_ns;
+  }
+}
+
+static int cgroup_actuator_write(poet_cgroup_actuator* actuator,
+                                 int fd,
+                                 const char* value,
+                                 const char* file) {
+  size_t len = strlen(value);
+  ssize_t written = pwrite(fd, value, len, 0);
+  if (written != (ssize_t) len) {
+    // a short write to cgroupfs means the value was not accepted
+    actuator->last_errno = written < 0 ? errno : EIO;
+    actuator->num_errors++;
+    fprintf(stderr, "apply_cgroup_actuator: Failed to write %s: %s\n", file,
+            strerror(actuator->last_errno));
+    return -1;
+  }
+  return 0;
+}
+
+// Throttle the whole cgroup with cpu.max for the idle time, returns the
+// achieved idle time
+static unsigned long long cgroup_actuator_idle(poet_cgroup_actuator* actuator,
+                                               unsigned long long idle_ns) {
+  char cpu_max[CGROUP_LEN_CPU_MAX];
+  struct timespec deadline;
+  unsigned long long achieved_ns = 0;
+  unsigned long long start;
+  unsigned long long end;
+  unsigned long long period_us = idle_ns / 1000;
+
+  if (period_us < 2 * CGROUP_IDLE_QUOTA_US) {
+    // the group would run for most of such a short period
+    if (idle_process(idle_ns, &achieved_ns)) {
+      fprintf(stderr, "apply_cgroup_actuator: ERROR pausing threads: %s\n", strerror(errno));
+    }
+    return achieved_ns;
+  }
+  if (period_us > CGROUP_MAX_PERIOD_US) {
+    period_us = CGROUP_MAX_PERIOD_US;
+  }
+  snprintf(cpu_max, sizeof(cpu_max), "%llu %llu\n", CGROUP_IDLE_QUOTA_US, period_us);
+  start = get_monotonic_ns();
+  if (cgroup_actuator_write(actuator, actuator->cpu_max_fd, cpu_max, "cpu.max")) {
+    return 0;
+  }
+  deadline.tv_sec = (time_t) ((start + idle_ns) / IDLE_NS_PER_SEC);
+  deadline.tv_nsec = (long) ((start + idle_ns) % IDLE_NS_PER_SEC);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+  end = get_monotonic_ns();
+  cgroup_actuator_write(actuator, actuator->cpu_max_fd, actuator->cpu_max, "cpu.max");
+  return end - start;
+}
+
+void apply_cgroup_actuator(void* states,
+                           unsigned int num_states,
+                           unsigned int id,
+                           unsigned int last_id,
+                           unsigned long long idle_ns,
+                           unsigned int is_first_apply) {
+  poet_cgroup_actuator* actuator = (poet_cgroup_actuator*) states;
+  if (actuator == NULL) {
+    fprintf(stderr, "apply_cgroup_actuator: actuator cannot be null.\n");
+    return;
+  }
+  if (id >= num_states || last_id >= num_states || num_states != actuator->table->num_states) {
+    fprintf(stderr, "apply_cgroup_actuator: id '%u' or last_id '%u' are not "
+            "acceptable values, they must be less than the number of states, "
+            "'%u'.\n", id, last_id, actuator->table->num_states);
+    return;
+  }
+  // only write the cpuset if the core assignment has changed
+  if (is_first_apply || !cpu_table_cores_equal(actuator->table, id, last_id)) {
+    cgroup_actuator_write(actuator, actuator->cpuset_fd,
+                          &actuator->cpu_lists[id * LEN_CPU_LIST(actuator->table->num_cpus)],
+                          "cpuset.cpus");
   }
-
-  if (sched_getaffinity(getpid(), sizeof(cur_mask), cur_mask)) {
-    fprintf(stderr, "alloc_curr_cpu_assignment: Failed to get CPU affinity\n");
-    CPU_FREE(cur_mask);
-    return NULL;
+  // idle this cgroup if desired
+  if (idle_ns > 0) {
+    actuator->idle_achieved_ns += cgroup_actuator_idle(actuator, idle_ns);
+    actuator->idle_requested_ns += idle_ns;
+    actuator->num_idles++;
   }
-  *num_cpus = num_configured_cpus;
-  return cur_mask;
 }
 
-/**
- * Compare the current CPU governor state with the provided one.
- * Returns -1 on failure.
- */
-static inline int cpu_governor_cmp(unsigned int cpu, const char* governor) {
-  FILE* fp;
-  char buffer[128];
-  int governor_cmp = -1;
-  size_t len;
-
-  snprintf(buffer, sizeof(buffer),
-           "/sys/devices/system/cpu/cpu%u/cpufreq/scaling_governor", cpu);
-  fp = fopen(buffer, "r");
-  if (fp == NULL) {
-    fprintf(stderr, "cpu_governor_cmp: Failed to open %s\n", buffer);
+int get_current_cgroup_actuator_state(const void* states,
+                                      unsigned int num_states,
+                                      unsigned int* curr_state_id) {
+  char* list;
+  cpu_set_t* mask;
+  ssize_t len;
+  unsigned int i;
+  const poet_cgroup_actuator* actuator = (const poet_cgroup_actuator*) states;
+  const poet_cpu_table* table;
+  if (actuator == NULL || curr_state_id == NULL || num_states != actuator->table->num_states) {
     return -1;
   }
-
-  if (fgets(buffer, sizeof(buffer), fp) != NULL) {
-    // replace trailing newline
-    len = strlen(buffer);
-    if (len > 0 && buffer[len - 1] == '\n') {
-        buffer[len - 1] = '\0';
+  table = actuator->table;
+  list = malloc(LEN_CPU_LIST(table->num_cpus));
+  mask = CPU_ALLOC(table->num_cpus);
+  if (list == NULL || mask == NULL) {
+    free(list);
+    if (mask != NULL) {
+      CPU_FREE(mask);
     }
-    governor_cmp = strcmp(governor, buffer);
+    return -1;
   }
-  fclose(fp);
-
-  return governor_cmp;
+  len = pread(actuator->cpuset_fd, list, LEN_CPU_LIST(table->num_cpus) - 1, 0);
+  i = num_states;
+  // a CPU no state uses can't match
+  if (len > 0) {
+    list[len] = '\0';
+    if (parse_cpu_list(list, mask, table->num_cpus, NULL) <= table->num_cpus) {
+      // frequencies are not set by this actuator, so the first state with the
+      // same cores is as good as any
+      for (i = 0; i < num_states; i++) {
+        if (CPU_EQUAL_S(table->mask_size, mask, get_cpu_table_mask(table, i))) {
+          *curr_state_id = i;
+          break;
+        }
+      }
+    }
+  }
+  free(list);
+  CPU_FREE(mask);
+  return i < num_states ? 0 : -1;
 }
 
-/**
- * Attempt to get the current frequency of the cpu.
+/*
+ * Built-in actuator backends
  */
-static inline unsigned long get_curr_cpu_frequency(unsigned long cpu) {
-  FILE* fp;
-  char buffer[128];
-  unsigned long curr_freq = 0;
 
-  snprintf(buffer, sizeof(buffer),
-           "/sys/devices/system/cpu/cpu%lu/cpufreq/scaling_cur_freq", cpu);
-  fp = fopen(buffer, "r");
-  if (fp == NULL) {
-    fprintf(stderr, "get_curr_cpu_frequency: Failed to open %s\n", buffer);
-    return 0;
+// sets affinity like the CPU actuator, without opening DVFS files
+typedef struct {
+  const poet_cpu_table* table;
+  unsigned int applied_cores;
+} cores_backend;
+
+static void* cores_backend_init(poet_cpu_table* table, const char* sysfs_root) {
+  cores_backend* backend = malloc(sizeof(cores_backend));
+  (void) sysfs_root;
+  if (backend == NULL) {
+    return NULL;
   }
+  backend->table = table;
+  backend->applied_cores = table->num_states;
+  return backend;
+}
 
-  if (fgets(buffer, sizeof(buffer), fp) != NULL) {
-    curr_freq = strtoul(buffer, NULL, 0);
-  } else {
-    fprintf(stderr,
-            "get_curr_cpu_frequency: Failed to read frequency from core %lu\n",
-            cpu);
+static int cores_backend_apply(void* ctx, unsigned int id, unsigned int last_id,
+                               unsigned long long idle_ns, unsigned int is_first_apply) {
+  cores_backend* backend = (cores_backend*) ctx;
+  int err = 0;
+  (void) last_id;
+  (void) idle_ns;
+  if (is_first_apply || backend->applied_cores == backend->table->num_states ||
+      !cpu_table_cores_equal(backend->table, id, backend->applied_cores)) {
+    err = apply_cpu_core_mask(get_cpu_table_mask(backend->table, id),
+                              backend->table->mask_size, 0);
+    backend->applied_cores = err ? backend->table->num_states : id;
   }
-  fclose(fp);
+  return err;
+}
 
-  return curr_freq;
+static void* dvfs_backend_init(poet_cpu_table* table, const char* sysfs_root) {
+  char path[4096];
+  if (sysfs_root != NULL) {
+    snprintf(path, sizeof(path), "%s/devices/system/cpu", sysfs_root);
+  }
+  return cpu_actuator_create(table, 0, sysfs_root == NULL ? NULL : path);
 }
 
-// Read current CPU frequencies for assigned cores.
-// Returns -1 if bad DVFS governor is found for an assigned core.
-static inline int get_cpu_frequencies(cpu_set_t* curr_cpu_mask,
-                                      unsigned long* curr_freq_assignment,
-                                      unsigned long ncpus) {
-  unsigned long i;
-  for (i = 0; i < ncpus; i++) {
-    // assigned cores must be in proper scaling governor,
-    // otherwise could get a false reading
-    if(CPU_ISSET_S(i, CPU_ALLOC_SIZE(ncpus), curr_cpu_mask) &&
-       cpu_governor_cmp(i, POET_CONFIG_DVFS_GOVERNOR)) {
-      fprintf(stderr,
-              "get_cpu_frequencies: Not all affected cores in "
-              POET_CONFIG_DVFS_GOVERNOR" governor\n");
-      return -1;
-    }
-    curr_freq_assignment[i] = get_curr_cpu_frequency(i);
+static int dvfs_backend_apply(void* ctx, unsigned int id, unsigned int last_id,
+                              unsigned long long idle_ns, unsigned int is_first_apply) {
+  poet_cpu_actuator* actuator = (poet_cpu_actuator*) ctx;
+  unsigned long num_errors = actuator->num_errors;
+  (void) last_id;
+  (void) idle_ns;
+  cpu_actuator_check_shadow(actuator, is_first_apply);
+  cpu_actuator_apply_frequencies(actuator, id);
+  return actuator->num_errors == num_errors ? 0 : actuator->last_errno;
+}
+
+static void dvfs_backend_destroy(void* ctx) {
+  cpu_actuator_destroy((poet_cpu_actuator*) ctx);
+}
+
+// writes the power limit of each RAPL zone, restoring the original limits
+// when destroyed
+typedef struct {
+  const poet_cpu_table* table;
+  // power limit file of each zone, or -1 if no state limits it
+  int* fds;
+  unsigned long* original_limits;
+  // shadow of the last applied limits, 0 if unknown
+  unsigned long* applied_limits;
+} rapl_backend;
+
+static int rapl_write_limit(int fd, unsigned long limit) {
+  char buf[32];
+  int len = snprintf(buf, sizeof(buf), "%lu\n", limit);
+  ssize_t written = pwrite(fd, buf, (size_t) len, 0);
+  if (written != len) {
+    return written < 0 ? errno : EIO;
   }
   return 0;
 }
 
-// parse core and frequency lists and fill in the assignments arrays
-static inline int parse_cores_and_freqs(const char* state_core_mask,
-                                        const char* state_freqs,
-                                        unsigned long ncpus,
-                                        cpu_set_t* i_core_mask,
-                                        unsigned long* i_freq_assignment) {
-  unsigned long i = 0;
-  char* freqs = strdup(state_freqs);
-  if (freqs == NULL) {
-    fprintf(stderr, "parse_cores_and_freqs: strdup failed\n");
-    return -1;
+static void rapl_backend_destroy(void* ctx) {
+  rapl_backend* backend = (rapl_backend*) ctx;
+  unsigned int z;
+  if (backend->fds != NULL) {
+    for (z = 0; z < backend->table->num_zones; z++) {
+      if (backend->fds[z] >= 0) {
+        if (backend->original_limits[z] != 0 &&
+            rapl_write_limit(backend->fds[z], backend->original_limits[z])) {
+          fprintf(stderr, "rapl_backend_destroy: Failed to restore intel-rapl:%u power limit\n", z);
+        }
+        close(backend->fds[z]);
+      }
+    }
+  }
+  free(backend->fds);
+  free(backend->original_limits);
+  free(backend->applied_limits);
+  free(backend);
+}
+
+static void* rapl_backend_init(poet_cpu_table* table, const char* sysfs_root) {
+  char path[4096];
+  char buf[32];
+  ssize_t len;
+  unsigned int i;
+  unsigned int z;
+  int err;
+  rapl_backend* backend = calloc(1, sizeof(rapl_backend));
+  if (backend == NULL) {
+    return NULL;
+  }
+  backend->table = table;
+  backend->fds = malloc((table->num_zones + 1) * sizeof(int));
+  backend->original_limits = calloc(table->num_zones + 1, sizeof(unsigned long));
+  backend->applied_limits = calloc(table->num_zones + 1, sizeof(unsigned long));
+  if (backend->fds == NULL || backend->original_limits == NULL ||
+      backend->applied_limits == NULL) {
+    rapl_backend_destroy(backend);
+    errno = ENOMEM;
+    return NULL;
+  }
+  for (z = 0; z < table->num_zones; z++) {
+    backend->fds[z] = -1;
   }
-  char* freq;
-  // clear assignments
-  CPU_ZERO_S(CPU_ALLOC_SIZE(ncpus), i_core_mask);
-  memset(i_freq_assignment, 0, ncpus * sizeof(unsigned long));
-  // now parse
-  freq = strtok(freqs, ",");
-  while (freq != NULL) {
-    if (freq[0] != '-') {
-      i_freq_assignment[i] = strtoul(freq, NULL, 0);
+  for (z = 0; z < table->num_zones; z++) {
+    for (i = 0; i < table->num_states && get_cpu_table_power_limits(table, i)[z] == 0; i++);
+    if (i == table->num_states) {
+      continue;
+    }
+    if (sysfs_root == NULL) {
+      snprintf(path, sizeof(path), POET_CONFIG_POWERCAP_SYSFS"/intel-rapl:%u/constraint_%d_power_limit_uw",
+               z, POET_CONFIG_RAPL_CONSTRAINT);
+    } else {
+      snprintf(path, sizeof(path), "%s/class/powercap/intel-rapl:%u/constraint_%d_power_limit_uw",
+               sysfs_root, z, POET_CONFIG_RAPL_CONSTRAINT);
+    }
+    backend->fds[z] = open(path, O_RDWR | O_CLOEXEC);
+    if (backend->fds[z] < 0) {
+      err = errno;
+      fprintf(stderr, "rapl_backend_init: Failed to open %s: %s\n", path, strerror(err));
+      rapl_backend_destroy(backend);
+      errno = err;
+      return NULL;
     }
-    freq = strtok(NULL, ",");
-    i++;
+    len = pread(backend->fds[z], buf, sizeof(buf) - 1, 0);
+    buf[len < 0 ? 0 : len] = '\0';
+    backend->original_limits[z] = strtoul(buf, NULL, 10);
   }
-  char c[] = {'0', 'x', '0', '\0'};
-  for (i = 0; i < ncpus; i++) {
-    // check if core is active in this state
-    // need to convert char representing hex value to a number format
-    c[2] = state_core_mask[POET_LEN_CORE_MASK - 2 - (i / 4)];
-    if ((1 << (i % 4)) & strtoul(c, NULL, 16)) {
-      CPU_SET_S(i, CPU_ALLOC_SIZE(ncpus), i_core_mask);
+  return backend;
+}
+
+static int rapl_backend_apply(void* ctx, unsigned int id, unsigned int last_id,
+                              unsigned long long idle_ns, unsigned int is_first_apply) {
+  rapl_backend* backend = (rapl_backend*) ctx;
+  const unsigned long* limits = get_cpu_table_power_limits(backend->table, id);
+  unsigned int z;
+  int err;
+  int ret = 0;
+  (void) last_id;
+  (void) idle_ns;
+  for (z = 0; z < backend->table->num_zones; z++) {
+    if (limits[z] == 0 || (!is_first_apply && backend->applied_limits[z] == limits[z])) {
+      continue;
+    }
+    err = rapl_write_limit(backend->fds[z], limits[z]);
+    backend->applied_limits[z] = err ? 0 : limits[z];
+    if (err) {
+      fprintf(stderr, "apply_actuator: Failed to set intel-rapl:%u power limit to %lu: %s\n",
+              z, limits[z], strerror(err));
+      ret = err;
     }
   }
-  free(freqs);
+  return ret;
+}
+
+static void* idle_backend_init(poet_cpu_table* table, const char* sysfs_root) {
+  (void) sysfs_root;
+  return table;
+}
+
+static int idle_backend_apply(void* ctx, unsigned int id, unsigned int last_id,
+                              unsigned long long idle_ns, unsigned int is_first_apply) {
+  (void) ctx;
+  (void) id;
+  (void) last_id;
+  (void) is_first_apply;
+  if (idle_ns > 0) {
+    apply_cpu_idle_state(idle_ns);
+  }
   return 0;
 }
 
-static inline int dvfs_freqs_equal(unsigned long* curr_freq_assignment,
-                                   unsigned long* i_freq_assignment,
-                                   unsigned long ncpus) {
-  unsigned long i;
-  for (i = 0; i < ncpus; i++) {
-    if (i_freq_assignment[i] != 0 &&
-        curr_freq_assignment[i] != i_freq_assignment[i]) {
-      // we care about this core, but the frequencies don't match
-      return 0;
+static void free_backend(void* ctx) {
+  free(ctx);
+}
+
+static void keep_backend(void* ctx) {
+  (void) ctx;
+}
+
+static const poet_actuator_backend builtin_backends[] = {
+  {"cores", cores_backend_init, cores_backend_apply, free_backend},
+  {"dvfs", dvfs_backend_init, dvfs_backend_apply, dvfs_backend_destroy},
+  {"rapl", rapl_backend_init, rapl_backend_apply, rapl_backend_destroy},
+  {"idle", idle_backend_init, idle_backend_apply, keep_backend},
+};
+#define NUM_BUILTIN_BACKENDS (sizeof(builtin_backends) / sizeof(builtin_backends[0]))
+
+static const poet_actuator_backend* actuator_backends[POET_CONFIG_MAX_ACTUATOR_BACKENDS] = {
+  &builtin_backends[0], &builtin_backends[1], &builtin_backends[2], &builtin_backends[3],
+};
+static unsigned int num_actuator_backends = NUM_BUILTIN_BACKENDS;
+static pthread_mutex_t actuator_backends_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const poet_actuator_backend* find_actuator_backend(const char* name, size_t len) {
+  unsigned int i;
+  for (i = 0; i < num_actuator_backends; i++) {
+    if (strlen(actuator_backends[i]->name) == len &&
+        !strncmp(actuator_backends[i]->name, name, len)) {
+      return actuator_backends[i];
     }
   }
-  return 1;
+  return NULL;
 }
 
-// try to get current CPU configuration state
-static int get_cpu_state(const poet_cpu_state_t* states,
-                         unsigned int num_states,
-                         unsigned int* curr_state_id) {
-  int ret = -1;
-  unsigned long ncpus = 0;
-  unsigned long i;
-  cpu_set_t* curr_cpu_mask = NULL;
-  unsigned long* curr_freq_assignment = NULL;
-  cpu_set_t* i_cpu_mask = NULL;
-  unsigned long* i_freq_assignment = NULL;
-
-  // first determine the current core assignment
-  curr_cpu_mask = alloc_curr_cpu_assignment(&ncpus);
-  if (!curr_cpu_mask) {
-    return ret;
-  }
-  curr_freq_assignment = malloc(ncpus * sizeof(unsigned long));
-  i_cpu_mask = CPU_ALLOC(ncpus);
-  i_freq_assignment = malloc(ncpus * sizeof(unsigned long));
-
-  if (curr_freq_assignment && i_cpu_mask && i_freq_assignment) {
-    // now determine the frequency assignments for active cores
-    if(get_cpu_frequencies(curr_cpu_mask, curr_freq_assignment, ncpus)) {
-        fprintf(stderr, "get_cpu_state: Failed to get CPU frequencies\n");
-    } else {
-      // search all states for a match
-      for (i = 0; i < num_states; i++) {
-        // parse core and freq lists for this state
-        if (parse_cores_and_freqs(states[i].core_mask, states[i].freqs, ncpus,
-                                  i_cpu_mask, i_freq_assignment)) {
-          // should only happen with a bad configuration
-          fprintf(stderr,
-                  "get_cpu_state: Failed to parse config for state %lu", i);
-          // no reason we can't keep searching
-          continue;
-        }
-        // compare current CPU and frequency assignments with this state
-        if (CPU_EQUAL_S(CPU_ALLOC_SIZE(ncpus), curr_cpu_mask, i_cpu_mask) &&
-            dvfs_freqs_equal(curr_freq_assignment, i_freq_assignment, ncpus)) {
-          // all fields matched
-          *curr_state_id = states[i].id;
-          ret = 0;
-          // don't break yet - if this is an idle state, we actually want to
-          // find its partner state
-        }
-      }
-    }
+int actuator_register_backend(const poet_actuator_backend* backend) {
+  int err = 0;
+  if (backend == NULL || backend->name == NULL || backend->init == NULL ||
+      backend->apply == NULL || backend->destroy == NULL || strchr(backend->name, ',')) {
+    errno = EINVAL;
+    return -1;
+  }
+  pthread_mutex_lock(&actuator_backends_lock);
+  if (find_actuator_backend(backend->name, strlen(backend->name)) != NULL) {
+    err = EEXIST;
+  } else if (num_actuator_backends == POET_CONFIG_MAX_ACTUATOR_BACKENDS) {
+    err = ENOSPC;
   } else {
-    fprintf(stderr, "get_cpu_state: Failed to malloc\n");
+    actuator_backends[num_actuator_backends++] = backend;
   }
-
-  if (i_cpu_mask) {
-    CPU_FREE(i_cpu_mask);
+  pthread_mutex_unlock(&actuator_backends_lock);
+  if (err) {
+    errno = err;
+    return -1;
   }
-  free(i_freq_assignment);
-  CPU_FREE(curr_cpu_mask);
-  free(curr_freq_assignment);
-  return ret;
+  return 0;
 }
 
-int get_current_cpu_state(const void* states,
-                          unsigned int num_states,
-                          unsigned int* curr_state_id) {
-  return get_cpu_state((const poet_cpu_state_t*) states, num_states, curr_state_id);
+const poet_actuator_backend* actuator_get_backend(const char* name) {
+  const poet_actuator_backend* backend;
+  if (name == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&actuator_backends_lock);
+  backend = find_actuator_backend(name, strlen(name));
+  pthread_mutex_unlock(&actuator_backends_lock);
+  return backend;
 }
 
-static void apply_cpu_idle_state(unsigned long long nanosec) {
-  char command[4096];
-  snprintf(command, sizeof(command), POET_CONFIG_IDLE_PATH" %llu %ld", nanosec, (long) getpid());
-  printf("apply_cpu_idle_state: %s\n", command);
-  if (system(command)) {
-    fprintf(stderr, "apply_cpu_idle_state: ERROR idling process\n");
+/*
+ * Composite actuator
+ */
+
+struct poet_actuator {
+  poet_cpu_table* table;
+  unsigned int num_backends;
+  const poet_actuator_backend* backends[POET_CONFIG_MAX_ACTUATOR_BACKENDS];
+  void* contexts[POET_CONFIG_MAX_ACTUATOR_BACKENDS];
+  unsigned long num_errors;
+  int last_errno;
+};
+
+void actuator_destroy(poet_actuator* actuator) {
+  unsigned int i;
+  if (actuator != NULL) {
+    // in reverse, like restoring a stack of settings
+    for (i = actuator->num_backends; i > 0; i--) {
+      actuator->backends[i - 1]->destroy(actuator->contexts[i - 1]);
+    }
+    free(actuator);
   }
 }
 
-// Set CPU frequency and number of cores using taskset system call
-static void apply_cpu_config_taskset(poet_cpu_state_t* cpu_states,
-                                     unsigned int num_states,
-                                     unsigned int id,
-                                     unsigned int last_id,
-                                     unsigned int is_first_apply) {
-  int retvalsyscall = 0;
-  char command[4096];
+poet_actuator* actuator_init(poet_cpu_table* table,
+                             const char* backends,
+                             const char* sysfs_root) {
+  char names[64];
+  const char* name;
+  const poet_actuator_backend* backend;
+  size_t len;
+  int err;
+  poet_actuator* actuator;
 
-  if (id >= num_states || last_id >= num_states) {
-    fprintf(stderr, "apply_cpu_config_taskset: id '%u' or last_id '%u' are not "
+  if (table == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if (backends == NULL) {
+    // every knob the table sets
+    snprintf(names, sizeof(names), "cores%s%s,idle", table->num_domains > 0 ? ",dvfs" : "",
+             table->num_zones > 0 ? ",rapl" : "");
+    backends = names;
+  }
+  actuator = calloc(1, sizeof(poet_actuator));
+  if (actuator == NULL) {
+    return NULL;
+  }
+  actuator->table = table;
+  for (name = backends; *name != '\0'; name += len + (name[len] == ',')) {
+    len = strcspn(name, ",");
+    pthread_mutex_lock(&actuator_backends_lock);
+    backend = find_actuator_backend(name, len);
+    pthread_mutex_unlock(&actuator_backends_lock);
+    if (backend == NULL || actuator->num_backends == POET_CONFIG_MAX_ACTUATOR_BACKENDS) {
+      fprintf(stderr, "actuator_init: Unknown actuator backend: %.*s\n", (int) len, name);
+      actuator_destroy(actuator);
+      errno = EINVAL;
+      return NULL;
+    }
+    actuator->contexts[actuator->num_backends] = backend->init(table, sysfs_root);
+    if (actuator->contexts[actuator->num_backends] == NULL) {
+      err = errno;
+      fprintf(stderr, "actuator_init: Failed to create %s backend: %s\n", backend->name,
+              strerror(err));
+      actuator_destroy(actuator);
+      errno = err;
+      return NULL;
+    }
+    actuator->backends[actuator->num_backends++] = backend;
+  }
+  return actuator;
+}
+
+void apply_actuator(void* states,
+                    unsigned int num_states,
+                    unsigned int id,
+                    unsigned int last_id,
+                    unsigned long long idle_ns,
+                    unsigned int is_first_apply) {
+  unsigned int i;
+  int err;
+  poet_actuator* actuator = (poet_actuator*) states;
+  if (actuator == NULL) {
+    fprintf(stderr, "apply_actuator: actuator cannot be null.\n");
+    return;
+  }
+  if (id >= num_states || last_id >= num_states || num_states != actuator->table->num_states) {
+    fprintf(stderr, "apply_actuator: id '%u' or last_id '%u' are not "
             "acceptable values, they must be less than the number of states, "
-            "'%u'.\n", id, last_id, num_states);
+            "'%u'.\n", id, last_id, actuator->table->num_states);
     return;
   }
+  for (i = 0; i < actuator->num_backends; i++) {
+    err = actuator->backends[i]->apply(actuator->contexts[i], id, last_id, idle_ns,
+                                       is_first_apply);
+    if (err) {
+      actuator->last_errno = err;
+      actuator->num_errors++;
+    }
+  }
+}
 
-  if (cpu_states == NULL) {
-    fprintf(stderr, "apply_cpu_config_taskset: cpu_states cannot be null.\n");
-    return;
+unsigned long actuator_get_errors(const poet_actuator* actuator,
+                                  int* last_errno) {
+  if (actuator == NULL) {
+    return 0;
   }
+  if (last_errno != NULL) {
+    *last_errno = actuator->last_errno;
+  }
+  return actuator->num_errors;
+}
 
-  printf("apply_cpu_config_taskset: Applying state: %u\n", id);
+/*
+ * RAPL energy counters
+ */
 
-  // only run taskset if the core assignment has changed
-  if (is_first_apply || strcmp(cpu_states[id].core_mask, cpu_states[last_id].core_mask)) {
-    // apply taskset to this PID and all subordinate PIDs
-    snprintf(command, sizeof(command),
-            "ps -eLf | awk '(/%d/) && (!/awk/) {print $4}' | xargs -n1 taskset -p %s > /dev/null",
-            getpid(), cpu_states[id].core_mask);
-    printf("apply_cpu_config_taskset: Applying core allocation: %s\n", command);
-    retvalsyscall = system(command);
-    if (retvalsyscall != 0) {
-      fprintf(stderr, "apply_cpu_config_taskset: ERROR running taskset: %d\n",
-              retvalsyscall);
-    }
-  }
-
-  unsigned int i = 0;
-  char* freqs = strdup(cpu_states[id].freqs);
-  char* freq = strtok(freqs, ",");
-  while (freq != NULL) {
-    if (freq[0] != '-') {
-      snprintf(command, sizeof(command),
-              "echo %lu > /sys/devices/system/cpu/cpu%u/cpufreq/"
-              POET_CONFIG_DVFS_FILE,
-              strtoul(freq, NULL, 0), i);
-      printf("apply_cpu_config_taskset: Applying CPU frequency: %s\n", command);
-      retvalsyscall = system(command);
-      if (retvalsyscall != 0) {
-        fprintf(stderr, "apply_cpu_config_taskset: ERROR setting frequencies: %d\n",
-                retvalsyscall);
+struct poet_rapl_energy {
+  unsigned int num_zones;
+  // energy_uj file of each package
+  int* fds;
+  // the counters wrap after max_energy_range_uj, 0 if it is unknown
+  unsigned long long* max_energy;
+  unsigned long long* last_energy;
+  unsigned long long total_energy;
+};
+
+static int read_ull(int fd, unsigned long long* value) {
+  char buf[32];
+  ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+  if (len <= 0) {
+    return -1;
+  }
+  buf[len] = '\0';
+  *value = strtoull(buf, NULL, 10);
+  return 0;
+}
+
+void rapl_energy_destroy(poet_rapl_energy* rapl) {
+  unsigned int z;
+  if (rapl != NULL) {
+    for (z = 0; z < rapl->num_zones; z++) {
+      close(rapl->fds[z]);
+    }
+    free(rapl->fds);
+    free(rapl->max_energy);
+    free(rapl->last_energy);
+    free(rapl);
+  }
+}
+
+poet_rapl_energy* rapl_energy_init(const char* sysfs_root) {
+  char dir_path[2048];
+  char path[4096];
+  unsigned int zone;
+  unsigned int capacity;
+  int fd;
+  int err;
+  void* tmp;
+  DIR* dir;
+  struct dirent* entry;
+  poet_rapl_energy* rapl = calloc(1, sizeof(poet_rapl_energy));
+  if (rapl == NULL) {
+    return NULL;
+  }
+  if (sysfs_root == NULL) {
+    snprintf(dir_path, sizeof(dir_path), POET_CONFIG_POWERCAP_SYSFS);
+  } else {
+    snprintf(dir_path, sizeof(dir_path), "%s/class/powercap", sysfs_root);
+  }
+  dir = opendir(dir_path);
+  if (dir == NULL) {
+    err = errno;
+    free(rapl);
+    errno = err;
+    return NULL;
+  }
+  // packages are intel-rapl:N, their subzones intel-rapl:N:M are included
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "intel-rapl:", 11) || strchr(&entry->d_name[11], ':') != NULL) {
+      continue;
+    }
+    zone = rapl->num_zones;
+    capacity = zone + 1;
+    err = ENOMEM;
+    if ((tmp = realloc(rapl->fds, capacity * sizeof(int))) == NULL) {
+      goto fail;
+    }
+    rapl->fds = tmp;
+    if ((tmp = realloc(rapl->max_energy, capacity * sizeof(unsigned long long))) == NULL) {
+      goto fail;
+    }
+    rapl->max_energy = tmp;
+    if ((tmp = realloc(rapl->last_energy, capacity * sizeof(unsigned long long))) == NULL) {
+      goto fail;
+    }
+    rapl->last_energy = tmp;
+    snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", dir_path, entry->d_name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read_ull(fd, &rapl->max_energy[zone])) {
+      rapl->max_energy[zone] = 0;
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    snprintf(path, sizeof(path), "%s/%s/energy_uj", dir_path, entry->d_name);
+    rapl->fds[zone] = open(path, O_RDONLY | O_CLOEXEC);
+    if (rapl->fds[zone] < 0 || read_ull(rapl->fds[zone], &rapl->last_energy[zone])) {
+      err = rapl->fds[zone] < 0 ? errno : EIO;
+      fprintf(stderr, "rapl_energy_init: Failed to read %s: %s\n", path, strerror(err));
+      if (rapl->fds[zone] >= 0) {
+        close(rapl->fds[zone]);
       }
+      goto fail;
     }
-    freq = strtok(NULL, ",");
-    i++;
+    rapl->num_zones++;
   }
-  free(freqs);
+  closedir(dir);
+  if (rapl->num_zones == 0) {
+    rapl_energy_destroy(rapl);
+    errno = ENOENT;
+    return NULL;
+  }
+  return rapl;
+
+fail:
+  closedir(dir);
+  rapl_energy_destroy(rapl);
+  errno = err;
+  return NULL;
 }
 
-void apply_cpu_config(void* states,
-                      unsigned int num_states,
-                      unsigned int id,
-                      unsigned int last_id,
-                      unsigned long long idle_ns,
-                      unsigned int is_first_apply) {
-  apply_cpu_config_taskset((poet_cpu_state_t*) states, num_states, id,
-                           last_id, is_first_apply);
-  // idle this process if desired
-  if (idle_ns > 0) {
-    apply_cpu_idle_state(idle_ns);
+unsigned long long rapl_energy_read(void* rapl) {
+  unsigned long long energy;
+  unsigned int z;
+  poet_rapl_energy* r = (poet_rapl_energy*) rapl;
+  if (r == NULL) {
+    return 0;
+  }
+  for (z = 0; z < r->num_zones; z++) {
+    if (read_ull(r->fds[z], &energy)) {
+      continue;
+    }
+    if (energy >= r->last_energy[z]) {
+      r->total_energy += energy - r->last_energy[z];
+    } else if (r->max_energy[z] >= r->last_energy[z]) {
+      // wrapped around
+      r->total_energy += r->max_energy[z] - r->last_energy[z] + energy + 1;
+    }
+    // without a known range, the energy used while wrapping is dropped
+    r->last_energy[z] = energy;
   }
+  return r->total_energy;
 }
 
 static inline unsigned int get_num_states(FILE* rfile) {
@@ -425,8 +2603,8 @@ int get_control_states(const char* path,
     }
     id = strtoul(argA, NULL, 0);
     states[id].id = id;
-    states[id].speedup = atof(argB);
-    states[id].cost = atof(argC);
+    states[id].speedup = CONST(atof(argB));
+    states[id].cost = CONST(atof(argC));
     states[id].idle_partner_id = strtoull(argD, NULL, 0);
   }
 
@@ -511,3 +2689,125 @@ int get_cpu_states(const char* path,
   *cstates = states;
   return 0;
 }
+
+/* Example file, in the format of get_cpu_states or with CPU lists and
+   frequencies per group of CPUs, and optional RAPL power limits (uW):
+  #id   cores       freqs                       power_limits
+  0     0           0-3:250000                  15000000
+  1     0-1         0-3:400000                  25000000
+  2     0-3,128-255 0-3:450000;128-255:1200000
+ */
+int get_cpu_table(const char* path,
+                  poet_cpu_table** table,
+                  unsigned int* num_states) {
+  cpu_state_strings* states = NULL;
+  cpu_state_strings* tmp;
+  // the cores, frequencies, and power limits of each line
+  char** fields = NULL;
+  char** tmp_fields;
+  FILE* rfile;
+  char* line = NULL;
+  size_t line_len = 0;
+  char* id_str;
+  char* cores;
+  char* freqs;
+  const char* power_limits;
+  char* save;
+  unsigned int linenum = 0;
+  unsigned int nstates = 0;
+  unsigned int capacity = 0;
+  unsigned int i;
+  int ret = -1;
+
+  if (table == NULL || num_states == NULL) {
+    fprintf(stderr, "get_cpu_table: table and num_states cannot be NULL.\n");
+    return -1;
+  }
+
+  if (path == NULL) {
+    path = POET_CPU_STATE_CONFIG_FILE;
+  }
+
+  rfile = fopen(path, "r");
+  if (rfile == NULL) {
+    fprintf(stderr, "get_cpu_table: Could not open file %s\n", path);
+    return -1;
+  }
+
+  // lines may be as long as the number of CPUs requires
+  while (getline(&line, &line_len, rfile) > 0) {
+    linenum++;
+    if (line[0] == '#') {
+      continue;
+    }
+    id_str = strtok_r(line, " \t\n", &save);
+    cores = strtok_r(NULL, " \t\n", &save);
+    freqs = strtok_r(NULL, " \t\n", &save);
+    // optional
+    power_limits = strtok_r(NULL, " \t\n", &save);
+    if (id_str == NULL) {
+      continue;
+    }
+    if (freqs == NULL) {
+      fprintf(stderr, "get_cpu_table: Syntax error, line %u\n", linenum);
+      goto out;
+    }
+    if (strtoul(id_str, NULL, 0) != nstates) {
+      fprintf(stderr, "get_cpu_table: States are missing or out of order.\n");
+      goto out;
+    }
+    if (nstates == capacity) {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      tmp = realloc(states, capacity * sizeof(cpu_state_strings));
+      if (tmp != NULL) {
+        states = tmp;
+      }
+      tmp_fields = realloc(fields, capacity * sizeof(char*));
+      if (tmp_fields != NULL) {
+        fields = tmp_fields;
+      }
+      if (tmp == NULL || tmp_fields == NULL) {
+        fprintf(stderr, "get_cpu_table: realloc failed.\n");
+        goto out;
+      }
+    }
+    if (power_limits == NULL) {
+      power_limits = "-";
+    }
+    // keep the fields in one copy, separated by their terminating chars
+    fields[nstates] = malloc(strlen(cores) + strlen(freqs) + strlen(power_limits) + 3);
+    if (fields[nstates] == NULL) {
+      fprintf(stderr, "get_cpu_table: malloc failed.\n");
+      goto out;
+    }
+    strcpy(fields[nstates], cores);
+    strcpy(fields[nstates] + strlen(cores) + 1, freqs);
+    strcpy(fields[nstates] + strlen(cores) + strlen(freqs) + 2, power_limits);
+    states[nstates].cores = fields[nstates];
+    states[nstates].freqs = fields[nstates] + strlen(cores) + 1;
+    states[nstates].power_limits = fields[nstates] + strlen(cores) + strlen(freqs) + 2;
+    nstates++;
+  }
+  if (nstates == 0) {
+    fprintf(stderr, "get_cpu_table: No states found.\n");
+    goto out;
+  }
+
+  *table = cpu_table_compile(states, nstates);
+  if (*table == NULL) {
+    fprintf(stderr, "get_cpu_table: Failed to compile states: %s\n", strerror(errno));
+    goto out;
+  }
+  *num_states = nstates;
+  ret = 0;
+
+out:
+  for (i = 0; i < nstates; i++) {
+    free(fields[i]);
+  }
+  free(fields);
+  free(states);
+  free(line);
+  fclose(rfile);
+  return ret;
+}
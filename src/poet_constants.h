@@ -20,31 +20,60 @@ static const real_t P_MINUS_START      =   CONST(0.0);
 static const real_t H_START            =   CONST(0.0);
 static const real_t R                  =   CONST(0.01);
 static const real_t K_START            =   CONST(0.0);
+// adaptive noise: weight of each innovation in its running mean and deviation
+static const real_t NOISE_GAIN         =   CONST(0.0625);
+// converts mean absolute deviation to variance for normal noise (pi/2)
+static const real_t NOISE_MAD_TO_VAR   =   CONST(1.5708);
+// innovations beyond 5 standard deviations are treated as workload changes
+static const real_t NOISE_JUMP_GATE    =   CONST(25.0);
+// innovation means beyond 4 of their standard deviations raise Q:
+// 16 * NOISE_GAIN / (2 - NOISE_GAIN)
+static const real_t NOISE_BIAS_GATE    =   CONST(0.5161);
 
 // calculate_xup constants
-#define FAST 1
-#define SLOW 0
-
-#if FAST
-static const real_t P1                 =   CONST(0.0);
-static const real_t P2                 =   CONST(0.0);
-static const real_t Z1                 =   CONST(0.0);
-#elif SLOW
-static const real_t P1                 =   CONST(0.1);
-static const real_t P2                 =   CONST(0.8);
-static const real_t Z1                 =   CONST(0.7);
-#else
-static const real_t P1                 =  -CONST(0.5);
-static const real_t P2                 =   CONST(0.0);
-static const real_t Z1                 =   CONST(0.0);
-#endif
-
-static const real_t MU                 =   CONST(1.0);
+// default controller pole/zero placement, see poet_get_controller_preset()
+static const real_t P1_FAST            =   CONST(0.0);
+static const real_t P2_FAST            =   CONST(0.0);
+static const real_t Z1_FAST            =   CONST(0.0);
+static const real_t MU_FAST            =   CONST(1.0);
+static const real_t P1_SLOW            =   CONST(0.1);
+static const real_t P2_SLOW            =   CONST(0.8);
+static const real_t Z1_SLOW            =   CONST(0.7);
+static const real_t MU_SLOW            =   CONST(1.0);
 static const real_t E_START            =   CONST(0.0);
 static const real_t EO_START           =   CONST(0.0);
 static const real_t U_MIN_SPEEDUP      =   CONST(0.1);
 static const real_t U_MIN_COST         =   CONST(0.1);
 
+// translate_hull_with_time constants
+// hull vertices checked on each side of the edge that brackets the target
+static const unsigned int HULL_NEIGHBORS =  1;
+// byte alignment of the state table arrays (a cache line)
+#define TABLE_ALIGNMENT 64
+
+// poet_apply_control_batch constants
+// number of instances whose filter state is copied into arrays at a time
+#define BATCH_CHUNK 64
+
+// logger constants
+// separates the log ring's producer and consumer counters
+#define LOG_CACHE_LINE 64
+// longest time the log writer sleeps before checking for records
+#define LOG_WRITER_TIMEOUT_NS 100000000
+// longest time the controller waits for space in a full log ring before
+// dropping the record
+#define LOG_PRODUCER_TIMEOUT_NS 10000000
+// stdio buffer size for binary logs
+#define LOG_BINARY_BUFFER_SIZE 65536
+
+// cooperative idle constants
+// each worker thread's idle time is on its own cache line
+#define IDLE_SLOT_SIZE 64
+
+// multi-producer constants
+// each producer's counters are on their own cache line
+#define PRODUCER_SLOT_SIZE 64
+
 // general constants
 static const int CURRENT_ACTION_START  =  1;
 
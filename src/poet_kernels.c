@@ -0,0 +1,400 @@
+/**
+ * Pair evaluation kernels for the exhaustive translation search.
+ *
+ * The floating point build has SSE2 and AVX2 kernels on x86 and a NEON kernel
+ * on AArch64 (32-bit NEON has no double precision).
+ * There is no packed 64-bit integer division to vectorize the fixed point
+ * build with, so its Q16 kernel instead saves one of the three divisions per
+ * lower state by memoizing the upper state term.
+ *
+ * Blocks with no candidate lower states are skipped, as the scalar kernel
+ * skips single states, which matters because the divisions dominate.
+ * Vector kernels perform exactly the same IEEE operations in the same order
+ * as the scalar kernel, so they must be compiled without floating point
+ * contraction (-ffp-contract=off) to produce bit-identical results.
+ */
+#include <stdlib.h>
+
+#if !defined(FIXED_POINT) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define POET_KERNEL_X86 1
+  #include <immintrin.h>
+#endif
+
+#if !defined(FIXED_POINT) && defined(__aarch64__) && defined(__ARM_NEON)
+  #define POET_KERNEL_NEON 1
+  #include <arm_neon.h>
+#endif
+
+// poet_math.h defines a div macro, so include it after the system headers
+#include "poet_kernels.h"
+#include "poet_constants.h"
+
+static inline int kernel_is_better(real_t cost, real_t best_cost, int maximize) {
+  return maximize ? cost > best_cost : cost < best_cost;
+}
+
+static inline real_t kernel_eval(real_t lower_xup,
+                                 real_t lower_xup_cost,
+                                 real_t upper_xup,
+                                 real_t upper_xup_cost,
+                                 real_t target_xup,
+                                 real_t r_period) {
+  int low_state_iters = kernel_low_state_iters(lower_xup, upper_xup,
+                                               target_xup, r_period);
+  return kernel_pair_cost(lower_xup, lower_xup_cost, upper_xup, upper_xup_cost,
+                          r_period, int_to_real(low_state_iters));
+}
+
+// evaluate states [start, num_states) in order
+static inline void find_best_lower_range(const real_t * xup,
+                                         const real_t * xup_cost,
+                                         unsigned int start,
+                                         unsigned int num_states,
+                                         real_t upper_xup,
+                                         real_t upper_xup_cost,
+                                         real_t target_xup,
+                                         real_t r_period,
+                                         int maximize,
+                                         int * best_id,
+                                         real_t * best_cost) {
+  unsigned int j;
+  real_t cost;
+  for (j = start; j < num_states; j++) {
+    if (xup[j] > target_xup || xup[j] < R_ONE) {
+      continue;
+    }
+    cost = kernel_eval(xup[j], xup_cost[j], upper_xup, upper_xup_cost,
+                       target_xup, r_period);
+    if (kernel_is_better(cost, *best_cost, maximize)) {
+      *best_cost = cost;
+      *best_id = (int) j;
+    }
+  }
+}
+
+static void find_best_lower_scalar(const real_t * xup,
+                                   const real_t * xup_cost,
+                                   unsigned int num_states,
+                                   real_t upper_xup,
+                                   real_t upper_xup_cost,
+                                   real_t target_xup,
+                                   real_t r_period,
+                                   int maximize,
+                                   int * best_id,
+                                   real_t * best_cost) {
+  *best_id = -1;
+  find_best_lower_range(xup, xup_cost, 0, num_states, upper_xup, upper_xup_cost,
+                        target_xup, r_period, maximize, best_id, best_cost);
+}
+
+#ifdef FIXED_POINT
+
+// largest period for which the upper state terms are memoized
+#define Q16_MAX_PERIOD 128
+#define Q16_MEMO_MIN_RATIO 8
+
+/*
+ * The upper state term of the cost only depends on the integer number of
+ * iterations in the lower state, so compute it once per iteration count.
+ */
+static void find_best_lower_q16(const real_t * xup,
+                                const real_t * xup_cost,
+                                unsigned int num_states,
+                                real_t upper_xup,
+                                real_t upper_xup_cost,
+                                real_t target_xup,
+                                real_t r_period,
+                                int maximize,
+                                int * best_id,
+                                real_t * best_cost) {
+  unsigned int j;
+  int i;
+  int iters;
+  int max_iters = real_to_int(r_period);
+  real_t cost;
+  real_t upper_term[Q16_MAX_PERIOD + 1];
+  // filling the memo only pays off when there are many more lower states
+  if (max_iters < 0 || max_iters > Q16_MAX_PERIOD ||
+      num_states < Q16_MEMO_MIN_RATIO * (unsigned int) max_iters) {
+    find_best_lower_scalar(xup, xup_cost, num_states, upper_xup, upper_xup_cost,
+                           target_xup, r_period, maximize, best_id, best_cost);
+    return;
+  }
+  for (i = 0; i <= max_iters; i++) {
+    upper_term[i] = mult(div(r_period - int_to_real(i), upper_xup), upper_xup_cost);
+  }
+  *best_id = -1;
+  for (j = 0; j < num_states; j++) {
+    if (xup[j] > target_xup || xup[j] < R_ONE) {
+      continue;
+    }
+    iters = kernel_low_state_iters(xup[j], upper_xup, target_xup, r_period);
+    if (iters < 0 || iters > max_iters) {
+      cost = kernel_pair_cost(xup[j], xup_cost[j], upper_xup, upper_xup_cost,
+                              r_period, int_to_real(iters));
+    } else {
+      cost = mult(div(int_to_real(iters), xup[j]), xup_cost[j]) + upper_term[iters];
+    }
+    if (kernel_is_better(cost, *best_cost, maximize)) {
+      *best_cost = cost;
+      *best_id = (int) j;
+    }
+  }
+}
+
+#endif
+
+/*
+ * Pick the best of the per-lane results: the best cost, then the lowest id,
+ * which is the state the scalar kernel would have found first.
+ */
+static inline void reduce_lanes(const double * lane_cost,
+                                const double * lane_id,
+                                unsigned int lanes,
+                                int maximize,
+                                int * best_id,
+                                real_t * best_cost) {
+  unsigned int k;
+  for (k = 0; k < lanes; k++) {
+    if (lane_id[k] < 0) {
+      continue;
+    }
+    if (*best_id < 0 || kernel_is_better(lane_cost[k], *best_cost, maximize) ||
+        (!kernel_is_better(*best_cost, lane_cost[k], maximize) && lane_id[k] < *best_id)) {
+      *best_cost = lane_cost[k];
+      *best_id = (int) lane_id[k];
+    }
+  }
+}
+
+#ifdef POET_KERNEL_X86
+
+#ifdef __SSE2__
+static void find_best_lower_sse2(const real_t * xup,
+                                 const real_t * xup_cost,
+                                 unsigned int num_states,
+                                 real_t upper_xup,
+                                 real_t upper_xup_cost,
+                                 real_t target_xup,
+                                 real_t r_period,
+                                 int maximize,
+                                 int * best_id,
+                                 real_t * best_cost) {
+  unsigned int j;
+  double lane_cost[2];
+  double lane_id[2];
+  const __m128d u = _mm_set1_pd(upper_xup);
+  const __m128d uc = _mm_set1_pd(upper_xup_cost);
+  const __m128d t = _mm_set1_pd(target_xup);
+  const __m128d p = _mm_set1_pd(r_period);
+  const __m128d one = _mm_set1_pd(R_ONE);
+  const __m128d half = _mm_set1_pd(0.5);
+  const __m128d step = _mm_set1_pd(2.0);
+  __m128d id = _mm_set_pd(1.0, 0.0);
+  __m128d b_cost = _mm_set1_pd(*best_cost);
+  __m128d b_id = _mm_set1_pd(-1.0);
+
+  for (j = 0; j + 2 <= num_states; j += 2) {
+    __m128d l = _mm_loadu_pd(&xup[j]);
+    __m128d lc = _mm_loadu_pd(&xup_cost[j]);
+    __m128d valid = _mm_and_pd(_mm_cmple_pd(l, t), _mm_cmpge_pd(l, one));
+    if (!_mm_movemask_pd(valid)) {
+      id = _mm_add_pd(id, step);
+      continue;
+    }
+    __m128d tl = _mm_mul_pd(t, l);
+    __m128d x = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(u, l), tl),
+                           _mm_sub_pd(_mm_mul_pd(u, t), tl));
+    __m128d r = _mm_mul_pd(p, x);
+    // no time division if the rates are equal
+    r = _mm_andnot_pd(_mm_cmpeq_pd(u, l), r);
+    // real_to_int, truncated
+    r = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_add_pd(r, half)));
+    __m128d cost = _mm_add_pd(_mm_mul_pd(_mm_div_pd(r, l), lc),
+                              _mm_mul_pd(_mm_div_pd(_mm_sub_pd(p, r), u), uc));
+    __m128d better = _mm_and_pd(valid, maximize ? _mm_cmpgt_pd(cost, b_cost) :
+                                                  _mm_cmplt_pd(cost, b_cost));
+    b_cost = _mm_or_pd(_mm_and_pd(better, cost), _mm_andnot_pd(better, b_cost));
+    b_id = _mm_or_pd(_mm_and_pd(better, id), _mm_andnot_pd(better, b_id));
+    id = _mm_add_pd(id, step);
+  }
+  _mm_storeu_pd(lane_cost, b_cost);
+  _mm_storeu_pd(lane_id, b_id);
+  *best_id = -1;
+  reduce_lanes(lane_cost, lane_id, 2, maximize, best_id, best_cost);
+  find_best_lower_range(xup, xup_cost, j, num_states, upper_xup, upper_xup_cost,
+                        target_xup, r_period, maximize, best_id, best_cost);
+}
+#endif
+
+__attribute__((target("avx2")))
+static void find_best_lower_avx2(const real_t * xup,
+                                 const real_t * xup_cost,
+                                 unsigned int num_states,
+                                 real_t upper_xup,
+                                 real_t upper_xup_cost,
+                                 real_t target_xup,
+                                 real_t r_period,
+                                 int maximize,
+                                 int * best_id,
+                                 real_t * best_cost) {
+  unsigned int j;
+  double lane_cost[4];
+  double lane_id[4];
+  const __m256d u = _mm256_set1_pd(upper_xup);
+  const __m256d uc = _mm256_set1_pd(upper_xup_cost);
+  const __m256d t = _mm256_set1_pd(target_xup);
+  const __m256d p = _mm256_set1_pd(r_period);
+  const __m256d one = _mm256_set1_pd(R_ONE);
+  const __m256d half = _mm256_set1_pd(0.5);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d step = _mm256_set1_pd(4.0);
+  __m256d id = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+  __m256d b_cost = _mm256_set1_pd(*best_cost);
+  __m256d b_id = _mm256_set1_pd(-1.0);
+
+  for (j = 0; j + 4 <= num_states; j += 4) {
+    __m256d l = _mm256_loadu_pd(&xup[j]);
+    __m256d lc = _mm256_loadu_pd(&xup_cost[j]);
+    __m256d valid = _mm256_and_pd(_mm256_cmp_pd(l, t, _CMP_LE_OQ),
+                                  _mm256_cmp_pd(l, one, _CMP_GE_OQ));
+    if (!_mm256_movemask_pd(valid)) {
+      id = _mm256_add_pd(id, step);
+      continue;
+    }
+    __m256d tl = _mm256_mul_pd(t, l);
+    __m256d x = _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(u, l), tl),
+                              _mm256_sub_pd(_mm256_mul_pd(u, t), tl));
+    __m256d r = _mm256_mul_pd(p, x);
+    // no time division if the rates are equal
+    __m256d eq = _mm256_cmp_pd(u, l, _CMP_EQ_OQ);
+    r = _mm256_blendv_pd(r, zero, eq);
+    // real_to_int, truncated
+    r = _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(_mm256_add_pd(r, half)));
+    __m256d cost = _mm256_add_pd(_mm256_mul_pd(_mm256_div_pd(r, l), lc),
+                                 _mm256_mul_pd(_mm256_div_pd(_mm256_sub_pd(p, r), u), uc));
+    __m256d better = _mm256_and_pd(valid, maximize ? _mm256_cmp_pd(cost, b_cost, _CMP_GT_OQ) :
+                                                     _mm256_cmp_pd(cost, b_cost, _CMP_LT_OQ));
+    b_cost = _mm256_blendv_pd(b_cost, cost, better);
+    b_id = _mm256_blendv_pd(b_id, id, better);
+    id = _mm256_add_pd(id, step);
+  }
+  _mm256_storeu_pd(lane_cost, b_cost);
+  _mm256_storeu_pd(lane_id, b_id);
+  *best_id = -1;
+  reduce_lanes(lane_cost, lane_id, 4, maximize, best_id, best_cost);
+  find_best_lower_range(xup, xup_cost, j, num_states, upper_xup, upper_xup_cost,
+                        target_xup, r_period, maximize, best_id, best_cost);
+}
+
+#endif
+
+#ifdef POET_KERNEL_NEON
+static void find_best_lower_neon(const real_t * xup,
+                                 const real_t * xup_cost,
+                                 unsigned int num_states,
+                                 real_t upper_xup,
+                                 real_t upper_xup_cost,
+                                 real_t target_xup,
+                                 real_t r_period,
+                                 int maximize,
+                                 int * best_id,
+                                 real_t * best_cost) {
+  unsigned int j;
+  double lane_cost[2];
+  double lane_id[2];
+  const double ids[2] = { 0.0, 1.0 };
+  const float64x2_t u = vdupq_n_f64(upper_xup);
+  const float64x2_t uc = vdupq_n_f64(upper_xup_cost);
+  const float64x2_t t = vdupq_n_f64(target_xup);
+  const float64x2_t p = vdupq_n_f64(r_period);
+  const float64x2_t one = vdupq_n_f64(R_ONE);
+  const float64x2_t half = vdupq_n_f64(0.5);
+  const float64x2_t zero = vdupq_n_f64(0.0);
+  const float64x2_t step = vdupq_n_f64(2.0);
+  float64x2_t id = vld1q_f64(ids);
+  float64x2_t b_cost = vdupq_n_f64(*best_cost);
+  float64x2_t b_id = vdupq_n_f64(-1.0);
+
+  for (j = 0; j + 2 <= num_states; j += 2) {
+    float64x2_t l = vld1q_f64(&xup[j]);
+    float64x2_t lc = vld1q_f64(&xup_cost[j]);
+    uint64x2_t valid = vandq_u64(vcleq_f64(l, t), vcgeq_f64(l, one));
+    if (!(vgetq_lane_u64(valid, 0) | vgetq_lane_u64(valid, 1))) {
+      id = vaddq_f64(id, step);
+      continue;
+    }
+    float64x2_t tl = vmulq_f64(t, l);
+    float64x2_t x = vdivq_f64(vsubq_f64(vmulq_f64(u, l), tl),
+                              vsubq_f64(vmulq_f64(u, t), tl));
+    float64x2_t r = vmulq_f64(p, x);
+    // no time division if the rates are equal
+    r = vbslq_f64(vceqq_f64(u, l), zero, r);
+    // real_to_int, truncated
+    r = vcvtq_f64_s64(vcvtq_s64_f64(vaddq_f64(r, half)));
+    float64x2_t cost = vaddq_f64(vmulq_f64(vdivq_f64(r, l), lc),
+                                 vmulq_f64(vdivq_f64(vsubq_f64(p, r), u), uc));
+    uint64x2_t better = vandq_u64(valid, maximize ? vcgtq_f64(cost, b_cost) :
+                                                    vcltq_f64(cost, b_cost));
+    b_cost = vbslq_f64(better, cost, b_cost);
+    b_id = vbslq_f64(better, id, b_id);
+    id = vaddq_f64(id, step);
+  }
+  vst1q_f64(lane_cost, b_cost);
+  vst1q_f64(lane_id, b_id);
+  *best_id = -1;
+  reduce_lanes(lane_cost, lane_id, 2, maximize, best_id, best_cost);
+  find_best_lower_range(xup, xup_cost, j, num_states, upper_xup, upper_xup_cost,
+                        target_xup, r_period, maximize, best_id, best_cost);
+}
+#endif
+
+static const poet_kernel KERNEL_SCALAR = { "scalar", &find_best_lower_scalar };
+#ifdef FIXED_POINT
+static const poet_kernel KERNEL_Q16 = { "q16", &find_best_lower_q16 };
+#endif
+#ifdef POET_KERNEL_X86
+#ifdef __SSE2__
+static const poet_kernel KERNEL_SSE2 = { "sse2", &find_best_lower_sse2 };
+#endif
+static const poet_kernel KERNEL_AVX2 = { "avx2", &find_best_lower_avx2 };
+#endif
+#ifdef POET_KERNEL_NEON
+static const poet_kernel KERNEL_NEON = { "neon", &find_best_lower_neon };
+#endif
+
+unsigned int poet_kernel_get_all(const poet_kernel ** kernels,
+                                 unsigned int max_kernels) {
+  unsigned int n = 0;
+  const poet_kernel * all[4];
+  unsigned int i;
+
+  all[n++] = &KERNEL_SCALAR;
+#ifdef FIXED_POINT
+  all[n++] = &KERNEL_Q16;
+#endif
+#ifdef POET_KERNEL_X86
+#ifdef __SSE2__
+  all[n++] = &KERNEL_SSE2;
+#endif
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    all[n++] = &KERNEL_AVX2;
+  }
+#endif
+#ifdef POET_KERNEL_NEON
+  all[n++] = &KERNEL_NEON;
+#endif
+
+  for (i = 0; i < n && i < max_kernels; i++) {
+    kernels[i] = all[i];
+  }
+  return i;
+}
+
+const poet_kernel * poet_kernel_select(void) {
+  const poet_kernel * kernels[4];
+  unsigned int n = poet_kernel_get_all(kernels, 4);
+  // kernels are ordered from slowest to fastest
+  return kernels[n - 1];
+}
@@ -0,0 +1,98 @@
+#ifndef _POET_KERNELS_H
+#define _POET_KERNELS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "poet.h"
+#include "poet_math.h"
+
+/*
+ * Kernels that evaluate the non-idle branch of calculate_time_division for
+ * every lower state against a fixed upper state.
+ * All implementations must choose exactly the same state as the scalar one.
+ */
+
+/*
+ * Number of iterations to spend in the lower state so that the combined rate
+ * of the lower and upper states equals the target rate.
+ */
+static inline int kernel_low_state_iters(real_t lower_xup,
+                                         real_t upper_xup,
+                                         real_t target_xup,
+                                         real_t r_period) {
+  real_t r_low_state_iters;
+  // If lower rate and upper rate are equal, no need for time division
+  if (upper_xup <= lower_xup && upper_xup >= lower_xup) {
+    r_low_state_iters = CONST(0.0);
+  } else {
+    // x represents the percentage of iterations spent in the first (lower)
+    // configuration
+    // Conversely, (1 - x) is the percentage of iterations in the second
+    // (upper) configuration
+    // This equation ensures the time period of the combined rates is equal
+    // to the time period of the target rate
+    // 1 / Target rate = X / (lower rate) + (1 - X) / (upper rate)
+    // Solve for X
+    real_t x = div(mult(upper_xup, lower_xup) - mult(target_xup, lower_xup),
+                   mult(upper_xup, target_xup) - mult(target_xup, lower_xup));
+
+    // Num of iterations (in lower state) = x * (controller period)
+    r_low_state_iters = mult(r_period, x);
+  }
+  return real_to_int(r_low_state_iters);
+}
+
+/*
+ * Cost of a period with r_low_state_iters in the lower state and the rest in
+ * the upper state.
+ */
+static inline real_t kernel_pair_cost(real_t lower_xup,
+                                      real_t lower_xup_cost,
+                                      real_t upper_xup,
+                                      real_t upper_xup_cost,
+                                      real_t r_period,
+                                      real_t r_low_state_iters) {
+  return mult(div(r_low_state_iters, lower_xup), lower_xup_cost) +
+         mult(div(r_period - r_low_state_iters, upper_xup), upper_xup_cost);
+}
+
+/*
+ * Find the first lower state with the best cost against the upper state.
+ * Only states with 1 <= xup <= target_xup are considered.
+ * best_id is -1 if no state beats the initial best_cost.
+ */
+typedef void (* poet_find_best_lower_func) (const real_t * xup,
+                                            const real_t * xup_cost,
+                                            unsigned int num_states,
+                                            real_t upper_xup,
+                                            real_t upper_xup_cost,
+                                            real_t target_xup,
+                                            real_t r_period,
+                                            int maximize,
+                                            int * best_id,
+                                            real_t * best_cost);
+
+typedef struct {
+  const char * name;
+  poet_find_best_lower_func find_best_lower;
+} poet_kernel;
+
+/*
+ * Get the fastest kernel supported by this CPU.
+ */
+const poet_kernel * poet_kernel_select(void);
+
+/*
+ * Get all kernels compiled in and supported by this CPU, scalar first.
+ * Returns the number of kernels.
+ */
+unsigned int poet_kernel_get_all(const poet_kernel ** kernels,
+                                 unsigned int max_kernels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,367 @@
+/**
+ * Log formats and writer thread.
+ *
+ * Logs are either text, with one column per field, or binary: a
+ * poet_log_header and the control states, followed by raw poet_records.
+ *
+ * The controller copies records into a single-producer single-consumer ring
+ * and the writer thread formats them, so file I/O stays off the control path.
+ * The producer only wakes the writer every half ring, and the writer also
+ * wakes periodically so the log keeps up with slow applications.
+ * If the writer falls a full ring behind, e.g. on a slow disk, the producer
+ * waits at most LOG_PRODUCER_TIMEOUT_NS for space and then drops the record.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "poet_log.h"
+#include "poet_constants.h"
+#include "poet_math.h"
+
+struct poet_log_writer {
+  // only written by the producer
+  unsigned long long head;
+  // the producer's last view of tail, so it rarely touches the writer's line
+  unsigned long long cached_tail;
+  // times the ring was full, and records dropped after waiting too long
+  unsigned long long stalls;
+  unsigned long long dropped;
+  char pad0[LOG_CACHE_LINE - 4 * sizeof(unsigned long long)];
+  // only written by the writer thread
+  unsigned long long tail;
+  char pad1[LOG_CACHE_LINE - sizeof(unsigned long long)];
+
+  int stop;
+  int binary;
+  FILE * file;
+  poet_record * ring;
+  unsigned int capacity;
+  unsigned int wake_interval;
+  sem_t wake;
+  pthread_t thread;
+};
+
+#define LOG_COLUMN_NAMES \
+  "TAG", "CONSTRAINT", \
+  "ACTUAL_RATE", "P_X_HAT_MINUS", "P_X_HAT", "P_P_MINUS", "P_H", "P_K", "P_P", "P_SPEEDUP", "P_ERROR", \
+  "ACTUAL_POWER", "C_X_HAT_MINUS", "C_X_HAT", "C_P_MINUS", "C_H", "C_K", "C_P", "C_POWERUP", "C_ERROR", \
+  "TIME_WORKLOAD", "ENERGY_WORKLOAD", "LOWER_ID", "UPPER_ID", "LOW_STATE_ITERS", "IDLE_NS"
+
+#define LOG_RECORD_VALUES(record, constraint) \
+  (record)->tag, \
+  constraint, \
+  /* performance data */ \
+  real_to_db((record)->act_rate), \
+  real_to_db((record)->pfs.x_hat_minus), \
+  real_to_db((record)->pfs.x_hat), \
+  real_to_db((record)->pfs.p_minus), \
+  real_to_db((record)->pfs.h), \
+  real_to_db((record)->pfs.k), \
+  real_to_db((record)->pfs.p), \
+  real_to_db((record)->scs.u), \
+  real_to_db((record)->scs.e), \
+  /* power data */ \
+  real_to_db((record)->act_power), \
+  real_to_db((record)->cfs.x_hat_minus), \
+  real_to_db((record)->cfs.x_hat), \
+  real_to_db((record)->cfs.p_minus), \
+  real_to_db((record)->cfs.h), \
+  real_to_db((record)->cfs.k), \
+  real_to_db((record)->cfs.p), \
+  real_to_db((record)->pcs.u), \
+  real_to_db((record)->pcs.e), \
+  /* other data */ \
+  real_to_db((record)->time_workload), \
+  real_to_db((record)->energy_workload), \
+  (record)->lower_id, \
+  (record)->upper_id, \
+  (record)->low_state_iters, \
+  (record)->idle_ns
+
+void poet_log_write_text_header(FILE * file, int csv) {
+  if (csv) {
+    fprintf(file,
+            "%s,%s,"
+            "%s,%s,%s,%s,%s,%s,%s,%s,%s,"
+            "%s,%s,%s,%s,%s,%s,%s,%s,%s,"
+            "%s,%s,%s,%s,%s,%s\n",
+            LOG_COLUMN_NAMES);
+  } else {
+    fprintf(file,
+            "%16s %16s "
+            "%16s %16s %16s %16s %16s %16s %16s %16s %16s "
+            "%16s %16s %16s %16s %16s %16s %16s %16s %16s "
+            "%16s %16s %16s %16s %16s %16s\n",
+            LOG_COLUMN_NAMES);
+  }
+}
+
+void poet_log_write_text_record(FILE * file, const poet_record * record, int csv) {
+  const char* constraint;
+  switch (record->constraint) {
+    case POWER:
+      constraint = "POWER";
+      break;
+    case PERFORMANCE:
+    default:
+      constraint = "PERFORMANCE";
+  }
+  if (csv) {
+    fprintf(file, "%lu,%s,"
+            "%f,%f,%f,%f,%f,%f,%f,%f,%f,"
+            "%f,%f,%f,%f,%f,%f,%f,%f,%f,"
+            "%f,%f,%d,%d,%d,%llu\n",
+            LOG_RECORD_VALUES(record, constraint));
+  } else {
+    fprintf(file, "%16lu %16s "
+            "%16f %16f %16f %16f %16f %16f %16f %16f %16f "
+            "%16f %16f %16f %16f %16f %16f %16f %16f %16f "
+            "%16f %16f %16d %16d %16d %16llu\n",
+            LOG_RECORD_VALUES(record, constraint));
+  }
+}
+
+int poet_log_write_binary_header(FILE * file,
+                                 unsigned int period,
+                                 unsigned int num_states,
+                                 const poet_control_state_t * states) {
+  poet_log_header header;
+  poet_control_state_t state;
+  unsigned int i;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, POET_LOG_MAGIC, sizeof(header.magic));
+  header.version = POET_LOG_VERSION;
+  header.byte_order = POET_LOG_BYTE_ORDER;
+#ifdef FIXED_POINT
+  header.flags = POET_LOG_FLAG_FIXED_POINT;
+#endif
+  header.real_size = sizeof(real_t);
+  header.record_size = sizeof(poet_record);
+  header.state_size = sizeof(poet_control_state_t);
+  header.period = period;
+  header.num_states = num_states;
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    return -1;
+  }
+  for (i = 0; i < num_states; i++) {
+    // copy each state so its padding is written as zeros
+    memset(&state, 0, sizeof(state));
+    state.id = states[i].id;
+    state.speedup = states[i].speedup;
+    state.cost = states[i].cost;
+    state.idle_partner_id = states[i].idle_partner_id;
+    if (fwrite(&state, sizeof(state), 1, file) != 1) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int poet_log_read_binary_header(FILE * file,
+                                poet_log_header * header,
+                                poet_control_state_t ** states) {
+  if (fread(header, sizeof(poet_log_header), 1, file) != 1 ||
+      memcmp(header->magic, POET_LOG_MAGIC, sizeof(header->magic))) {
+    fprintf(stderr, "Not a binary log\n");
+    return -1;
+  }
+  if (header->version != POET_LOG_VERSION) {
+    fprintf(stderr, "Unsupported log version: %u\n", header->version);
+    return -1;
+  }
+  // records are raw structs, so they must match this build
+  if (header->byte_order != POET_LOG_BYTE_ORDER ||
+#ifdef FIXED_POINT
+      !(header->flags & POET_LOG_FLAG_FIXED_POINT) ||
+#else
+      (header->flags & POET_LOG_FLAG_FIXED_POINT) ||
+#endif
+      header->real_size != sizeof(real_t) ||
+      header->record_size != sizeof(poet_record) ||
+      header->state_size != sizeof(poet_control_state_t)) {
+    fprintf(stderr, "Log was written by an incompatible build (%s, %u-byte records)\n",
+            (header->flags & POET_LOG_FLAG_FIXED_POINT) ? "fixed point" : "floating point",
+            header->record_size);
+    return -1;
+  }
+  *states = malloc(header->num_states * sizeof(poet_control_state_t));
+  if (*states == NULL) {
+    perror("malloc");
+    return -1;
+  }
+  if (fread(*states, sizeof(poet_control_state_t), header->num_states, file) != header->num_states) {
+    fprintf(stderr, "Truncated log header\n");
+    free(*states);
+    *states = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+// write count records starting at index i, which must not wrap
+static void write_records(poet_log_writer * writer,
+                          unsigned int i,
+                          unsigned int count) {
+  unsigned int j;
+  if (writer->binary) {
+    fwrite(&writer->ring[i], sizeof(poet_record), count, writer->file);
+  } else {
+    for (j = i; j < i + count; j++) {
+      poet_log_write_text_record(writer->file, &writer->ring[j], 0);
+    }
+  }
+}
+
+static void * log_writer_run(void * arg) {
+  poet_log_writer * writer = (poet_log_writer *) arg;
+  unsigned long long tail = writer->tail;
+  unsigned long long head;
+  struct timespec ts;
+  unsigned int i;
+  unsigned int count;
+  int stop;
+
+  for (;;) {
+    // records committed before stop was set are visible once we see it
+    stop = __atomic_load_n(&writer->stop, __ATOMIC_ACQUIRE);
+    head = __atomic_load_n(&writer->head, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      // write contiguous runs of the ring at once
+      while (tail != head) {
+        i = tail % writer->capacity;
+        count = writer->capacity - i;
+        if (count > head - tail) {
+          count = (unsigned int) (head - tail);
+        }
+        write_records(writer, i, count);
+        tail += count;
+        __atomic_store_n(&writer->tail, tail, __ATOMIC_RELEASE);
+      }
+      fflush(writer->file);
+    } else if (stop) {
+      break;
+    } else {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += LOG_WRITER_TIMEOUT_NS;
+      if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+      // timeouts and interrupts just mean we check the ring again
+      sem_timedwait(&writer->wake, &ts);
+    }
+  }
+  return NULL;
+}
+
+poet_log_writer * poet_log_writer_create(FILE * file,
+                                         unsigned int capacity,
+                                         int binary) {
+  int err;
+  void * mem;
+  poet_log_writer * writer;
+
+  if (file == NULL || capacity == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  // the padding only separates head and tail if the writer is line aligned
+  if (posix_memalign(&mem, LOG_CACHE_LINE, sizeof(poet_log_writer))) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  writer = (poet_log_writer *) mem;
+  memset(writer, 0, sizeof(poet_log_writer));
+  writer->ring = malloc(capacity * sizeof(poet_record));
+  if (writer->ring == NULL) {
+    free(writer);
+    return NULL;
+  }
+  writer->file = file;
+  writer->binary = binary;
+  writer->capacity = capacity;
+  writer->wake_interval = capacity / 2 > 0 ? capacity / 2 : 1;
+  if (sem_init(&writer->wake, 0, 0)) {
+    free(writer->ring);
+    free(writer);
+    return NULL;
+  }
+  err = pthread_create(&writer->thread, NULL, log_writer_run, writer);
+  if (err) {
+    sem_destroy(&writer->wake);
+    free(writer->ring);
+    free(writer);
+    errno = err;
+    return NULL;
+  }
+  return writer;
+}
+
+static inline unsigned long long get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+poet_record * poet_log_writer_next(poet_log_writer * writer) {
+  poet_record * record;
+  unsigned long long deadline_ns;
+  if (writer->head - writer->cached_tail >= writer->capacity) {
+    writer->cached_tail = __atomic_load_n(&writer->tail, __ATOMIC_ACQUIRE);
+    if (writer->head - writer->cached_tail >= writer->capacity) {
+      // the writer has fallen a full ring behind
+      __atomic_store_n(&writer->stalls, writer->stalls + 1, __ATOMIC_RELAXED);
+      deadline_ns = get_time_ns() + LOG_PRODUCER_TIMEOUT_NS;
+      do {
+        sem_post(&writer->wake);
+        sched_yield();
+        writer->cached_tail = __atomic_load_n(&writer->tail, __ATOMIC_ACQUIRE);
+        if (writer->head - writer->cached_tail >= writer->capacity &&
+            get_time_ns() >= deadline_ns) {
+          __atomic_store_n(&writer->dropped, writer->dropped + 1, __ATOMIC_RELAXED);
+          return NULL;
+        }
+      } while (writer->head - writer->cached_tail >= writer->capacity);
+    }
+  }
+  // binary logs write whole records, so don't leave old bytes in the padding
+  record = &writer->ring[writer->head % writer->capacity];
+  memset(record, 0, sizeof(poet_record));
+  return record;
+}
+
+void poet_log_writer_get_stats(const poet_log_writer * writer,
+                               unsigned long long * stalls,
+                               unsigned long long * dropped) {
+  if (stalls != NULL) {
+    *stalls = __atomic_load_n(&writer->stalls, __ATOMIC_RELAXED);
+  }
+  if (dropped != NULL) {
+    *dropped = __atomic_load_n(&writer->dropped, __ATOMIC_RELAXED);
+  }
+}
+
+void poet_log_writer_commit(poet_log_writer * writer) {
+  unsigned long long head = writer->head + 1;
+  __atomic_store_n(&writer->head, head, __ATOMIC_RELEASE);
+  if (head % writer->wake_interval == 0) {
+    sem_post(&writer->wake);
+  }
+}
+
+void poet_log_writer_destroy(poet_log_writer * writer) {
+  if (writer != NULL) {
+    __atomic_store_n(&writer->stop, 1, __ATOMIC_RELEASE);
+    sem_post(&writer->wake);
+    pthread_join(writer->thread, NULL);
+    sem_destroy(&writer->wake);
+    free(writer->ring);
+    free(writer);
+  }
+}
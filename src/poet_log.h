@@ -0,0 +1,148 @@
+#ifndef _POET_LOG_H
+#define _POET_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include "poet.h"
+
+// Represents state of kalman filter used in estimate_workload
+typedef struct {
+  real_t x_hat_minus;
+  real_t x_hat;
+  real_t p_minus;
+  real_t h;
+  real_t k;
+  real_t p;
+} filter_state;
+
+// Container for old speedup/powerup values and old errors
+typedef struct {
+  real_t u;
+  real_t uo;
+  real_t uoo;
+  real_t e;
+  real_t eo;
+  real_t umin;
+  real_t umax;
+} calc_xup_state;
+
+// Container for log records
+typedef struct {
+  unsigned long tag;
+  poet_tradeoff_type_t constraint;
+  real_t act_rate;
+  real_t act_power;
+  filter_state pfs;
+  calc_xup_state scs;
+  filter_state cfs;
+  calc_xup_state pcs;
+  real_t time_workload;
+  real_t energy_workload;
+  int lower_id;
+  int upper_id;
+  int low_state_iters;
+  unsigned long long idle_ns;
+} poet_record;
+
+// Binary logs start with this header, followed by num_states control states
+#define POET_LOG_MAGIC "BARDLOG"
+#define POET_LOG_VERSION 1
+// written in native byte order, so readers can detect a mismatch
+#define POET_LOG_BYTE_ORDER 0x01020304
+#define POET_LOG_FLAG_FIXED_POINT 0x1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  // POET_LOG_FLAG_* values
+  uint32_t flags;
+  uint32_t real_size;
+  uint32_t record_size;
+  uint32_t state_size;
+  uint32_t period;
+  uint32_t num_states;
+} poet_log_header;
+
+/*
+ * Write the column names of the text log, space-aligned or CSV.
+ */
+void poet_log_write_text_header(FILE * file, int csv);
+
+/*
+ * Write a record as a text log line, space-aligned or CSV.
+ */
+void poet_log_write_text_record(FILE * file, const poet_record * record, int csv);
+
+/*
+ * Write the header and control states that start a binary log.
+ * Returns -1 on failure.
+ */
+int poet_log_write_binary_header(FILE * file,
+                                 unsigned int period,
+                                 unsigned int num_states,
+                                 const poet_control_state_t * states);
+
+/*
+ * Read and validate the start of a binary log, which must have been written
+ * by a compatible build. The control states are allocated and must be freed.
+ * Returns -1 on failure, after printing the reason to stderr.
+ */
+int poet_log_read_binary_header(FILE * file,
+                                poet_log_header * header,
+                                poet_control_state_t ** states);
+
+/*
+ * Writes log records to a file from a background thread.
+ * Records are passed through a single-producer single-consumer ring, so only
+ * one thread may produce records.
+ */
+typedef struct poet_log_writer poet_log_writer;
+
+/*
+ * Start a writer thread for the file, which must remain open until the writer
+ * is destroyed. The ring holds capacity records, which are written as text or
+ * binary records. The header must already be written.
+ * Returns NULL and sets errno on failure.
+ */
+poet_log_writer * poet_log_writer_create(FILE * file,
+                                         unsigned int capacity,
+                                         int binary);
+
+/*
+ * Get the next free record in the ring, waiting for the writer only if the
+ * ring is full. The record is zeroed, including its padding, and must be
+ * filled then published with poet_log_writer_commit().
+ * Returns NULL if the ring stayed full for LOG_PRODUCER_TIMEOUT_NS, in which
+ * case the record is dropped and must not be committed.
+ */
+poet_record * poet_log_writer_next(poet_log_writer * writer);
+
+/*
+ * Get the number of times the producer found the ring full and the number of
+ * records it dropped. May be called from any thread.
+ */
+void poet_log_writer_get_stats(const poet_log_writer * writer,
+                               unsigned long long * stalls,
+                               unsigned long long * dropped);
+
+/*
+ * Publish the record returned by poet_log_writer_next().
+ */
+void poet_log_writer_commit(poet_log_writer * writer);
+
+/*
+ * Write all committed records, stop the writer thread, and free the writer.
+ * Does not close the file.
+ */
+void poet_log_writer_destroy(poet_log_writer * writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
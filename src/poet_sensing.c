@@ -0,0 +1,96 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include "poet_sensing.h"
+
+typedef struct {
+  unsigned long long time_ns;
+  unsigned long long energy_uj;
+} sensor_sample;
+
+struct poet_sensor {
+  poet_energy_func energy;
+  void * energy_arg;
+  // ring of window_size + 1 samples, the window is between the oldest and
+  // the newest
+  sensor_sample * samples;
+  unsigned int num_samples;
+  // index of the newest sample
+  unsigned int newest;
+  // samples written so far, up to num_samples
+  unsigned int count;
+};
+
+static inline unsigned long long get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static inline void take_sample(const poet_sensor * sensor, sensor_sample * sample) {
+  sample->time_ns = get_time_ns();
+  sample->energy_uj = sensor->energy == NULL ? 0 : sensor->energy(sensor->energy_arg);
+}
+
+poet_sensor * poet_sensor_create(unsigned int window_size,
+                                 poet_energy_func energy,
+                                 void * energy_arg) {
+  poet_sensor * sensor;
+
+  if (window_size == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  sensor = malloc(sizeof(poet_sensor));
+  if (sensor == NULL) {
+    return NULL;
+  }
+  sensor->samples = malloc((window_size + 1) * sizeof(sensor_sample));
+  if (sensor->samples == NULL) {
+    free(sensor);
+    errno = ENOMEM;
+    return NULL;
+  }
+  sensor->energy = energy;
+  sensor->energy_arg = energy_arg;
+  sensor->num_samples = window_size + 1;
+  // the first beat's interval starts now
+  sensor->newest = 0;
+  sensor->count = 1;
+  take_sample(sensor, &sensor->samples[0]);
+  return sensor;
+}
+
+void poet_sensor_beat(poet_sensor * sensor,
+                      double * perf,
+                      double * pwr) {
+  const sensor_sample * newest;
+  const sensor_sample * oldest;
+  unsigned long long elapsed_ns;
+
+  sensor->newest = sensor->newest + 1 == sensor->num_samples ? 0 : sensor->newest + 1;
+  if (sensor->count < sensor->num_samples) {
+    sensor->count++;
+  }
+  newest = &sensor->samples[sensor->newest];
+  take_sample(sensor, &sensor->samples[sensor->newest]);
+  // the oldest sample is the next one once the ring is full
+  oldest = &sensor->samples[sensor->count < sensor->num_samples ? 0 :
+                            (sensor->newest + 1 == sensor->num_samples ? 0 : sensor->newest + 1)];
+
+  elapsed_ns = newest->time_ns - oldest->time_ns;
+  if (elapsed_ns == 0) {
+    elapsed_ns = 1;
+  }
+  *perf = (double) (sensor->count - 1) * 1000000000.0 / (double) elapsed_ns;
+  // uJ / ns = 1000 W
+  *pwr = newest->energy_uj < oldest->energy_uj ? 0.0 :
+         (double) (newest->energy_uj - oldest->energy_uj) * 1000.0 / (double) elapsed_ns;
+}
+
+void poet_sensor_destroy(poet_sensor * sensor) {
+  if (sensor != NULL) {
+    free(sensor->samples);
+    free(sensor);
+  }
+}
@@ -0,0 +1,41 @@
+#ifndef _POET_SENSING_H
+#define _POET_SENSING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "poet.h"
+
+/*
+ * Measures the heart rate and power over a sliding window of heartbeats.
+ * Each beat stores its timestamp and energy reading in a ring of
+ * window_size + 1 samples, so the window's rate and power only need the
+ * newest and oldest samples.
+ */
+typedef struct poet_sensor poet_sensor;
+
+/*
+ * Create a sensor, whose first window starts now. energy may be NULL, in
+ * which case power is always 0.
+ * Returns NULL and sets errno on failure.
+ */
+poet_sensor * poet_sensor_create(unsigned int window_size,
+                                 poet_energy_func energy,
+                                 void * energy_arg);
+
+/*
+ * Record a heartbeat and get the heart rate (beats/s) and power (W) over the
+ * window that ends with it.
+ */
+void poet_sensor_beat(poet_sensor * sensor,
+                      double * perf,
+                      double * pwr);
+
+void poet_sensor_destroy(poet_sensor * sensor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef _POET_STATS_H
+#define _POET_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+#include "poet.h"
+
+/*
+ * Per-phase timing of poet_apply_control(), compiled in with POET_STATS.
+ * Durations are measured in ticks of the cheapest monotonic counter (the TSC
+ * on x86, the virtual counter on AArch64, or clock_gettime() nanoseconds) and
+ * added to a log2 histogram, so recording a phase only costs two counter
+ * reads and a few increments.
+ */
+
+static inline unsigned long long poet_stats_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  unsigned long long ticks;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (ticks));
+  return ticks;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+#endif
+}
+
+static inline unsigned long long poet_stats_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static inline void poet_stats_record(poet_stats * stats,
+                                     poet_phase phase,
+                                     unsigned long long ticks) {
+  poet_phase_stats * ps = &stats->phases[phase];
+  unsigned int bucket = 63 - (unsigned int) __builtin_clzll(ticks | 1);
+  if (bucket >= POET_STATS_BUCKETS) {
+    bucket = POET_STATS_BUCKETS - 1;
+  }
+  ps->buckets[bucket]++;
+  ps->count++;
+  ps->total_ticks += ticks;
+  if (ticks < ps->min_ticks || ps->count == 1) {
+    ps->min_ticks = ticks;
+  }
+  if (ticks > ps->max_ticks) {
+    ps->max_ticks = ticks;
+  }
+}
+
+#ifdef POET_STATS
+  // time a phase if stats are enabled at runtime
+  #define POET_PHASE_BEGIN(state, start) \
+    unsigned long long start = (state)->stats != NULL ? poet_stats_ticks() : 0
+  #define POET_PHASE_END(state, start, phase) \
+    if ((state)->stats != NULL) { \
+      poet_stats_record((state)->stats, (phase), poet_stats_ticks() - (start)); \
+    }
+#else
+  #define POET_PHASE_BEGIN(state, start)
+  #define POET_PHASE_END(state, start, phase)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
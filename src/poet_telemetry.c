@@ -0,0 +1,212 @@
+/**
+ * Live telemetry ring in a memory-mapped file.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "poet_telemetry.h"
+
+struct poet_telemetry {
+  poet_telemetry_header * header;
+  poet_telemetry_slot * slots;
+  size_t size;
+  // only the controller writes, so it keeps its own copy of head
+  uint64_t head;
+  poet_telemetry_slot * current;
+  uint64_t current_seq;
+};
+
+static inline size_t get_ring_size(unsigned int num_slots) {
+  return sizeof(poet_telemetry_header) + num_slots * sizeof(poet_telemetry_slot);
+}
+
+static inline const poet_telemetry_slot * get_slots(const poet_telemetry_header * header) {
+  return (const poet_telemetry_slot *) ((const char *) header + sizeof(poet_telemetry_header));
+}
+
+poet_telemetry * poet_telemetry_create(const char * path,
+                                       unsigned int num_slots,
+                                       unsigned int period) {
+  int fd;
+  int err;
+  void * addr;
+  poet_telemetry * telemetry;
+  size_t size = get_ring_size(num_slots);
+
+  if (path == NULL || num_slots == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  telemetry = malloc(sizeof(poet_telemetry));
+  if (telemetry == NULL) {
+    return NULL;
+  }
+  // replace rather than truncate the file, which readers may still have mapped
+  if (unlink(path) && errno != ENOENT) {
+    free(telemetry);
+    return NULL;
+  }
+  fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    free(telemetry);
+    return NULL;
+  }
+  // extending the file zeroes the ring, so all sequence counters are 0
+  if (ftruncate(fd, (off_t) size)) {
+    err = errno;
+    close(fd);
+    free(telemetry);
+    errno = err;
+    return NULL;
+  }
+  addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    free(telemetry);
+    errno = err;
+    return NULL;
+  }
+
+  telemetry->header = (poet_telemetry_header *) addr;
+  telemetry->slots = (poet_telemetry_slot *) ((char *) addr + sizeof(poet_telemetry_header));
+  telemetry->size = size;
+  telemetry->head = 0;
+  telemetry->current = NULL;
+  telemetry->current_seq = 0;
+  telemetry->header->version = POET_TELEMETRY_VERSION;
+  telemetry->header->byte_order = POET_LOG_BYTE_ORDER;
+#ifdef FIXED_POINT
+  telemetry->header->flags = POET_LOG_FLAG_FIXED_POINT;
+#endif
+  telemetry->header->real_size = sizeof(real_t);
+  telemetry->header->record_size = sizeof(poet_record);
+  telemetry->header->num_slots = num_slots;
+  telemetry->header->period = period;
+  telemetry->header->pid = (uint64_t) getpid();
+  // readers only trust the header once they see the magic
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(telemetry->header->magic, POET_TELEMETRY_MAGIC, sizeof(telemetry->header->magic));
+  return telemetry;
+}
+
+poet_record * poet_telemetry_begin(poet_telemetry * telemetry) {
+  telemetry->current = &telemetry->slots[telemetry->head % telemetry->header->num_slots];
+  telemetry->current_seq = telemetry->current->seq;
+  // odd while the record is being written
+  __atomic_store_n(&telemetry->current->seq, telemetry->current_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return &telemetry->current->record;
+}
+
+void poet_telemetry_end(poet_telemetry * telemetry) {
+  __atomic_store_n(&telemetry->current->seq, telemetry->current_seq + 2, __ATOMIC_RELEASE);
+  telemetry->head++;
+  __atomic_store_n(&telemetry->header->head, telemetry->head, __ATOMIC_RELEASE);
+}
+
+void poet_telemetry_destroy(poet_telemetry * telemetry) {
+  if (telemetry != NULL) {
+    munmap(telemetry->header, telemetry->size);
+    free(telemetry);
+  }
+}
+
+const poet_telemetry_header * poet_telemetry_open(const char * path,
+                                                  size_t * size) {
+  int fd;
+  struct stat st;
+  void * addr;
+  const poet_telemetry_header * header;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+  if (fstat(fd, &st)) {
+    perror(path);
+    close(fd);
+    return NULL;
+  }
+  if ((size_t) st.st_size < sizeof(poet_telemetry_header)) {
+    fprintf(stderr, "%s: Not a telemetry ring\n", path);
+    close(fd);
+    return NULL;
+  }
+  addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    perror(path);
+    return NULL;
+  }
+  header = (const poet_telemetry_header *) addr;
+
+  if (memcmp(header->magic, POET_TELEMETRY_MAGIC, sizeof(header->magic))) {
+    fprintf(stderr, "%s: Not a telemetry ring\n", path);
+  } else {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (header->version != POET_TELEMETRY_VERSION) {
+      fprintf(stderr, "%s: Unsupported telemetry version: %u\n", path, header->version);
+    } else if (header->byte_order != POET_LOG_BYTE_ORDER ||
+#ifdef FIXED_POINT
+               !(header->flags & POET_LOG_FLAG_FIXED_POINT) ||
+#else
+               (header->flags & POET_LOG_FLAG_FIXED_POINT) ||
+#endif
+               header->real_size != sizeof(real_t) ||
+               header->record_size != sizeof(poet_record)) {
+      fprintf(stderr, "%s: Written by an incompatible build (%s, %u-byte records)\n", path,
+              (header->flags & POET_LOG_FLAG_FIXED_POINT) ? "fixed point" : "floating point",
+              header->record_size);
+    } else if ((size_t) st.st_size < get_ring_size(header->num_slots)) {
+      fprintf(stderr, "%s: Truncated telemetry ring\n", path);
+    } else {
+      *size = (size_t) st.st_size;
+      return header;
+    }
+  }
+  munmap(addr, (size_t) st.st_size);
+  return NULL;
+}
+
+uint64_t poet_telemetry_get_head(const poet_telemetry_header * header) {
+  return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+}
+
+int poet_telemetry_read(const poet_telemetry_header * header,
+                        uint64_t index,
+                        poet_record * record) {
+  uint64_t head = poet_telemetry_get_head(header);
+  uint64_t expected = 2 * (index / header->num_slots + 1);
+  const poet_telemetry_slot * slot = &get_slots(header)[index % header->num_slots];
+  uint64_t seq;
+
+  if (index >= head) {
+    return -1;
+  }
+  // the slot is at least as new as the record once it has been published
+  seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+  if (seq != expected) {
+    return 1;
+  }
+  memcpy(record, &slot->record, sizeof(poet_record));
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  // the record was torn if the controller started overwriting it
+  if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+    return 1;
+  }
+  return 0;
+}
+
+void poet_telemetry_close(const poet_telemetry_header * header,
+                          size_t size) {
+  if (header != NULL) {
+    munmap((void *) (uintptr_t) header, size);
+  }
+}
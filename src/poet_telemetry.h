@@ -0,0 +1,105 @@
+#ifndef _POET_TELEMETRY_H
+#define _POET_TELEMETRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include "poet_log.h"
+
+/*
+ * Live telemetry ring in a memory-mapped file.
+ *
+ * The controller overwrites the oldest slot with each new record. Each slot has
+ * a sequence counter that is odd while the slot is written (a seqlock), so
+ * readers in other processes can copy records without ever blocking the
+ * controller. A slot's counter is 2 * (number of times it has been written).
+ */
+
+#define POET_TELEMETRY_MAGIC "BARDTLM"
+#define POET_TELEMETRY_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  // POET_LOG_BYTE_ORDER
+  uint32_t byte_order;
+  // POET_LOG_FLAG_* values
+  uint32_t flags;
+  uint32_t real_size;
+  uint32_t record_size;
+  uint32_t num_slots;
+  uint32_t period;
+  uint32_t reserved0;
+  uint64_t pid;
+  char reserved1[16];
+  // number of records published, on its own cache line
+  uint64_t head;
+  char pad[56];
+} poet_telemetry_header;
+
+typedef struct {
+  uint64_t seq;
+  poet_record record;
+} poet_telemetry_slot;
+
+typedef struct poet_telemetry poet_telemetry;
+
+/*
+ * Create (or replace) and map the ring file.
+ * Returns NULL and sets errno on failure.
+ */
+poet_telemetry * poet_telemetry_create(const char * path,
+                                       unsigned int num_slots,
+                                       unsigned int period);
+
+/*
+ * Get the slot record to fill, which is marked as being written.
+ * The record must be published with poet_telemetry_end().
+ */
+poet_record * poet_telemetry_begin(poet_telemetry * telemetry);
+
+/*
+ * Publish the record returned by poet_telemetry_begin().
+ */
+void poet_telemetry_end(poet_telemetry * telemetry);
+
+/*
+ * Unmap the ring and free the telemetry. The file is left for readers.
+ */
+void poet_telemetry_destroy(poet_telemetry * telemetry);
+
+/*
+ * Map a ring file for reading.
+ * Returns NULL on failure, after printing the reason to stderr.
+ */
+const poet_telemetry_header * poet_telemetry_open(const char * path,
+                                                  size_t * size);
+
+/*
+ * Get the number of records published so far.
+ */
+uint64_t poet_telemetry_get_head(const poet_telemetry_header * header);
+
+/*
+ * Copy the record with the given index (0 is the first record published).
+ * Returns 0 on success, 1 if the record has been overwritten, or -1 if it has
+ * not been published yet.
+ */
+int poet_telemetry_read(const poet_telemetry_header * header,
+                        uint64_t index,
+                        poet_record * record);
+
+/*
+ * Unmap a ring opened with poet_telemetry_open().
+ */
+void poet_telemetry_close(const poet_telemetry_header * header,
+                          size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
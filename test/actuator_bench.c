@@ -0,0 +1,309 @@
+/**
+ * Compare the latency of state transitions that set CPU frequencies by
+ * running a shell for each CPU with transitions through a CPU actuator,
+ * using a fake sysfs tree, and of setting the core assignment with taskset
+ * with setting it with sched_setaffinity. Also checks that the actuator only
+ * writes the frequencies that change between states, and rewrites those
+ * changed behind its back.
+ * Includes poet_config_linux.c directly to time only the frequency writes
+ * and core assignments.
+ *
+ * Usage: actuator_bench [shell_transitions] [actuator_transitions]
+ */
+// defines _GNU_SOURCE, so it comes first
+#include "../src/poet_config_linux.c"
+#include <signal.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#define FAKE_CPUS 8
+
+static const char* CPU_CONFIG = "../config/examples/ODROIDXU3/cpu_config_stream";
+
+static inline uint64_t get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // must use a const or cast a literal - using a simple literal can overflow!
+  const uint64_t ONE_BILLION = 1000000000;
+  return ts.tv_sec * ONE_BILLION + ts.tv_nsec;
+}
+
+// create or remove root/cpuN/cpufreq/POET_CONFIG_DVFS_FILE for each fake CPU
+static int fake_sysfs(const char* root, int create) {
+  char path[4096];
+  unsigned int cpu;
+  FILE* f;
+  for (cpu = 0; cpu < FAKE_CPUS; cpu++) {
+    snprintf(path, sizeof(path), "%s/cpu%u", root, cpu);
+    if (create ? mkdir(path, 0755) : 0) {
+      perror(path);
+      return -1;
+    }
+    snprintf(path, sizeof(path), "%s/cpu%u/cpufreq", root, cpu);
+    if (create ? mkdir(path, 0755) : 0) {
+      perror(path);
+      return -1;
+    }
+    snprintf(path, sizeof(path), "%s/cpu%u/cpufreq/"POET_CONFIG_DVFS_FILE, root, cpu);
+    if (create) {
+      f = fopen(path, "w");
+      if (f == NULL) {
+        perror(path);
+        return -1;
+      }
+      fclose(f);
+    } else {
+      unlink(path);
+      snprintf(path, sizeof(path), "%s/cpu%u/cpufreq", root, cpu);
+      rmdir(path);
+      snprintf(path, sizeof(path), "%s/cpu%u", root, cpu);
+      rmdir(path);
+    }
+  }
+  return create ? 0 : rmdir(root);
+}
+
+// the core allocation command used before sched_setaffinity
+static void apply_cpu_core_mask_taskset(const char* core_mask) {
+  char command[4096];
+  snprintf(command, sizeof(command),
+          "ps -eLf | awk '(/%d/) && (!/awk/) {print $4}' | xargs -n1 taskset -p %s > /dev/null",
+          getpid(), core_mask);
+  if (system(command)) {
+    fprintf(stderr, "apply_cpu_core_mask_taskset: ERROR running taskset\n");
+  }
+}
+
+// time core assignments of this process and a child to the first CPU we have
+static int bench_affinity(unsigned int shell_iters, unsigned int native_iters) {
+  unsigned int i;
+  int ret = 0;
+  uint64_t start;
+  double shell_ns;
+  double native_ns;
+  pid_t child;
+  poet_cpu_state_t state;
+  cpu_set_t* mask = CPU_ALLOC(POET_MAX_CORES);
+  cpu_set_t* child_mask = CPU_ALLOC(POET_MAX_CORES);
+  size_t size = CPU_ALLOC_SIZE(POET_MAX_CORES);
+
+  if (mask == NULL || child_mask == NULL || sched_getaffinity(0, size, mask)) {
+    perror("sched_getaffinity");
+    return -1;
+  }
+  for (i = 0; i < POET_MAX_CORES && !CPU_ISSET_S(i, size, mask); i++);
+  memset(state.core_mask, '0', POET_LEN_CORE_MASK - 1);
+  state.core_mask[1] = 'x';
+  state.core_mask[POET_LEN_CORE_MASK - 1] = '\0';
+  state.core_mask[POET_LEN_CORE_MASK - 2 - (i / 4)] = "1248"[i % 4];
+  parse_core_mask(state.core_mask, mask, POET_MAX_CORES);
+
+  child = fork();
+  if (child == 0) {
+    pause();
+    _exit(0);
+  }
+  start = get_time();
+  for (i = 0; i < shell_iters; i++) {
+    apply_cpu_core_mask_taskset(state.core_mask);
+  }
+  shell_ns = (double) (get_time() - start) / shell_iters;
+  start = get_time();
+  for (i = 0; i < native_iters; i++) {
+    if (apply_cpu_core_mask(mask, size, 1)) {
+      ret = -1;
+      break;
+    }
+  }
+  native_ns = (double) (get_time() - start) / native_iters;
+  printf("core mask %s: taskset %.0f ns, sched_setaffinity %.0f ns per transition (%.0fx)\n",
+         state.core_mask, shell_ns, native_ns, shell_ns / native_ns);
+
+  // the child process follows
+  if (child < 0 || sched_getaffinity(child, size, child_mask) ||
+      !CPU_EQUAL_S(size, mask, child_mask)) {
+    fprintf(stderr, "Child process affinity was not set\n");
+    ret = -1;
+  }
+  if (child > 0) {
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+  }
+  CPU_FREE(mask);
+  CPU_FREE(child_mask);
+  return ret;
+}
+
+static unsigned long read_freq(const char* root, unsigned int cpu) {
+  char path[4096];
+  unsigned long freq = 0;
+  FILE* f;
+  snprintf(path, sizeof(path), "%s/cpu%u/cpufreq/"POET_CONFIG_DVFS_FILE, root, cpu);
+  f = fopen(path, "r");
+  if (f != NULL) {
+    if (fscanf(f, "%lu", &freq) != 1) {
+      freq = 0;
+    }
+    fclose(f);
+  }
+  return freq;
+}
+
+static int write_freq(const char* root, unsigned int cpu, unsigned long freq) {
+  char path[4096];
+  FILE* f;
+  snprintf(path, sizeof(path), "%s/cpu%u/cpufreq/"POET_CONFIG_DVFS_FILE, root, cpu);
+  f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  fprintf(f, "%lu\n", freq);
+  fclose(f);
+  return 0;
+}
+
+// step through neighbouring states, as the controller usually does
+static int test_shadow(poet_cpu_actuator* actuator, const char* root) {
+  const poet_cpu_table* table = actuator->table;
+  unsigned long before;
+  unsigned long writes;
+  unsigned long stale;
+  unsigned long all_writes = 0;
+  unsigned long freq;
+  unsigned int i;
+  unsigned int d;
+  int failures = 0;
+
+  cpu_actuator_get_write_stats(actuator, &before, NULL, NULL);
+  for (i = 0; i < table->num_states; i++) {
+    cpu_actuator_apply_frequencies(actuator, i);
+    for (d = 0; d < table->num_domains; d++) {
+      all_writes += get_cpu_table_freqs(table, i)[d] != 0;
+    }
+  }
+  cpu_actuator_get_write_stats(actuator, &writes, NULL, NULL);
+  writes -= before;
+  printf("%u neighbouring transitions: %lu of %lu frequency writes\n",
+         table->num_states, writes, all_writes);
+  if (writes >= all_writes) {
+    fprintf(stderr, "Unchanged frequencies were written\n");
+    failures++;
+  }
+
+  // a frequency changed by someone else is rewritten after revalidating
+  i = table->num_states - 1;
+  freq = get_cpu_table_freqs(table, i)[0];
+  if (write_freq(root, table->domain_cpus[0], freq + 1)) {
+    return failures + 1;
+  }
+  cpu_actuator_apply_frequencies(actuator, i);
+  if (read_freq(root, table->domain_cpus[0]) != freq + 1) {
+    fprintf(stderr, "Frequency was rewritten without revalidating\n");
+    failures++;
+  }
+  cpu_actuator_revalidate(actuator);
+  cpu_actuator_apply_frequencies(actuator, i);
+  cpu_actuator_get_write_stats(actuator, NULL, NULL, &stale);
+  if (read_freq(root, table->domain_cpus[0]) != freq || stale != 1) {
+    fprintf(stderr, "Stale frequency was not rewritten: %lu, %lu stale\n",
+            read_freq(root, table->domain_cpus[0]), stale);
+    failures++;
+  }
+  return failures;
+}
+
+int main(int argc, char** argv) {
+  char root[] = "/tmp/bard_sysfs_XXXXXX";
+  unsigned int shell_iters = argc > 1 ? (unsigned int) atoi(argv[1]) : 100;
+  unsigned int actuator_iters = argc > 2 ? (unsigned int) atoi(argv[2]) : 100000;
+  unsigned int nstates;
+  unsigned int i;
+  unsigned int id = 0;
+  int failures = 0;
+  int err;
+  int stdout_fd;
+  int null_fd;
+  uint64_t start;
+  double shell_ns;
+  double actuator_ns;
+  poet_cpu_state_t* states;
+  poet_cpu_actuator* actuator;
+  unsigned long freqs[POET_MAX_CORES];
+
+  if (shell_iters == 0 || actuator_iters == 0) {
+    fprintf(stderr, "Usage: %s [shell_transitions] [actuator_transitions]\n", argv[0]);
+    return 1;
+  }
+  if (get_cpu_states(CPU_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  if (mkdtemp(root) == NULL || fake_sysfs(root, 1)) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  // a missing tree is reported when the actuator is created
+  if (cpu_actuator_init(states, nstates, "/nonexistent") != NULL || errno != ENOENT) {
+    fprintf(stderr, "Actuator created without DVFS files\n");
+    failures++;
+  }
+  actuator = cpu_actuator_init(states, nstates, root);
+  if (actuator == NULL) {
+    perror("cpu_actuator_init");
+    return 1;
+  }
+
+  // the shell path logs each command
+  fflush(stdout);
+  stdout_fd = dup(STDOUT_FILENO);
+  null_fd = open("/dev/null", O_WRONLY);
+  if (stdout_fd < 0 || null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+    perror("dup");
+    return 1;
+  }
+  start = get_time();
+  for (i = 0; i < shell_iters; i++) {
+    id = i % nstates;
+    apply_cpu_table_frequencies_system(root, actuator->table, id);
+  }
+  shell_ns = (double) (get_time() - start) / shell_iters;
+  fflush(stdout);
+  dup2(stdout_fd, STDOUT_FILENO);
+  close(stdout_fd);
+  close(null_fd);
+
+  start = get_time();
+  for (i = 0; i < actuator_iters; i++) {
+    id = i % nstates;
+    cpu_actuator_apply_frequencies(actuator, id);
+  }
+  actuator_ns = (double) (get_time() - start) / actuator_iters;
+  printf("%u states: shell %.0f ns, actuator %.0f ns per transition (%.0fx)\n",
+         nstates, shell_ns, actuator_ns, shell_ns / actuator_ns);
+
+  // the files hold the last state's frequencies
+  parse_freq_list(states[id].freqs, freqs, POET_MAX_CORES);
+  for (i = 0; i < FAKE_CPUS; i++) {
+    if (freqs[i] != 0 && read_freq(root, i) != freqs[i]) {
+      fprintf(stderr, "CPU %u: expected frequency %lu, got %lu\n", i, freqs[i],
+              read_freq(root, i));
+      failures++;
+    }
+  }
+  failures += test_shadow(actuator, root);
+  if (bench_affinity(shell_iters / 10 + 1, actuator_iters / 10 + 1)) {
+    failures++;
+  }
+  if (cpu_actuator_get_errors(actuator, &err) != 0) {
+    fprintf(stderr, "Actuator reported errors: %s\n", strerror(err));
+    failures++;
+  }
+
+  cpu_actuator_destroy(actuator);
+  free(states);
+  fake_sysfs(root, 0);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * Verify that an actuator combines registered backends, and that the RAPL
+ * backend writes each state's power limit and restores the original limit,
+ * using a fake sysfs tree.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "poet_config.h"
+
+#define ORIGINAL_LIMIT 50000000UL
+#define IDLE_NS 2000000ULL
+
+static const char* CPU_CONFIG =
+  "#id cores freqs power_limits\n"
+  "0 0 1000000,- 10000000\n"
+  "1 0 2000000,- 20000000\n"
+  "2 0 2000000,- -\n";
+
+static const char* DIRS[] = {
+  "devices", "devices/system", "devices/system/cpu",
+  "devices/system/cpu/cpu0", "devices/system/cpu/cpu0/cpufreq",
+  "class", "class/powercap", "class/powercap/intel-rapl:0",
+};
+#define NUM_DIRS (sizeof(DIRS) / sizeof(DIRS[0]))
+
+static const char* DVFS_FILE = "devices/system/cpu/cpu0/cpufreq/scaling_setspeed";
+static const char* RAPL_FILE = "class/powercap/intel-rapl:0/constraint_0_power_limit_uw";
+
+static char root[] = "/tmp/bard_actuator_XXXXXX";
+static unsigned int num_applies = 0;
+static unsigned int num_destroys = 0;
+
+static void* count_init(poet_cpu_table* table, const char* sysfs_root) {
+  (void) sysfs_root;
+  return table;
+}
+
+static int count_apply(void* backend, unsigned int id, unsigned int last_id,
+                       unsigned long long idle_ns, unsigned int is_first_apply) {
+  (void) backend;
+  (void) id;
+  (void) last_id;
+  (void) idle_ns;
+  (void) is_first_apply;
+  num_applies++;
+  return 0;
+}
+
+static void count_destroy(void* backend) {
+  (void) backend;
+  num_destroys++;
+}
+
+static const poet_actuator_backend COUNT_BACKEND = {
+  "count", count_init, count_apply, count_destroy
+};
+
+static inline unsigned long long get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static int write_file(const char* file, const char* value) {
+  char path[4096];
+  FILE* f;
+  snprintf(path, sizeof(path), "%s/%s", root, file);
+  f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  fputs(value, f);
+  fclose(f);
+  return 0;
+}
+
+static unsigned long read_value(const char* file) {
+  char path[4096];
+  unsigned long value = 0;
+  FILE* f;
+  snprintf(path, sizeof(path), "%s/%s", root, file);
+  f = fopen(path, "r");
+  if (f != NULL) {
+    if (fscanf(f, "%lu", &value) != 1) {
+      value = 0;
+    }
+    fclose(f);
+  }
+  return value;
+}
+
+static void remove_tree(void) {
+  char path[4096];
+  unsigned int i;
+  snprintf(path, sizeof(path), "%s/%s", root, DVFS_FILE);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/%s", root, RAPL_FILE);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/cpu_config", root);
+  unlink(path);
+  for (i = NUM_DIRS; i > 0; i--) {
+    snprintf(path, sizeof(path), "%s/%s", root, DIRS[i - 1]);
+    rmdir(path);
+  }
+  rmdir(root);
+}
+
+int main(void) {
+  char path[4096];
+  char limit[32];
+  poet_cpu_table* table;
+  poet_actuator* actuator;
+  unsigned long long start;
+  unsigned int nstates;
+  unsigned int i;
+  int failures = 0;
+
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  for (i = 0; i < NUM_DIRS; i++) {
+    snprintf(path, sizeof(path), "%s/%s", root, DIRS[i]);
+    if (mkdir(path, 0755)) {
+      perror(path);
+      return 1;
+    }
+  }
+  snprintf(limit, sizeof(limit), "%lu\n", ORIGINAL_LIMIT);
+  snprintf(path, sizeof(path), "%s/cpu_config", root);
+  if (write_file(DVFS_FILE, "") || write_file(RAPL_FILE, limit) ||
+      write_file("cpu_config", CPU_CONFIG) || get_cpu_table(path, &table, &nstates)) {
+    return 1;
+  }
+
+  // backends are registered once by name
+  if (actuator_register_backend(&COUNT_BACKEND) ||
+      actuator_register_backend(&COUNT_BACKEND) == 0 || errno != EEXIST ||
+      actuator_get_backend("count") != &COUNT_BACKEND || actuator_get_backend("rapl") == NULL) {
+    fprintf(stderr, "Backend was not registered once\n");
+    failures++;
+  }
+  if (actuator_init(table, "dvfs,unknown", root) != NULL || errno != EINVAL) {
+    fprintf(stderr, "Actuator created with an unknown backend\n");
+    failures++;
+  }
+
+  // cores are left alone, since this process may not be allowed to use CPU 0
+  actuator = actuator_init(table, "dvfs,rapl,idle,count", root);
+  if (actuator == NULL) {
+    perror("actuator_init");
+    return 1;
+  }
+  apply_actuator(actuator, nstates, 0, 0, 0, 1);
+  if (read_value(DVFS_FILE) != 1000000 || read_value(RAPL_FILE) != 10000000) {
+    fprintf(stderr, "State 0: expected 1000000 kHz and 10000000 uW, got %lu kHz and %lu uW\n",
+            read_value(DVFS_FILE), read_value(RAPL_FILE));
+    failures++;
+  }
+  apply_actuator(actuator, nstates, 1, 0, 0, 0);
+  // a state without a power limit keeps the last one
+  start = get_time();
+  apply_actuator(actuator, nstates, 2, 1, IDLE_NS, 0);
+  if (get_time() - start < IDLE_NS) {
+    fprintf(stderr, "The idle backend did not idle\n");
+    failures++;
+  }
+  if (read_value(DVFS_FILE) != 2000000 || read_value(RAPL_FILE) != 20000000) {
+    fprintf(stderr, "State 2: expected 2000000 kHz and 20000000 uW, got %lu kHz and %lu uW\n",
+            read_value(DVFS_FILE), read_value(RAPL_FILE));
+    failures++;
+  }
+  if (num_applies != 3 || actuator_get_errors(actuator, NULL) != 0) {
+    fprintf(stderr, "Registered backend applied %u of 3 states, %lu errors\n", num_applies,
+            actuator_get_errors(actuator, NULL));
+    failures++;
+  }
+  actuator_destroy(actuator);
+  if (num_destroys != 1 || read_value(RAPL_FILE) != ORIGINAL_LIMIT) {
+    fprintf(stderr, "Original power limit was not restored: %lu\n", read_value(RAPL_FILE));
+    failures++;
+  }
+
+  cpu_table_destroy(table);
+  remove_tree();
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * Verify that the apply thread applies the latest request in order, and that
+ * slow apply functions no longer delay poet_apply_control().
+ * Includes poet.c directly to also test the apply thread on its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+#define NUM_STATES 3
+#define ITERATIONS 40
+#define APPLY_NS 2000000
+
+// an idle state at id 0, partnered with id 1
+static const char* CONTROL_CONFIG = "config/control_config_idle";
+
+static unsigned int num_applies = 0;
+static unsigned int last_applied_id = 1;
+static int out_of_order = 0;
+
+static inline unsigned long long get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+// a slow actuator
+static void apply(void* states, unsigned int num_states, unsigned int id,
+                  unsigned int last_id, unsigned long long idle_ns,
+                  unsigned int is_first_apply) {
+  struct timespec ts;
+  (void) states;
+  (void) num_states;
+  (void) idle_ns;
+  (void) is_first_apply;
+  // last_id is always the state that was really applied
+  if (last_id != last_applied_id) {
+    out_of_order++;
+  }
+  last_applied_id = id;
+  num_applies++;
+  ts.tv_sec = 0;
+  ts.tv_nsec = APPLY_NS;
+  nanosleep(&ts, NULL);
+}
+
+static int test_mailbox(void) {
+  poet_async_apply_stats stats;
+  unsigned long long time_ns[NUM_STATES];
+  unsigned long long start = get_time();
+  unsigned long long total;
+  unsigned int i;
+  int failures = 0;
+  poet_apply_thread* thread = poet_apply_thread_create(apply, NULL, NUM_STATES, 1);
+  if (thread == NULL) {
+    perror("poet_apply_thread_create");
+    return 1;
+  }
+  // requests posted while the thread is busy replace each other
+  for (i = 0; i < 20; i++) {
+    poet_apply_thread_post(thread, i % NUM_STATES, 0, i == 0);
+  }
+  poet_apply_thread_get_time_in_states(thread, time_ns);
+  poet_apply_thread_get_stats(thread, &stats);
+  total = time_ns[0] + time_ns[1] + time_ns[2];
+  if (total > get_time() - start) {
+    fprintf(stderr, "Time in states %llu ns is longer than the thread existed\n", total);
+    failures++;
+  }
+  poet_apply_thread_destroy(thread);
+  printf("mailbox: posted %llu, applied %u, superseded %llu\n",
+         stats.posted, num_applies, stats.superseded);
+  if (stats.posted != 20 || stats.superseded == 0 || num_applies >= 20) {
+    fprintf(stderr, "Requests were not superseded\n");
+    failures++;
+  }
+  // the latest request is applied before the thread stops
+  if (last_applied_id != 19 % NUM_STATES) {
+    fprintf(stderr, "Latest request was not applied: %u\n", last_applied_id);
+    failures++;
+  }
+  return failures;
+}
+
+// returns the longest poet_apply_control() call
+static unsigned long long run_control(poet_state* state) {
+  unsigned long long start;
+  unsigned long long longest = 0;
+  unsigned long i;
+  for (i = 0; i < ITERATIONS; i++) {
+    start = get_time();
+    // alternate between goals far below and far above the performance
+    poet_set_constraint_type(state, PERFORMANCE, i % 2 ? CONST(10000.0) : CONST(1.0));
+    poet_apply_control(state, i, CONST(100.0), CONST(1.0));
+    if (get_time() - start > longest) {
+      longest = get_time() - start;
+    }
+  }
+  return longest;
+}
+
+static int test_async_apply(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  poet_async_apply_stats stats;
+  unsigned long long time_ns[NUM_STATES];
+  unsigned long long sync_ns;
+  unsigned long long async_ns;
+  unsigned long long async_start;
+  unsigned int sync_applies;
+  struct timespec ts;
+  int failures = 0;
+  poet_state* state;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  num_applies = 0;
+  // without a current state function, the highest state is assumed
+  last_applied_id = nstates - 1;
+  state = poet_init(CONST(1000.0), PERFORMANCE, nstates, states, NULL, apply,
+                    NULL, 1, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  if (poet_get_async_apply_stats(state, &stats) == 0) {
+    fprintf(stderr, "Got stats without async apply\n");
+    failures++;
+  }
+  sync_ns = run_control(state);
+  sync_applies = num_applies;
+
+  // time in states starts when the apply thread does
+  async_start = get_time();
+  if (poet_set_async_apply(state, 1)) {
+    perror("poet_set_async_apply");
+    return 1;
+  }
+  async_ns = run_control(state);
+  // let the apply thread catch up
+  ts.tv_sec = 0;
+  ts.tv_nsec = 5 * APPLY_NS;
+  nanosleep(&ts, NULL);
+  if (poet_get_async_apply_stats(state, &stats) || poet_get_time_in_states(state, time_ns)) {
+    perror("poet_get_async_apply_stats");
+    return 1;
+  }
+  poet_destroy(state);
+  free(states);
+  printf("sync: %u applies, longest call %llu ns\n", sync_applies, sync_ns);
+  printf("async: posted %llu, superseded %llu, longest call %llu ns\n",
+         stats.posted, stats.superseded, async_ns);
+  printf("time in states: %llu %llu %llu ns\n", time_ns[0], time_ns[1], time_ns[2]);
+  if (sync_applies == 0 || sync_ns < APPLY_NS) {
+    fprintf(stderr, "Controller never applied a state\n");
+    failures++;
+  }
+  if (time_ns[0] + time_ns[1] + time_ns[2] > get_time() - async_start ||
+      time_ns[0] + time_ns[1] + time_ns[2] < 5 * APPLY_NS) {
+    fprintf(stderr, "Time in states does not match the time async apply was enabled\n");
+    failures++;
+  }
+  if (stats.applied + stats.superseded != stats.posted || stats.applied_id != last_applied_id) {
+    fprintf(stderr, "Not all requests were applied or superseded\n");
+    failures++;
+  }
+  if (async_ns >= APPLY_NS) {
+    fprintf(stderr, "poet_apply_control() waited for the apply function\n");
+    failures++;
+  }
+  return failures;
+}
+
+int main(void) {
+  int failures = test_mailbox() + test_async_apply();
+  if (out_of_order) {
+    fprintf(stderr, "%d applies had the wrong last_id\n", out_of_order);
+    failures++;
+  }
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
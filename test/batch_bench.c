@@ -0,0 +1,176 @@
+/**
+ * Compare the throughput of poet_apply_control() called per instance with
+ * poet_apply_control_batch(), and verify that both produce the same state.
+ * Includes poet.c directly to compare internal state.
+ *
+ * Usage: batch_bench [instances] [iterations] [period]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+static const char* CONTROL_CONFIG = "../config/examples/ODROIDXU3/control_config_stream";
+
+static inline uint64_t get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // must use a const or cast a literal - using a simple literal can overflow!
+  const uint64_t ONE_BILLION = 1000000000;
+  return ts.tv_sec * ONE_BILLION + ts.tv_nsec;
+}
+
+static poet_state** create_states(unsigned int n,
+                                  poet_control_state_t* cstates,
+                                  unsigned int nstates,
+                                  unsigned int period) {
+  unsigned int i;
+  poet_controller_params slow;
+  poet_filter_params adaptive = {Q, R, 1};
+  poet_state** states = malloc(n * sizeof(poet_state*));
+  if (states == NULL) {
+    return NULL;
+  }
+  poet_get_controller_preset(POET_CONTROLLER_SLOW, &slow);
+  for (i = 0; i < n; i++) {
+    // alternate constraints and vary goals
+    states[i] = poet_init(CONST(1.0 + (i % 5) * 0.5), i % 2 ? POWER : PERFORMANCE,
+                          nstates, cstates, NULL, NULL, NULL, period, 0, NULL);
+    if (states[i] == NULL) {
+      perror("poet_init");
+      exit(1);
+    }
+    // mix controllers, so batches have per-instance coefficients
+    if (i % 3 == 2 && poet_set_controller_params(states[i], &slow)) {
+      perror("poet_set_controller_params");
+      exit(1);
+    }
+    // and fixed and adaptive filters
+    if (i % 4 == 1 && (poet_set_filter_params(states[i], POET_FILTER_PERFORMANCE, &adaptive) ||
+                       poet_set_filter_params(states[i], POET_FILTER_POWER, &adaptive))) {
+      perror("poet_set_filter_params");
+      exit(1);
+    }
+  }
+  return states;
+}
+
+static void destroy_states(poet_state** states, unsigned int n) {
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    poet_destroy(states[i]);
+  }
+  free(states);
+}
+
+// synthetic heartbeat rates and power for instance i at iteration it
+static void get_inputs(unsigned int n, unsigned int it, real_t* perf, real_t* pwr) {
+  unsigned int i;
+  for (i = 0; i < n; i++) {
+    perf[i] = CONST(0.5 + ((i * 7 + it * 3) % 17) * 0.1);
+    pwr[i] = CONST(1.0 + ((i * 5 + it * 11) % 13) * 0.2);
+  }
+}
+
+// compares fields, since filter_noise has padding
+static int same_noise(const filter_noise* a, const filter_noise* b) {
+  return !memcmp(&a->q, &b->q, sizeof(real_t)) && !memcmp(&a->r, &b->r, sizeof(real_t)) &&
+         !memcmp(&a->bias, &b->bias, sizeof(real_t)) && !memcmp(&a->mad, &b->mad, sizeof(real_t));
+}
+
+static int same_state(const poet_state* a, const poet_state* b) {
+  return !memcmp(&a->pfs, &b->pfs, sizeof(filter_state)) &&
+         !memcmp(&a->cfs, &b->cfs, sizeof(filter_state)) &&
+         !memcmp(&a->scs, &b->scs, sizeof(calc_xup_state)) &&
+         !memcmp(&a->pcs, &b->pcs, sizeof(calc_xup_state)) &&
+         same_noise(&a->pfn, &b->pfn) && same_noise(&a->cfn, &b->cfn) &&
+         a->lower_id == b->lower_id && a->upper_id == b->upper_id &&
+         a->low_state_iters == b->low_state_iters && a->last_id == b->last_id &&
+         a->current_action == b->current_action;
+}
+
+int main(int argc, char** argv) {
+  unsigned int n = argc > 1 ? (unsigned int) atoi(argv[1]) : 4096;
+  unsigned int iters = argc > 2 ? (unsigned int) atoi(argv[2]) : 200;
+  unsigned int period = argc > 3 ? (unsigned int) atoi(argv[3]) : 1;
+  unsigned int nstates;
+  unsigned int i;
+  unsigned int it;
+  int failures = 0;
+  uint64_t start;
+  double single_ns;
+  double batch_ns;
+  poet_control_state_t* cstates;
+  poet_state** single;
+  poet_state** batch;
+  unsigned long* ids;
+  real_t* perf;
+  real_t* pwr;
+
+  if (n == 0 || iters == 0 || period == 0) {
+    fprintf(stderr, "Usage: %s [instances] [iterations] [period]\n", argv[0]);
+    return 1;
+  }
+  if (get_control_states(CONTROL_CONFIG, &cstates, &nstates)) {
+    return 1;
+  }
+  single = create_states(n, cstates, nstates, period);
+  batch = create_states(n, cstates, nstates, period);
+  ids = malloc(n * sizeof(unsigned long));
+  perf = malloc(n * sizeof(real_t));
+  pwr = malloc(n * sizeof(real_t));
+  if (single == NULL || batch == NULL || ids == NULL || perf == NULL || pwr == NULL) {
+    perror("malloc");
+    return 1;
+  }
+
+  // verify
+  for (it = 0; it < iters; it++) {
+    get_inputs(n, it, perf, pwr);
+    for (i = 0; i < n; i++) {
+      ids[i] = it;
+      poet_apply_control(single[i], ids[i], perf[i], pwr[i]);
+    }
+    poet_apply_control_batch(batch, ids, perf, pwr, n);
+    for (i = 0; i < n; i++) {
+      if (!same_state(single[i], batch[i])) {
+        fprintf(stderr, "Iteration %u: instance %u state differs\n", it, i);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  // time - inputs are precomputed so only control is measured
+  get_inputs(n, 0, perf, pwr);
+  start = get_time();
+  for (it = 0; it < iters; it++) {
+    for (i = 0; i < n; i++) {
+      poet_apply_control(single[i], it, perf[i], pwr[i]);
+    }
+  }
+  single_ns = (double) (get_time() - start) / ((double) n * iters);
+  start = get_time();
+  for (it = 0; it < iters; it++) {
+    poet_apply_control_batch(batch, ids, perf, pwr, n);
+  }
+  batch_ns = (double) (get_time() - start) / ((double) n * iters);
+  printf("%u instances, period %u: per-instance %.1f ns, batch %.1f ns (%.2fx)\n",
+         n, period, single_ns, batch_ns, single_ns / batch_ns);
+
+  destroy_states(single, n);
+  destroy_states(batch, n);
+  free(ids);
+  free(perf);
+  free(pwr);
+  free(cstates);
+
+  if (failures) {
+    fprintf(stderr, "%d batch mismatches\n", failures);
+    return 1;
+  }
+  return 0;
+}
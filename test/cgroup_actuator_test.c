@@ -0,0 +1,160 @@
+/**
+ * Verify that the cgroup actuator writes each state's cores to cpuset.cpus and
+ * throttles the group with cpu.max while idling, using a fake cgroup directory.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "poet_config.h"
+
+#define IDLE_NS 10000000ULL
+#define ORIGINAL_CPU_MAX "max 100000"
+
+static const char* CPU_CONFIG = "../config/examples/ODROIDXU3/cpu_config_stream";
+
+static char cpu_max_path[4096];
+static char cpu_max_idling[64];
+
+// reads the first line, since pwrite does not truncate regular files like
+// cgroupfs replaces values
+static int read_file(const char* path, char* buf, size_t len) {
+  size_t n;
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  n = fread(buf, 1, len - 1, f);
+  buf[n] = '\0';
+  buf[strcspn(buf, "\n")] = '\0';
+  fclose(f);
+  return 0;
+}
+
+static int write_file(const char* path, const char* value) {
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  fputs(value, f);
+  fclose(f);
+  return 0;
+}
+
+// read cpu.max halfway through the idle
+static void* read_cpu_max(void* arg) {
+  struct timespec ts;
+  (void) arg;
+  ts.tv_sec = 0;
+  ts.tv_nsec = (long) (IDLE_NS / 2);
+  nanosleep(&ts, NULL);
+  read_file(cpu_max_path, cpu_max_idling, sizeof(cpu_max_idling));
+  return NULL;
+}
+
+int main(void) {
+  char root[] = "/tmp/bard_cgroup_XXXXXX";
+  char cpuset_path[4096];
+  char cpus[256];
+  char cpu_max[64];
+  poet_cpu_state_t* states;
+  poet_cgroup_actuator* actuator;
+  pthread_t reader;
+  unsigned int nstates;
+  unsigned int i;
+  unsigned int id;
+  unsigned long num_idles;
+  unsigned long long requested_ns;
+  unsigned long long achieved_ns;
+  int failures = 0;
+
+  if (get_cpu_states(CPU_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  snprintf(cpuset_path, sizeof(cpuset_path), "%s/cpuset.cpus", root);
+  snprintf(cpu_max_path, sizeof(cpu_max_path), "%s/cpu.max", root);
+
+  // a group without the cpu and cpuset controllers is reported
+  if (cgroup_actuator_init(states, nstates, root) != NULL) {
+    fprintf(stderr, "Actuator created without cgroup files\n");
+    failures++;
+  }
+  if (write_file(cpuset_path, "") || write_file(cpu_max_path, ORIGINAL_CPU_MAX"\n")) {
+    return 1;
+  }
+  actuator = cgroup_actuator_init(states, nstates, root);
+  if (actuator == NULL) {
+    perror("cgroup_actuator_init");
+    return 1;
+  }
+
+  // cores are written as a cpuset list
+  for (i = 0; i < nstates; i++) {
+    apply_cgroup_actuator(actuator, nstates, i, i > 0 ? i - 1 : 0, 0, i == 0);
+    if (get_current_cgroup_actuator_state(actuator, nstates, &id) ||
+        strcmp(states[id].core_mask, states[i].core_mask)) {
+      fprintf(stderr, "State %u: cores were not applied\n", i);
+      failures++;
+    }
+  }
+  // cpu_config_stream's last state uses cores 4-6
+  read_file(cpuset_path, cpus, sizeof(cpus));
+  if (strcmp(cpus, "4-6")) {
+    fprintf(stderr, "Expected cpuset.cpus 4-6, got: %s\n", cpus);
+    failures++;
+  }
+  // states 0-3 use only core 0
+  apply_cgroup_actuator(actuator, nstates, 0, nstates - 1, 0, 0);
+  read_file(cpuset_path, cpus, sizeof(cpus));
+  if (strcmp(cpus, "0")) {
+    fprintf(stderr, "Expected cpuset.cpus 0, got: %s\n", cpus);
+    failures++;
+  }
+
+  // the group is throttled while idling, then restored
+  if (pthread_create(&reader, NULL, read_cpu_max, NULL)) {
+    perror("pthread_create");
+    return 1;
+  }
+  apply_cgroup_actuator(actuator, nstates, 1, 0, IDLE_NS, 0);
+  pthread_join(reader, NULL);
+  snprintf(cpu_max, sizeof(cpu_max), "1000 %llu", IDLE_NS / 1000);
+  if (strcmp(cpu_max_idling, cpu_max)) {
+    fprintf(stderr, "Expected cpu.max %s while idling, got: %s\n", cpu_max, cpu_max_idling);
+    failures++;
+  }
+  read_file(cpu_max_path, cpu_max, sizeof(cpu_max));
+  if (strcmp(cpu_max, ORIGINAL_CPU_MAX)) {
+    fprintf(stderr, "cpu.max was not restored: %s\n", cpu_max);
+    failures++;
+  }
+  cgroup_actuator_get_idle_stats(actuator, &num_idles, &requested_ns, &achieved_ns);
+  printf("idled %lu times: %llu ns of %llu ns requested\n", num_idles, achieved_ns, requested_ns);
+  if (num_idles != 1 || requested_ns != IDLE_NS || achieved_ns < IDLE_NS) {
+    fprintf(stderr, "Idle was not achieved\n");
+    failures++;
+  }
+  if (cgroup_actuator_get_errors(actuator, NULL) != 0) {
+    fprintf(stderr, "Writes failed\n");
+    failures++;
+  }
+
+  cgroup_actuator_destroy(actuator);
+  unlink(cpuset_path);
+  unlink(cpu_max_path);
+  rmdir(root);
+  free(states);
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,424 @@
+/**
+ * Verify that CPU tables hold the same cores and frequencies as the states
+ * they are compiled from, that they scale to 1024 CPUs with frequencies per
+ * domain, that domains are grouped by cpufreq policy, that power limits scale
+ * to any number of RAPL zones, and compare matching a state against a table
+ * with parsing the state strings for each match.
+ * Includes poet_config_linux.c directly to check the compiled states.
+ *
+ * Usage: cpu_table_test [matches]
+ */
+// defines _GNU_SOURCE, so it comes first
+#include "../src/poet_config_linux.c"
+#include <ctype.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define LARGE_CPUS 1024
+#define LARGE_ZONES 100
+
+static const char* CPU_CONFIGS[] = {
+  "../config/default/cpu_config",
+  "../config/examples/ODROIDXU3/cpu_config_blackscholes",
+  "../config/examples/ODROIDXU3/cpu_config_stream",
+  "../config/examples/ODROIDXU3/cpu_config_x264_native",
+  "../config/examples/SVT11226CXB/cpu_config_blackscholes",
+  "../config/examples/SVT11226CXB/cpu_config_stream",
+  "../config/examples/SVT11226CXB/cpu_config_x264_native",
+};
+
+static inline uint64_t get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // must use a const or cast a literal - using a simple literal can overflow!
+  const uint64_t ONE_BILLION = 1000000000;
+  return ts.tv_sec * ONE_BILLION + ts.tv_nsec;
+}
+
+// the frequency of a CPU in a state, 0 if it doesn't matter
+static unsigned long get_table_freq(const poet_cpu_table* table, unsigned int id,
+                                    unsigned int cpu) {
+  unsigned int d;
+  unsigned int i;
+  for (d = 0; d < table->num_domains; d++) {
+    for (i = table->domain_offsets[d]; i < table->domain_offsets[d + 1]; i++) {
+      if (table->domain_cpus[i] == cpu) {
+        return get_cpu_table_freqs(table, id)[d];
+      }
+    }
+  }
+  return 0;
+}
+
+// check each CPU against the state's hex digits and frequency list
+static int check_state(const poet_cpu_table* table, const poet_cpu_state_t* state,
+                       unsigned int id, const char* name) {
+  char digit;
+  const char* freq = state->freqs;
+  unsigned long expected;
+  unsigned int cpu;
+  int set;
+  int failures = 0;
+  size_t len = strlen(state->core_mask);
+  for (cpu = 0; cpu < POET_MAX_CORES; cpu++) {
+    digit = cpu / 4 < len - 2 ? state->core_mask[len - 1 - cpu / 4] : '0';
+    set = (int) ((strchr("0123456789abcdef", tolower(digit)) - "0123456789abcdef") >>
+                 (cpu % 4)) & 1;
+    if (set != !!CPU_ISSET_S(cpu, table->mask_size, get_cpu_table_mask(table, id))) {
+      fprintf(stderr, "%s: state %u: CPU %u should be %s\n", name, id, cpu,
+              set ? "set" : "clear");
+      failures++;
+    }
+    expected = freq == NULL || *freq == '-' ? 0 : strtoul(freq, NULL, 10);
+    if (get_table_freq(table, id, cpu) != expected) {
+      fprintf(stderr, "%s: state %u: CPU %u frequency should be %lu, got %lu\n", name,
+              id, cpu, expected, get_table_freq(table, id, cpu));
+      failures++;
+    }
+    if (freq != NULL) {
+      freq = strchr(freq, ',');
+      freq = freq == NULL ? NULL : freq + 1;
+    }
+  }
+  return failures;
+}
+
+// find the last state with the same cores and frequencies as the target
+static unsigned int match_strings(const poet_cpu_state_t* states, unsigned int num_states,
+                                  unsigned int target, cpu_set_t* mask, cpu_set_t* target_mask) {
+  unsigned long freqs[POET_MAX_CORES];
+  unsigned long target_freqs[POET_MAX_CORES];
+  unsigned int i;
+  unsigned int n;
+  unsigned int match = num_states;
+  parse_core_mask(states[target].core_mask, target_mask, POET_MAX_CORES);
+  n = parse_freq_list(states[target].freqs, target_freqs, POET_MAX_CORES);
+  for (i = 0; i < num_states; i++) {
+    parse_core_mask(states[i].core_mask, mask, POET_MAX_CORES);
+    if (CPU_EQUAL_S(CPU_ALLOC_SIZE(POET_MAX_CORES), mask, target_mask) &&
+        parse_freq_list(states[i].freqs, freqs, POET_MAX_CORES) == n &&
+        !memcmp(freqs, target_freqs, n * sizeof(unsigned long))) {
+      match = i;
+    }
+  }
+  return match;
+}
+
+static unsigned int match_table(const poet_cpu_table* table, unsigned int target) {
+  unsigned int i;
+  unsigned int match = table->num_states;
+  for (i = 0; i < table->num_states; i++) {
+    if (cpu_table_cores_equal(table, i, target) &&
+        !memcmp(get_cpu_table_freqs(table, i), get_cpu_table_freqs(table, target),
+                table->num_domains * sizeof(unsigned long))) {
+      match = i;
+    }
+  }
+  return match;
+}
+
+static int write_config(const char* path, const char* contents) {
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  fputs(contents, f);
+  fclose(f);
+  return 0;
+}
+
+// a 1024 CPU system with two frequency domains, in both file formats
+static int test_large_table(void) {
+  char path[] = "/tmp/bard_cpu_table_XXXXXX";
+  char* contents = malloc(4 * LARGE_CPUS * 8 + 4096);
+  poet_cpu_table* table;
+  unsigned int nstates;
+  unsigned int cpu;
+  int len;
+  int fd = mkstemp(path);
+  int failures = 0;
+
+  if (fd < 0 || contents == NULL) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  len = sprintf(contents, "#id cores freqs\n0 0-3 0-511:1000000;512-1023:2000000\n"
+                "1 0-1023 0-511:2000000;512-1023:-\n2 0x8");
+  // state 2 uses the last CPU and sets every CPU's frequency separately
+  for (cpu = 1; cpu < LARGE_CPUS / 4; cpu++) {
+    contents[len++] = '0';
+  }
+  contents[len++] = ' ';
+  for (cpu = 0; cpu < LARGE_CPUS; cpu++) {
+    len += sprintf(&contents[len], cpu < 512 ? "3000000," : "4000000,");
+  }
+  strcpy(&contents[len - 1], "\n");
+  // per-CPU frequencies overlap the groups of the other states
+  if (write_config(path, contents) || get_cpu_table(path, &table, &nstates) == 0) {
+    fprintf(stderr, "Overlapping frequency groups were accepted\n");
+    return 1;
+  }
+
+  strcpy(&contents[len - LARGE_CPUS * 8], "0-511:3000000;512-1023:4000000\n");
+  if (write_config(path, contents) || get_cpu_table(path, &table, &nstates)) {
+    return 1;
+  }
+  printf("%u CPUs, %u domains: %zu bytes per state, poet_cpu_state_t: %zu bytes\n",
+         table->num_cpus, table->num_domains,
+         table->mask_size + table->num_domains * sizeof(unsigned long),
+         sizeof(poet_cpu_state_t));
+  if (nstates != 3 || table->num_cpus != LARGE_CPUS || table->num_domains != 2) {
+    fprintf(stderr, "Expected 3 states, %u CPUs, 2 domains\n", LARGE_CPUS);
+    failures++;
+  }
+  if (CPU_COUNT_S(table->mask_size, get_cpu_table_mask(table, 0)) != 4 ||
+      CPU_COUNT_S(table->mask_size, get_cpu_table_mask(table, 1)) != LARGE_CPUS ||
+      CPU_COUNT_S(table->mask_size, get_cpu_table_mask(table, 2)) != 1 ||
+      !CPU_ISSET_S(LARGE_CPUS - 1, table->mask_size, get_cpu_table_mask(table, 2))) {
+    fprintf(stderr, "Cores were not parsed\n");
+    failures++;
+  }
+  if (get_table_freq(table, 0, 0) != 1000000 || get_table_freq(table, 0, 1023) != 2000000 ||
+      get_table_freq(table, 1, 511) != 2000000 || get_table_freq(table, 1, 512) != 0 ||
+      get_table_freq(table, 2, 0) != 3000000 || get_table_freq(table, 2, 1023) != 4000000) {
+    fprintf(stderr, "Frequencies were not parsed\n");
+    failures++;
+  }
+  cpu_table_destroy(table);
+
+  // overlapping groups can't be written consistently
+  if (write_config(path, "0 0 0-3:1000000\n1 0 2-5:1000000\n") ||
+      get_cpu_table(path, &table, &nstates) == 0) {
+    fprintf(stderr, "Overlapping frequency groups were accepted\n");
+    failures++;
+  }
+  unlink(path);
+  free(contents);
+  return failures;
+}
+
+static int write_policy(const char* root, unsigned int policy, const char* related_cpus) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/cpufreq/policy%u", root, policy);
+  if (mkdir(path, 0755)) {
+    perror(path);
+    return -1;
+  }
+  snprintf(path, sizeof(path), "%s/cpufreq/policy%u/related_cpus", root, policy);
+  return write_config(path, related_cpus);
+}
+
+static int make_dvfs_file(const char* root, unsigned int cpu) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/cpu%u", root, cpu);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/cpu%u/cpufreq", root, cpu);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/cpu%u/cpufreq/"POET_CONFIG_DVFS_FILE, root, cpu);
+  return write_config(path, "");
+}
+
+static void remove_tree(const char* root) {
+  char cmd[4096];
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+  if (system(cmd)) {
+    fprintf(stderr, "Failed to remove %s\n", root);
+  }
+}
+
+// two policies of 4 CPUs, like a big.LITTLE system
+// RAPL zones are not limited to POET_MAX_CORES either
+static int test_many_zones(void) {
+  char limits[LARGE_ZONES * 2 + 16];
+  cpu_state_strings strings;
+  poet_cpu_table* table;
+  unsigned int z;
+  int len = 0;
+  int failures = 0;
+
+  for (z = 0; z + 1 < LARGE_ZONES; z++) {
+    len += snprintf(&limits[len], sizeof(limits) - (size_t) len, "-,");
+  }
+  snprintf(&limits[len], sizeof(limits) - (size_t) len, "5000000");
+  strings.cores = "0x1";
+  strings.freqs = "-";
+  strings.power_limits = limits;
+  table = cpu_table_compile(&strings, 1);
+  if (table == NULL) {
+    perror("cpu_table_compile");
+    return 1;
+  }
+  if (table->num_zones != LARGE_ZONES ||
+      get_cpu_table_power_limits(table, 0)[LARGE_ZONES - 1] != 5000000) {
+    fprintf(stderr, "Expected %u zones, got %u\n", LARGE_ZONES, table->num_zones);
+    failures++;
+  }
+  cpu_table_destroy(table);
+  return failures;
+}
+
+static int test_policy_domains(void) {
+  char root[] = "/tmp/bard_cpufreq_XXXXXX";
+  char path[4096];
+  char freq[64];
+  const char* config = "../config/examples/SVT11226CXB/cpu_config_stream";
+  poet_cpu_state_t* states;
+  poet_cpu_table* table;
+  poet_cpu_actuator* actuator;
+  unsigned long* freqs;
+  unsigned int nstates;
+  unsigned int writes;
+  unsigned int i;
+  FILE* f;
+  int failures = 0;
+
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  snprintf(path, sizeof(path), "%s/cpufreq", root);
+  if (mkdir(path, 0755) || write_policy(root, 0, "0 1 2 3\n") ||
+      write_policy(root, 4, "4 5 6 7\n")) {
+    return 1;
+  }
+
+  // the same frequency for each CPU of a policy is written once
+  if (get_cpu_states(config, &states, &nstates) || get_cpu_table(config, &table, &nstates)) {
+    return 1;
+  }
+  writes = table->domain_offsets[table->num_domains];
+  freqs = malloc(nstates * sizeof(unsigned long));
+  for (i = 0; i < nstates; i++) {
+    freqs[i] = get_cpu_table_freqs(table, i)[0];
+  }
+  if (cpu_table_discover_domains(table, root) != 2) {
+    fprintf(stderr, "Policies were not found\n");
+    failures++;
+  }
+  printf("%s: %u writes per state, %u with cpufreq policies\n", config, writes,
+         table->domain_offsets[table->num_domains]);
+  if (table->num_domains != 1 || table->domain_offsets[1] != 1 || table->domain_cpus[0] != 0) {
+    fprintf(stderr, "Expected one domain written through CPU 0\n");
+    failures++;
+  }
+  for (i = 0; i < nstates; i++) {
+    if (get_cpu_table_freqs(table, i)[0] != freqs[i]) {
+      fprintf(stderr, "State %u: frequency changed to %lu\n", i, get_cpu_table_freqs(table, i)[0]);
+      failures++;
+    }
+  }
+  cpu_table_destroy(table);
+  free(freqs);
+
+  // the actuator only opens one CPU's file per policy
+  if (make_dvfs_file(root, 0) || make_dvfs_file(root, 4)) {
+    return 1;
+  }
+  actuator = cpu_actuator_init(states, nstates, root);
+  if (actuator == NULL) {
+    perror("cpu_actuator_init");
+    return 1;
+  }
+  apply_cpu_actuator(actuator, nstates, nstates - 1, 0, 0, 1);
+  snprintf(path, sizeof(path), "%s/cpu0/cpufreq/"POET_CONFIG_DVFS_FILE, root);
+  f = fopen(path, "r");
+  if (f == NULL || fgets(freq, sizeof(freq), f) == NULL ||
+      strtoul(freq, NULL, 10) != strtoul(states[nstates - 1].freqs, NULL, 10)) {
+    fprintf(stderr, "Frequency was not written through CPU 0\n");
+    failures++;
+  }
+  if (f != NULL) {
+    fclose(f);
+  }
+  cpu_actuator_destroy(actuator);
+  free(states);
+
+  // CPUs in a policy that states set differently stay separate
+  snprintf(path, sizeof(path), "%s/cpu_config", root);
+  if (write_config(path, "0 0x1 1000000,2000000\n1 0x1 1000000,-\n") ||
+      get_cpu_table(path, &table, &nstates)) {
+    return 1;
+  }
+  if (cpu_table_discover_domains(table, root) != 2 || table->num_domains != 2) {
+    fprintf(stderr, "Conflicting domains were merged\n");
+    failures++;
+  }
+  cpu_table_destroy(table);
+  remove_tree(root);
+  return failures;
+}
+
+int main(int argc, char** argv) {
+  unsigned int matches = argc > 1 ? (unsigned int) atoi(argv[1]) : 1000;
+  unsigned int c;
+  unsigned int i;
+  unsigned int nstates;
+  unsigned int ntable_states;
+  unsigned int sum = 0;
+  uint64_t start;
+  double string_ns;
+  double table_ns;
+  int failures = 0;
+  poet_cpu_state_t* states;
+  poet_cpu_table* table;
+  cpu_set_t* mask = CPU_ALLOC(POET_MAX_CORES);
+  cpu_set_t* target_mask = CPU_ALLOC(POET_MAX_CORES);
+
+  if (matches == 0 || mask == NULL || target_mask == NULL) {
+    fprintf(stderr, "Usage: %s [matches]\n", argv[0]);
+    return 1;
+  }
+  if (cpu_table_init(NULL, 1) != NULL || errno != EINVAL) {
+    fprintf(stderr, "Table created without states\n");
+    failures++;
+  }
+
+  for (c = 0; c < sizeof(CPU_CONFIGS) / sizeof(CPU_CONFIGS[0]); c++) {
+    if (get_cpu_states(CPU_CONFIGS[c], &states, &nstates) ||
+        get_cpu_table(CPU_CONFIGS[c], &table, &ntable_states)) {
+      return 1;
+    }
+    if (ntable_states != nstates || table->num_states != nstates) {
+      fprintf(stderr, "%s: table has %u states, expected %u\n", CPU_CONFIGS[c],
+              ntable_states, nstates);
+      failures++;
+    }
+    for (i = 0; i < nstates; i++) {
+      failures += check_state(table, &states[i], i, CPU_CONFIGS[c]);
+      if (match_table(table, i) != match_strings(states, nstates, i, mask, target_mask)) {
+        fprintf(stderr, "%s: state %u matched a different state\n", CPU_CONFIGS[c], i);
+        failures++;
+      }
+    }
+
+    start = get_time();
+    for (i = 0; i < matches; i++) {
+      sum += match_strings(states, nstates, i % nstates, mask, target_mask);
+    }
+    string_ns = (double) (get_time() - start) / matches;
+    start = get_time();
+    for (i = 0; i < matches; i++) {
+      sum += match_table(table, i % nstates);
+    }
+    table_ns = (double) (get_time() - start) / matches;
+    printf("%-56s %3u states: strings %.0f ns, table %.0f ns per match (%.0fx)\n",
+           CPU_CONFIGS[c], nstates, string_ns, table_ns, string_ns / table_ns);
+    cpu_table_destroy(table);
+    free(states);
+  }
+  CPU_FREE(mask);
+  CPU_FREE(target_mask);
+  if (sum == 0) {
+    printf("No state matched\n");
+  }
+  failures += test_large_table();
+  failures += test_policy_domains();
+  failures += test_many_zones();
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
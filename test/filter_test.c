@@ -0,0 +1,127 @@
+/**
+ * Compare how many periods the fixed and adaptive Kalman filters take to
+ * converge after a step change in a noisy synthetic workload.
+ * Includes poet.c directly to run the filter on its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+#define NUM_PERIODS 600
+#define STEP_PERIOD 300
+#define BASE_BEFORE 10.0
+#define BASE_AFTER 20.0
+// relative error of a converged estimate
+#define CONVERGED 0.05
+
+static const char* CONTROL_CONFIG = "../config/default/control_config";
+
+typedef struct {
+  int periods;
+  double steady_error;
+} filter_result;
+
+// deterministic uniform noise in [-amplitude, amplitude]
+static double get_noise(unsigned int* seed, double amplitude) {
+  *seed = *seed * 1103515245 + 12345;
+  return amplitude * (((*seed >> 8) & 0xFFFF) / 32767.5 - 1.0);
+}
+
+static filter_result run_filter(const poet_filter_params* params, double amplitude) {
+  static const double SPEEDUPS[] = {1.0, 1.5, 2.0};
+  unsigned int seed = 1;
+  unsigned int t;
+  double base;
+  double speedup;
+  double error;
+  filter_state fs;
+  filter_noise noise;
+  filter_result result;
+
+  fs.x_hat_minus = X_HAT_MINUS_START;
+  fs.x_hat = X_HAT_START;
+  fs.p_minus = P_MINUS_START;
+  fs.h = H_START;
+  fs.k = K_START;
+  fs.p = P_START;
+  noise.params = *params;
+  reset_filter_noise(&noise);
+
+  result.periods = -1;
+  result.steady_error = 0;
+  for (t = 0; t < NUM_PERIODS; t++) {
+    base = t < STEP_PERIOD ? BASE_BEFORE : BASE_AFTER;
+    // the speedup the controller applied varies from period to period
+    speedup = SPEEDUPS[t % 3];
+    estimate_base_workload(CONST(base * speedup * (1.0 + get_noise(&seed, amplitude))),
+                           CONST(speedup), &noise, &fs);
+    error = real_to_db(fs.x_hat) / base - 1.0;
+    error = error < 0 ? -error : error;
+    if (t < STEP_PERIOD && t >= STEP_PERIOD - 100) {
+      result.steady_error += error / 100;
+    } else if (t >= STEP_PERIOD && result.periods < 0 && error < CONVERGED) {
+      result.periods = (int) (t - STEP_PERIOD);
+    }
+  }
+  return result;
+}
+
+int main(void) {
+  static const double AMPLITUDES[] = {0.0, 0.035, 0.17};
+  unsigned int i;
+  int failures = 0;
+  poet_filter_params fixed = {Q, R, 0};
+  poet_filter_params adaptive = {Q, R, 1};
+  unsigned int nstates;
+  filter_result f;
+  filter_result a;
+  poet_filter_params params;
+  poet_control_state_t* cstates;
+  poet_state* state;
+
+  printf("%10s %15s %18s %15s %18s\n", "NOISE", "FIXED_PERIODS", "FIXED_STEADY_ERR",
+         "ADAPT_PERIODS", "ADAPT_STEADY_ERR");
+  for (i = 0; i < sizeof(AMPLITUDES) / sizeof(AMPLITUDES[0]); i++) {
+    f = run_filter(&fixed, AMPLITUDES[i]);
+    a = run_filter(&adaptive, AMPLITUDES[i]);
+    printf("%9.1f%% %15d %18f %15d %18f\n", AMPLITUDES[i] * 100, f.periods,
+           f.steady_error, a.periods, a.steady_error);
+    if (a.periods < 0 || f.periods < 0 || a.periods > f.periods) {
+      fprintf(stderr, "Adaptive filter did not converge faster\n");
+      failures++;
+    }
+  }
+
+  // parameters are per filter and validated
+  if (get_control_states(CONTROL_CONFIG, &cstates, &nstates)) {
+    return 1;
+  }
+  state = poet_init(CONST(1.0), PERFORMANCE, nstates, cstates, NULL, NULL, NULL, 1, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  poet_get_filter_params(state, POET_FILTER_POWER, &params);
+  if (params.adaptive || poet_set_filter_params(state, POET_FILTER_POWER, &adaptive)) {
+    failures++;
+  }
+  poet_get_filter_params(state, POET_FILTER_PERFORMANCE, &params);
+  if (params.adaptive) {
+    fprintf(stderr, "Setting the power filter changed the performance filter\n");
+    failures++;
+  }
+  adaptive.r = R_ZERO;
+  if (poet_set_filter_params(state, POET_FILTER_PERFORMANCE, &adaptive) == 0) {
+    fprintf(stderr, "Invalid filter parameters were accepted\n");
+    failures++;
+  }
+  poet_destroy(state);
+  free(cstates);
+
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
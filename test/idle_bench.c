@@ -0,0 +1,151 @@
+/**
+ * Compare the requested idle time with the idle time achieved by idling this
+ * process in-process with idle_process() and by running bard_idle, while
+ * worker threads repeatedly do short sleeps. Also checks that the workers make
+ * (almost) no progress while the process idles.
+ * Workers sleep instead of spinning so that on a single CPU they do not delay
+ * the idling thread itself, and allocate memory so they are sometimes paused
+ * while holding allocator locks.
+ *
+ * Usage: idle_bench [idles_per_duration] [bard_idle_path]
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "poet_config.h"
+
+#define NUM_WORKERS 2
+#define WORKER_SLEEP_NS 20000
+
+static const unsigned long long IDLE_NS[] = {100000, 500000, 1000000, 5000000};
+#define NUM_IDLE_NS (sizeof(IDLE_NS) / sizeof(IDLE_NS[0]))
+
+static volatile int running = 1;
+static uint64_t progress[NUM_WORKERS];
+
+static inline uint64_t get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // must use a const or cast a literal - using a simple literal can overflow!
+  const uint64_t ONE_BILLION = 1000000000;
+  return ts.tv_sec * ONE_BILLION + ts.tv_nsec;
+}
+
+static void* worker(void* arg) {
+  uint64_t* count = (uint64_t*) arg;
+  struct timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = WORKER_SLEEP_NS;
+  void* mem;
+  while (running) {
+    // interrupted by the idle signal
+    nanosleep(&ts, NULL);
+    // may be paused inside malloc, which must not deadlock the idling thread
+    mem = malloc(64 + (size_t) (*count % 4096));
+    free(mem);
+    __atomic_add_fetch(count, 1, __ATOMIC_RELAXED);
+  }
+  return NULL;
+}
+
+static uint64_t get_progress(void) {
+  uint64_t total = 0;
+  unsigned int i;
+  for (i = 0; i < NUM_WORKERS; i++) {
+    total += __atomic_load_n(&progress[i], __ATOMIC_RELAXED);
+  }
+  return total;
+}
+
+static void sleep_ns(unsigned long long ns) {
+  struct timespec ts;
+  ts.tv_sec = (time_t) (ns / 1000000000ULL);
+  ts.tv_nsec = (long) (ns % 1000000000ULL);
+  while (nanosleep(&ts, &ts));
+}
+
+static unsigned long long idle_external(const char* cmd, unsigned long long ns) {
+  char command[4096];
+  uint64_t start = get_time();
+  snprintf(command, sizeof(command), "%s %llu %ld", cmd, ns, (long) getpid());
+  if (system(command)) {
+    fprintf(stderr, "Failed to run: %s\n", command);
+  }
+  return get_time() - start;
+}
+
+int main(int argc, char** argv) {
+  unsigned int reps = argc > 1 ? (unsigned int) atoi(argv[1]) : 100;
+  const char* cmd = argc > 2 ? argv[2] : NULL;
+  pthread_t threads[NUM_WORKERS];
+  unsigned long long achieved;
+  double in_process_ns;
+  double external_ns;
+  double idle_progress;
+  double sleep_progress;
+  uint64_t before;
+  unsigned int i;
+  unsigned int j;
+  int failures = 0;
+
+  if (reps == 0) {
+    fprintf(stderr, "Usage: %s [idles_per_duration] [bard_idle_path]\n", argv[0]);
+    return 1;
+  }
+  for (i = 0; i < NUM_WORKERS; i++) {
+    if (pthread_create(&threads[i], NULL, worker, &progress[i])) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+
+  printf("%12s %14s %14s %14s %12s\n", "REQUESTED_NS", "IN_PROCESS_NS",
+         "BARD_IDLE_NS", "WORK_IDLING", "WORK_AWAKE");
+  for (i = 0; i < NUM_IDLE_NS; i++) {
+    in_process_ns = 0;
+    external_ns = 0;
+    idle_progress = 0;
+    sleep_progress = 0;
+    for (j = 0; j < reps; j++) {
+      before = get_progress();
+      if (idle_process(IDLE_NS[i], &achieved)) {
+        perror("idle_process");
+        failures++;
+      }
+      idle_progress += (double) (get_progress() - before);
+      in_process_ns += (double) achieved;
+      if (achieved < IDLE_NS[i]) {
+        fprintf(stderr, "Idled %llu ns of %llu ns\n", achieved, IDLE_NS[i]);
+        failures++;
+      }
+      // workers run while only this thread sleeps
+      before = get_progress();
+      sleep_ns(IDLE_NS[i]);
+      sleep_progress += (double) (get_progress() - before);
+      if (cmd != NULL) {
+        achieved = idle_external(cmd, IDLE_NS[i]);
+        external_ns += (double) achieved;
+      }
+    }
+    printf("%12llu %14.0f %14.0f %14.0f %12.0f\n", IDLE_NS[i], in_process_ns / reps,
+           external_ns / reps, idle_progress / reps, sleep_progress / reps);
+    // with short idles, the workers may run a bit before they are paused
+    if (IDLE_NS[i] >= 1000000 && idle_progress * 4 > sleep_progress) {
+      fprintf(stderr, "Workers were not paused while idling\n");
+      failures++;
+    }
+  }
+
+  running = 0;
+  for (i = 0; i < NUM_WORKERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * Verify that cooperative idling assigns the controller's idle time to each
+ * worker thread instead of passing it to the apply function.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "poet.h"
+#include "poet_config.h"
+#include "poet_math.h"
+
+#define NUM_THREADS 4
+#define ITERATIONS 50
+
+// an idle state at id 0, partnered with id 1
+static const char* CONTROL_CONFIG = "config/control_config_idle";
+
+static unsigned long long applied_idle_ns = 0;
+static unsigned int num_applies = 0;
+static volatile int running = 1;
+
+typedef struct {
+  poet_state* state;
+  unsigned int thread;
+  unsigned long long idle_ns;
+} worker_arg;
+
+static void apply(void* states, unsigned int num_states, unsigned int id,
+                  unsigned int last_id, unsigned long long idle_ns,
+                  unsigned int is_first_apply) {
+  (void) states;
+  (void) num_states;
+  (void) id;
+  (void) last_id;
+  (void) is_first_apply;
+  applied_idle_ns += idle_ns;
+  num_applies++;
+}
+
+static void* worker(void* arg) {
+  worker_arg* w = (worker_arg*) arg;
+  struct timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = 100000;
+  while (running) {
+    w->idle_ns += poet_idle_point(w->state, w->thread);
+    nanosleep(&ts, NULL);
+  }
+  return NULL;
+}
+
+// performance far above the goal makes the controller idle
+static void run_control(poet_state* state) {
+  unsigned long i;
+  struct timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = 1000000;
+  for (i = 0; i < ITERATIONS; i++) {
+    poet_apply_control(state, i, CONST(10000.0), CONST(1.0));
+    nanosleep(&ts, NULL);
+  }
+}
+
+int main(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  pthread_t threads[NUM_THREADS];
+  worker_arg args[NUM_THREADS];
+  poet_state* state;
+  unsigned long long idle_ns;
+  unsigned int i;
+  int failures = 0;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+
+  // the apply function idles the process by default
+  state = poet_init(CONST(1000.0), PERFORMANCE, nstates, states, NULL, apply,
+                    NULL, 1, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  run_control(state);
+  if (applied_idle_ns == 0) {
+    fprintf(stderr, "The controller never idled\n");
+    failures++;
+  }
+  printf("apply: %llu ns idle in %u applies\n", applied_idle_ns, num_applies);
+  poet_destroy(state);
+
+  // idle time is taken once by each thread
+  applied_idle_ns = 0;
+  state = poet_init(CONST(1000.0), PERFORMANCE, nstates, states, NULL, apply,
+                    NULL, 1, 0, NULL);
+  if (state == NULL || poet_set_idle_threads(state, 2)) {
+    perror("poet_set_idle_threads");
+    return 1;
+  }
+  for (i = 0; i < ITERATIONS && poet_take_idle_ns(state, 1) == 0; i++) {
+    poet_apply_control(state, i, CONST(10000.0), CONST(1.0));
+  }
+  idle_ns = poet_take_idle_ns(state, 0);
+  if (idle_ns == 0 || poet_take_idle_ns(state, 0) != 0 || poet_take_idle_ns(state, 1) != 0) {
+    fprintf(stderr, "Idle time was not assigned to each thread once\n");
+    failures++;
+  }
+  if (poet_take_idle_ns(state, 2) != 0 || poet_take_idle_ns(NULL, 0) != 0) {
+    fprintf(stderr, "Idle time was taken by an unknown thread\n");
+    failures++;
+  }
+  poet_destroy(state);
+
+  // worker threads idle instead of the apply function
+  state = poet_init(CONST(1000.0), PERFORMANCE, nstates, states, NULL, apply,
+                    NULL, 1, 0, NULL);
+  if (state == NULL || poet_set_idle_threads(state, NUM_THREADS)) {
+    perror("poet_set_idle_threads");
+    return 1;
+  }
+  for (i = 0; i < NUM_THREADS; i++) {
+    args[i].state = state;
+    args[i].thread = i;
+    args[i].idle_ns = 0;
+    if (pthread_create(&threads[i], NULL, worker, &args[i])) {
+      perror("pthread_create");
+      return 1;
+    }
+  }
+  run_control(state);
+  running = 0;
+  for (i = 0; i < NUM_THREADS; i++) {
+    pthread_join(threads[i], NULL);
+    printf("thread %u: %llu ns idle\n", i, args[i].idle_ns);
+    if (args[i].idle_ns == 0) {
+      fprintf(stderr, "Thread %u never idled\n", i);
+      failures++;
+    }
+  }
+  if (applied_idle_ns != 0) {
+    fprintf(stderr, "Apply function was asked to idle %llu ns\n", applied_idle_ns);
+    failures++;
+  }
+  poet_destroy(state);
+  free(states);
+
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * Verify that the log writer thread writes every record in order, including
+ * records still queued when poet_destroy() is called, that binary logs
+ * decode to the same text as text logs, that records are zeroed before they
+ * are filled, and that a writer stuck on a slow file only delays the
+ * controller for a bounded time.
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "poet.h"
+#include "poet_config.h"
+#include "poet_math.h"
+#include "../src/poet_log.h"
+
+#define PERIOD 2
+#define BUFFER_DEPTH 8
+// not a multiple of BUFFER_DEPTH, so the last buffer is partially filled
+#define NUM_RECORDS 1001
+// records dropped by the stuck writer before giving up on it
+#define NUM_DROPS 3
+
+static const char* CONTROL_CONFIG = "../config/default/control_config";
+
+static int make_temp_file(char* filename) {
+  int fd = mkstemp(filename);
+  if (fd < 0) {
+    perror("mkstemp");
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+static int write_log(const char* log_filename, int binary) {
+  unsigned int nstates;
+  unsigned long i;
+  unsigned long long stalls;
+  unsigned long long dropped;
+  poet_control_state_t* cstates;
+  poet_state* state;
+
+  if (get_control_states(CONTROL_CONFIG, &cstates, &nstates)) {
+    return -1;
+  }
+  if (binary) {
+    setenv(POET_LOG_BINARY, "1", 1);
+  } else {
+    unsetenv(POET_LOG_BINARY);
+  }
+  state = poet_init(CONST(1.0), PERFORMANCE, nstates, cstates, NULL, NULL, NULL,
+                    PERIOD, BUFFER_DEPTH, log_filename);
+  if (state == NULL) {
+    perror("poet_init");
+    return -1;
+  }
+  // one record per period
+  for (i = 0; i < NUM_RECORDS * PERIOD; i++) {
+    poet_apply_control(state, i, CONST(1.0 + (i % 5) * 0.1), CONST(1.0));
+  }
+  poet_get_log_stats(state, &stalls, &dropped);
+  poet_destroy(state);
+  free(cstates);
+  printf("%llu stalls waiting for the log writer\n", stalls);
+  if (dropped) {
+    fprintf(stderr, "%llu records dropped\n", dropped);
+    return -1;
+  }
+  return 0;
+}
+
+static inline unsigned long long get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+// a pipe nobody reads blocks the writer thread once the pipe is full
+static int test_stuck_writer(void) {
+  int fds[2];
+  FILE* file;
+  poet_log_writer* writer;
+  poet_record* record;
+  unsigned long long start;
+  unsigned long long longest = 0;
+  unsigned long long stalls;
+  unsigned long long dropped = 0;
+  unsigned long i;
+  int ret = 0;
+
+  if (pipe(fds)) {
+    perror("pipe");
+    return -1;
+  }
+  // the writer's last writes fail once the read end is closed
+  signal(SIGPIPE, SIG_IGN);
+  file = fdopen(fds[1], "w");
+  writer = file == NULL ? NULL : poet_log_writer_create(file, 2, 0);
+  if (writer == NULL) {
+    perror("poet_log_writer_create");
+    return -1;
+  }
+  for (i = 0; i < 1000000 && dropped < NUM_DROPS; i++) {
+    start = get_time();
+    record = poet_log_writer_next(writer);
+    if (record != NULL) {
+      memset(record, 0, sizeof(poet_record));
+      record->tag = i;
+      poet_log_writer_commit(writer);
+    }
+    if (get_time() - start > longest) {
+      longest = get_time() - start;
+    }
+    poet_log_writer_get_stats(writer, &stalls, &dropped);
+  }
+  printf("stuck writer: %llu stalls, %llu dropped, longest wait %llu ns\n",
+         stalls, dropped, longest);
+  if (dropped < NUM_DROPS || stalls < dropped) {
+    fprintf(stderr, "Records were not dropped while the writer was stuck\n");
+    ret = -1;
+  }
+  // the wait is bounded by 10 ms, with plenty of slack for busy machines
+  if (longest > 1000000000ULL) {
+    fprintf(stderr, "Waited %llu ns for the stuck writer\n", longest);
+    ret = -1;
+  }
+  close(fds[0]);
+  poet_log_writer_destroy(writer);
+  fclose(file);
+  return ret;
+}
+
+// binary logs write whole records, so a reused slot must not keep old bytes
+static int test_zeroed_records(void) {
+  FILE* file = tmpfile();
+  poet_log_writer* writer = file == NULL ? NULL : poet_log_writer_create(file, 2, 1);
+  poet_record* record;
+  const unsigned char* bytes;
+  size_t i;
+  int ret = 0;
+  if (writer == NULL) {
+    perror("poet_log_writer_create");
+    return -1;
+  }
+  record = poet_log_writer_next(writer);
+  memset(record, 0xAA, sizeof(poet_record));
+  // not committed, so this is the same slot
+  bytes = (const unsigned char*) poet_log_writer_next(writer);
+  for (i = 0; i < sizeof(poet_record); i++) {
+    if (bytes[i] != 0) {
+      fprintf(stderr, "Record byte %zu was not zeroed\n", i);
+      ret = -1;
+      break;
+    }
+  }
+  poet_log_writer_destroy(writer);
+  fclose(file);
+  return ret;
+}
+
+static int check_text_log(const char* log_filename) {
+  char line[1024];
+  unsigned long tag;
+  unsigned long expected = 0;
+  FILE* f = fopen(log_filename, "r");
+  if (f == NULL) {
+    perror(log_filename);
+    return -1;
+  }
+  // skip header
+  if (fgets(line, sizeof(line), f) == NULL) {
+    fprintf(stderr, "Empty log\n");
+    fclose(f);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    tag = strtoul(line, NULL, 10);
+    // the first decision is made on the second iteration
+    if (tag != expected * PERIOD + PERIOD - 1) {
+      fprintf(stderr, "Record %lu: unexpected tag %lu\n", expected, tag);
+      fclose(f);
+      return -1;
+    }
+    expected++;
+  }
+  fclose(f);
+  printf("%lu records logged\n", expected);
+  if (expected != NUM_RECORDS) {
+    fprintf(stderr, "Expected %d records\n", NUM_RECORDS);
+    return -1;
+  }
+  return 0;
+}
+
+// decode the binary log to text, like bard_logdump
+static int decode_binary_log(const char* binary_filename, const char* text_filename) {
+  poet_log_header header;
+  poet_control_state_t* states;
+  poet_record record;
+  FILE* in = fopen(binary_filename, "rb");
+  FILE* out = fopen(text_filename, "w");
+  if (in == NULL || out == NULL) {
+    perror("fopen");
+    return -1;
+  }
+  if (poet_log_read_binary_header(in, &header, &states)) {
+    return -1;
+  }
+  if (header.period != PERIOD) {
+    fprintf(stderr, "Binary log header has period %u\n", header.period);
+    return -1;
+  }
+  poet_log_write_text_header(out, 0);
+  while (fread(&record, sizeof(record), 1, in) == 1) {
+    poet_log_write_text_record(out, &record, 0);
+  }
+  free(states);
+  fclose(in);
+  fclose(out);
+  return 0;
+}
+
+static int compare_files(const char* a, const char* b) {
+  int ca;
+  int cb;
+  FILE* fa = fopen(a, "r");
+  FILE* fb = fopen(b, "r");
+  if (fa == NULL || fb == NULL) {
+    perror("fopen");
+    return -1;
+  }
+  do {
+    ca = fgetc(fa);
+    cb = fgetc(fb);
+  } while (ca == cb && ca != EOF);
+  fclose(fa);
+  fclose(fb);
+  if (ca != cb) {
+    fprintf(stderr, "Decoded binary log differs from text log\n");
+    return -1;
+  }
+  return 0;
+}
+
+int main(void) {
+  char text_log[] = "/tmp/bard_log_test_XXXXXX";
+  char binary_log[] = "/tmp/bard_log_test_XXXXXX";
+  char decoded_log[] = "/tmp/bard_log_test_XXXXXX";
+  int ret = 0;
+
+  if (make_temp_file(text_log) || make_temp_file(binary_log) ||
+      make_temp_file(decoded_log)) {
+    return 1;
+  }
+  if (write_log(text_log, 0) || check_text_log(text_log) ||
+      write_log(binary_log, 1) || decode_binary_log(binary_log, decoded_log) ||
+      compare_files(text_log, decoded_log) || test_zeroed_records() ||
+      test_stuck_writer()) {
+    ret = 1;
+  }
+  unlink(text_log);
+  unlink(binary_log);
+  unlink(decoded_log);
+  return ret;
+}
@@ -0,0 +1,218 @@
+/**
+ * Verify that work and energy recorded concurrently by many producer threads
+ * is aggregated exactly once by concurrent control steps, and compare the
+ * cost of recording work with funneling every completion through a mutex.
+ * Also checks steps whose producers report no energy.
+ * Includes poet.c directly to check the aggregated totals.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+#define NUM_PRODUCERS 8
+#define NUM_STEPPERS 2
+#define ITERATIONS 1000000
+#define ENERGY_UJ 3
+
+// states with equal cost per unit of speedup
+static const char* CONTROL_CONFIG = "config/control_config_linear";
+
+static poet_state* state;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int producing;
+static unsigned long long num_steps[NUM_STEPPERS];
+
+typedef struct {
+  unsigned int producer;
+  double ns_per_call;
+} producer_arg;
+
+static void apply(void* states, unsigned int num_states, unsigned int id,
+                  unsigned int last_id, unsigned long long idle_ns,
+                  unsigned int is_first_apply) {
+  (void) states;
+  (void) num_states;
+  (void) id;
+  (void) last_id;
+  (void) idle_ns;
+  (void) is_first_apply;
+}
+
+static inline unsigned long long get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static void* produce(void* arg) {
+  producer_arg* pa = (producer_arg*) arg;
+  unsigned long long start = get_time();
+  unsigned int i;
+  for (i = 0; i < ITERATIONS; i++) {
+    poet_produce(state, pa->producer, 1, ENERGY_UJ);
+  }
+  pa->ns_per_call = (double) (get_time() - start) / ITERATIONS;
+  return NULL;
+}
+
+// the single call site that multithreaded applications needed before; no work
+// is produced, so the steppers never run the controller at the same time
+static void* produce_locked(void* arg) {
+  producer_arg* pa = (producer_arg*) arg;
+  unsigned long long start = get_time();
+  unsigned int i;
+  for (i = 0; i < ITERATIONS / 10; i++) {
+    pthread_mutex_lock(&mutex);
+    poet_apply_control(state, i, CONST(10.0), CONST(1.0));
+    pthread_mutex_unlock(&mutex);
+  }
+  pa->ns_per_call = (double) (get_time() - start) / (ITERATIONS / 10);
+  return NULL;
+}
+
+static void* step(void* arg) {
+  unsigned long long* steps = (unsigned long long*) arg;
+  unsigned long id = 0;
+  while (producing) {
+    *steps += (unsigned long long) poet_control_step(state, id++);
+  }
+  return NULL;
+}
+
+static double run(void* (*producer_func)(void*)) {
+  pthread_t producers[NUM_PRODUCERS];
+  pthread_t steppers[NUM_STEPPERS];
+  producer_arg args[NUM_PRODUCERS];
+  double ns = 0.0;
+  unsigned int i;
+
+  producing = 1;
+  for (i = 0; i < NUM_STEPPERS; i++) {
+    pthread_create(&steppers[i], NULL, step, &num_steps[i]);
+  }
+  for (i = 0; i < NUM_PRODUCERS; i++) {
+    args[i].producer = i;
+    pthread_create(&producers[i], NULL, producer_func, &args[i]);
+  }
+  for (i = 0; i < NUM_PRODUCERS; i++) {
+    pthread_join(producers[i], NULL);
+    ns += args[i].ns_per_call / NUM_PRODUCERS;
+  }
+  producing = 0;
+  for (i = 0; i < NUM_STEPPERS; i++) {
+    pthread_join(steppers[i], NULL);
+  }
+  return ns;
+}
+
+static void sleep_ms(long ms) {
+  struct timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = ms * 1000000;
+  nanosleep(&ts, NULL);
+}
+
+// producers that never report energy still run the controller, while a step
+// without energy after producers reported some is carried over
+static int test_energy(void) {
+  int failures = 0;
+  if (poet_set_producers(state, 1)) {
+    perror("poet_set_producers");
+    return 1;
+  }
+  poet_produce(state, 0, 10, 0);
+  sleep_ms(1);
+  if (poet_control_step(state, 0) != 1) {
+    fprintf(stderr, "Work without energy did not run the controller\n");
+    failures++;
+  }
+  poet_produce(state, 0, 10, 1000);
+  sleep_ms(1);
+  poet_control_step(state, 1);
+  poet_produce(state, 0, 10, 0);
+  sleep_ms(1);
+  if (poet_control_step(state, 2) != 0 || state->producer_pending_work != 10) {
+    fprintf(stderr, "A step without energy was not carried over\n");
+    failures++;
+  }
+  poet_produce(state, 0, 10, 1000);
+  if (poet_control_step(state, 3) != 1 || state->producer_pending_work != 0) {
+    fprintf(stderr, "A carried over step was not controlled\n");
+    failures++;
+  }
+  return failures;
+}
+
+int main(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  unsigned long long work = 0;
+  unsigned long long energy_uj = 0;
+  double ns_produce;
+  double ns_locked;
+  unsigned int i;
+  int failures = 0;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  state = poet_init(CONST(10.0), PERFORMANCE, nstates, states, NULL, apply, NULL,
+                    1, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  if (poet_control_step(state, 0) != 0) {
+    fprintf(stderr, "Stepped without producers\n");
+    failures++;
+  }
+  if (poet_set_producers(state, NUM_PRODUCERS)) {
+    perror("poet_set_producers");
+    return 1;
+  }
+  if (((size_t) state->producer_slots) % PRODUCER_SLOT_SIZE != 0) {
+    fprintf(stderr, "Producer slots are not cache line aligned\n");
+    failures++;
+  }
+
+  ns_produce = run(produce);
+  // the last step aggregates what the others missed
+  num_steps[0] += (unsigned long long) poet_control_step(state, 0);
+  for (i = 0; i < NUM_PRODUCERS; i++) {
+    work += state->producer_seen[2 * i];
+    energy_uj += state->producer_seen[2 * i + 1];
+  }
+  if (work != (unsigned long long) NUM_PRODUCERS * ITERATIONS ||
+      energy_uj != (unsigned long long) NUM_PRODUCERS * ITERATIONS * ENERGY_UJ) {
+    fprintf(stderr, "Expected %llu work and %llu uJ, aggregated %llu work and %llu uJ\n",
+            (unsigned long long) NUM_PRODUCERS * ITERATIONS,
+            (unsigned long long) NUM_PRODUCERS * ITERATIONS * ENERGY_UJ, work, energy_uj);
+    failures++;
+  }
+  if (num_steps[0] + num_steps[1] == 0) {
+    fprintf(stderr, "The controller never stepped\n");
+    failures++;
+  }
+  // out of range producers are ignored
+  poet_produce(state, NUM_PRODUCERS, 1, 1);
+
+  ns_locked = run(produce_locked);
+  printf("%d producers: %.1f ns per poet_produce(), %.1f ns per mutex-protected "
+         "poet_apply_control(), %llu steps\n", NUM_PRODUCERS, ns_produce, ns_locked,
+         num_steps[0] + num_steps[1]);
+
+  failures += test_energy();
+  if (poet_set_producers(state, 0) || poet_control_step(state, 0) != 0) {
+    fprintf(stderr, "Producers were not disabled\n");
+    failures++;
+  }
+  poet_destroy(state);
+  free(states);
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
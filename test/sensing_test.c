@@ -0,0 +1,333 @@
+/**
+ * Verify that the heartbeat window measures rate and power, that beats take
+ * the same time with any window size, that RAPL energy counters are summed
+ * across packages and wraparounds on a fake sysfs tree, and that
+ * poet_heartbeat() runs the controller, also without an energy counter, with
+ * one that stalls, and at rates beyond the fixed point range.
+ * Includes poet.c directly to also test the sensor on its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+#define PERIOD 5
+#define BEAT_NS 1000000
+// energy used per call of the fake counter
+#define BEAT_UJ 250000ULL
+// calls between updates of the stalling fake counter, longer than the window
+#define STALL_READS (3 * PERIOD)
+
+// states with equal cost per unit of speedup
+static const char* CONTROL_CONFIG = "config/control_config_linear";
+
+static unsigned long long energy_uj = 0;
+static unsigned int num_reads = 0;
+static unsigned int num_applies = 0;
+
+static unsigned long long read_energy(void* arg) {
+  (void) arg;
+  energy_uj += BEAT_UJ;
+  return energy_uj;
+}
+
+// like a counter that updates less often than the heart beats
+static unsigned long long read_stalled_energy(void* arg) {
+  (void) arg;
+  num_reads++;
+  return num_reads / STALL_READS * STALL_READS * BEAT_UJ;
+}
+
+static inline unsigned long long get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static void sleep_ns(long ns) {
+  struct timespec ts;
+  ts.tv_sec = 0;
+  ts.tv_nsec = ns;
+  nanosleep(&ts, NULL);
+}
+
+static void apply(void* states, unsigned int num_states, unsigned int id,
+                  unsigned int last_id, unsigned long long idle_ns,
+                  unsigned int is_first_apply) {
+  (void) states;
+  (void) num_states;
+  (void) id;
+  (void) last_id;
+  (void) idle_ns;
+  (void) is_first_apply;
+  num_applies++;
+}
+
+static int test_window(void) {
+  double perf;
+  double pwr;
+  unsigned int i;
+  int failures = 0;
+  poet_sensor* sensor = poet_sensor_create(4, read_energy, NULL);
+  if (sensor == NULL || poet_sensor_create(0, NULL, NULL) != NULL) {
+    fprintf(stderr, "Sensor created with an empty window\n");
+    return 1;
+  }
+  for (i = 0; i < 10; i++) {
+    sleep_ns(BEAT_NS);
+    poet_sensor_beat(sensor, &perf, &pwr);
+    // each beat uses the same energy, so power is the rate times the energy
+    if (pwr < perf * 0.249999 || pwr > perf * 0.250001) {
+      fprintf(stderr, "Beat %u: %f beats/s should use %f W, got %f W\n", i, perf,
+              perf * 0.25, pwr);
+      failures++;
+    }
+  }
+  printf("window: %.0f beats/s, %.1f W\n", perf, pwr);
+  // sleeps may take longer, but never shorter
+  if (perf > 1000000000.0 / BEAT_NS || perf < 10.0) {
+    fprintf(stderr, "Rate %f beats/s does not match one beat every %d ns\n", perf, BEAT_NS);
+    failures++;
+  }
+  poet_sensor_destroy(sensor);
+  return failures;
+}
+
+// time beats with a small and a large window
+static void bench_window(void) {
+  static const unsigned int WINDOWS[] = {10, 100000};
+  double perf;
+  double pwr;
+  unsigned long long start;
+  unsigned int w;
+  unsigned int i;
+  poet_sensor* sensor;
+  for (w = 0; w < 2; w++) {
+    sensor = poet_sensor_create(WINDOWS[w], NULL, NULL);
+    if (sensor == NULL) {
+      return;
+    }
+    start = get_time();
+    for (i = 0; i < 200000; i++) {
+      poet_sensor_beat(sensor, &perf, &pwr);
+    }
+    printf("window of %u beats: %.0f ns per beat\n", WINDOWS[w],
+           (double) (get_time() - start) / 200000);
+    poet_sensor_destroy(sensor);
+  }
+}
+
+static int write_file(const char* dir, const char* file, const char* value) {
+  char path[4096];
+  FILE* f;
+  snprintf(path, sizeof(path), "%s/%s", dir, file);
+  f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  fputs(value, f);
+  fclose(f);
+  return 0;
+}
+
+static int make_zone(const char* root, const char* zone, const char* energy) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/class/powercap/%s", root, zone);
+  if (mkdir(path, 0755)) {
+    perror(path);
+    return -1;
+  }
+  return write_file(path, "energy_uj", energy) ||
+         write_file(path, "max_energy_range_uj", "1000000\n") ? -1 : 0;
+}
+
+static int test_rapl(void) {
+  char root[] = "/tmp/bard_powercap_XXXXXX";
+  char path[4096];
+  poet_rapl_energy* rapl;
+  unsigned long long energy;
+  int failures = 0;
+
+  if (mkdtemp(root) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+  snprintf(path, sizeof(path), "%s/class", root);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/class/powercap", root);
+  mkdir(path, 0755);
+  if (rapl_energy_init(root) != NULL) {
+    fprintf(stderr, "RAPL energy read without packages\n");
+    failures++;
+  }
+  // subzones are part of their package
+  if (make_zone(root, "intel-rapl:0", "900000\n") || make_zone(root, "intel-rapl:1", "100\n") ||
+      make_zone(root, "intel-rapl:0:0", "5\n")) {
+    return 1;
+  }
+  // a package whose range is unknown
+  snprintf(path, sizeof(path), "%s/class/powercap/intel-rapl:2", root);
+  if (mkdir(path, 0755) || write_file(path, "energy_uj", "500\n")) {
+    perror(path);
+    return 1;
+  }
+  rapl = rapl_energy_init(root);
+  if (rapl == NULL) {
+    perror("rapl_energy_init");
+    return 1;
+  }
+  if (rapl_energy_read(rapl) != 0) {
+    fprintf(stderr, "Energy was used before reading\n");
+    failures++;
+  }
+  // package 0 wraps after 1000000 uJ
+  snprintf(path, sizeof(path), "%s/class/powercap/intel-rapl:0", root);
+  write_file(path, "energy_uj", "50000\n");
+  snprintf(path, sizeof(path), "%s/class/powercap/intel-rapl:1", root);
+  write_file(path, "energy_uj", "300\n");
+  // wrapping without a known range drops that package's energy
+  snprintf(path, sizeof(path), "%s/class/powercap/intel-rapl:2", root);
+  write_file(path, "energy_uj", "100\n");
+  energy = rapl_energy_read(rapl);
+  if (energy != 150001 + 200) {
+    fprintf(stderr, "Expected 150201 uJ, got %llu uJ\n", energy);
+    failures++;
+  }
+  write_file(path, "energy_uj", "400\n");
+  energy = rapl_energy_read(rapl);
+  if (energy != 150201 + 300) {
+    fprintf(stderr, "Expected 150501 uJ, got %llu uJ\n", energy);
+    failures++;
+  }
+  rapl_energy_destroy(rapl);
+  snprintf(path, sizeof(path), "rm -rf %s", root);
+  if (system(path)) {
+    fprintf(stderr, "Failed to remove %s\n", root);
+  }
+  return failures;
+}
+
+static int test_heartbeat(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  poet_state* state;
+  unsigned int i;
+  int failures = 0;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  // far below the heart rate, so the controller slows down
+  state = poet_init(CONST(10.0), PERFORMANCE, nstates, states, NULL, apply, NULL,
+                    PERIOD, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  // nothing happens without sensing
+  poet_heartbeat(state, 0);
+  if (poet_set_sensing(state, PERIOD, read_energy, NULL)) {
+    perror("poet_set_sensing");
+    return 1;
+  }
+  for (i = 0; i < 10 * PERIOD; i++) {
+    sleep_ns(BEAT_NS);
+    poet_heartbeat(state, i);
+  }
+  if (num_applies == 0) {
+    fprintf(stderr, "Heartbeats did not run the controller\n");
+    failures++;
+  }
+  if (poet_set_sensing(state, 0, NULL, NULL) || state->sensor != NULL) {
+    fprintf(stderr, "Sensing was not disabled\n");
+    failures++;
+  }
+  poet_destroy(state);
+  free(states);
+  return failures;
+}
+
+// without an energy counter, and at rates beyond the fixed point range
+static int test_heartbeat_without_energy(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  poet_state* state;
+  unsigned int applies;
+  unsigned int i;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  state = poet_init(CONST(10.0), PERFORMANCE, nstates, states, NULL, apply, NULL,
+                    PERIOD, 0, NULL);
+  if (state == NULL || poet_set_sensing(state, 4 * PERIOD, NULL, NULL)) {
+    perror("poet_init");
+    return 1;
+  }
+  applies = num_applies;
+  for (i = 0; i < 10 * PERIOD; i++) {
+    sleep_ns(BEAT_NS);
+    poet_heartbeat(state, i);
+  }
+  for (i = 0; i < 100000; i++) {
+    poet_heartbeat(state, i);
+  }
+  poet_destroy(state);
+  free(states);
+  if (num_applies == applies) {
+    fprintf(stderr, "Heartbeats without energy did not run the controller\n");
+    return 1;
+  }
+  return 0;
+}
+
+// beats over which the energy counter did not advance still follow the schedule
+static int test_heartbeat_stalled_energy(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  poet_state* state;
+  unsigned int applies;
+  unsigned int i;
+  int failures = 0;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  state = poet_init(CONST(10.0), PERFORMANCE, nstates, states, NULL, apply, NULL,
+                    PERIOD, 0, NULL);
+  if (state == NULL || poet_set_sensing(state, PERIOD, read_stalled_energy, NULL)) {
+    perror("poet_init");
+    return 1;
+  }
+  applies = num_applies;
+  for (i = 0; i < 10 * PERIOD + 2; i++) {
+    sleep_ns(BEAT_NS);
+    poet_heartbeat(state, i);
+    if ((unsigned int) state->current_action != (CURRENT_ACTION_START + i + 1) % PERIOD) {
+      fprintf(stderr, "Beat %u left the schedule at action %d\n", i, state->current_action);
+      failures++;
+      break;
+    }
+  }
+  if (num_applies == applies) {
+    fprintf(stderr, "Heartbeats with a stalled energy counter did not run the controller\n");
+    failures++;
+  }
+  poet_destroy(state);
+  free(states);
+  return failures;
+}
+
+int main(void) {
+  int failures = test_window() + test_rapl() + test_heartbeat() +
+                 test_heartbeat_without_energy() + test_heartbeat_stalled_energy();
+  bench_window();
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,140 @@
+/**
+ * Verify that each phase of poet_apply_control() is timed into its histogram
+ * once stats are enabled, and report the time per phase and the overhead of
+ * timing.
+ * Includes poet.c directly, built with POET_STATS.
+ */
+#ifndef POET_STATS
+  #define POET_STATS
+#endif
+#include <stdio.h>
+#include <time.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+#define PERIOD 5
+#define ITERATIONS 200000
+
+// states with equal cost per unit of speedup
+static const char* CONTROL_CONFIG = "config/control_config_linear";
+
+static const char* PHASES[POET_NUM_PHASES] = {
+  "estimate", "xup", "translate", "log", "apply"
+};
+
+static void apply(void* states, unsigned int num_states, unsigned int id,
+                  unsigned int last_id, unsigned long long idle_ns,
+                  unsigned int is_first_apply) {
+  (void) states;
+  (void) num_states;
+  (void) id;
+  (void) last_id;
+  (void) idle_ns;
+  (void) is_first_apply;
+}
+
+static inline unsigned long long get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+// alternate rates so the controller keeps changing states
+static double run(poet_state* state, unsigned int iterations) {
+  unsigned long long start = get_time();
+  unsigned int i;
+  for (i = 0; i < iterations; i++) {
+    poet_apply_control(state, i, CONST((i / 50) % 2 ? 5.0 : 20.0), CONST(1.0));
+  }
+  return (double) (get_time() - start) / iterations;
+}
+
+static int check_phase(const poet_stats* stats, poet_phase phase, unsigned long long expected) {
+  const poet_phase_stats* ps = &stats->phases[phase];
+  unsigned long long sum = 0;
+  unsigned int i;
+  for (i = 0; i < POET_STATS_BUCKETS; i++) {
+    sum += ps->buckets[i];
+  }
+  printf("%-9s %8llu times, %6.1f ns avg, %6.1f ns min, %8.1f ns max\n", PHASES[phase],
+         ps->count, ps->count ? ps->total_ticks * stats->ns_per_tick / ps->count : 0.0,
+         ps->min_ticks * stats->ns_per_tick, ps->max_ticks * stats->ns_per_tick);
+  if (sum != ps->count || ps->min_ticks > ps->max_ticks) {
+    fprintf(stderr, "%s: histogram has %llu of %llu samples\n", PHASES[phase], sum, ps->count);
+    return 1;
+  }
+  if (expected > 0 && ps->count != expected) {
+    fprintf(stderr, "%s: expected %llu samples, got %llu\n", PHASES[phase], expected, ps->count);
+    return 1;
+  }
+  if (expected == 0 && ps->count == 0) {
+    fprintf(stderr, "%s: never timed\n", PHASES[phase]);
+    return 1;
+  }
+  return 0;
+}
+
+int main(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  poet_state* state;
+  poet_stats stats;
+  double ns_off;
+  double ns_on;
+  int failures = 0;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  state = poet_init(CONST(10.0), PERFORMANCE, nstates, states, NULL, apply, NULL,
+                    PERIOD, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  if (poet_get_stats(state, &stats) == 0) {
+    fprintf(stderr, "Got stats before enabling them\n");
+    failures++;
+  }
+
+  ns_off = run(state, ITERATIONS);
+  if (poet_set_stats(state, 1)) {
+    perror("poet_set_stats");
+    return 1;
+  }
+  ns_on = run(state, ITERATIONS);
+  if (poet_get_stats(state, &stats)) {
+    perror("poet_get_stats");
+    return 1;
+  }
+  printf("%.3f ns per tick, %.1f ns per iteration without stats, %.1f ns with stats\n",
+         stats.ns_per_tick, ns_off, ns_on);
+  // the controller runs once per period, but only applies changed states
+  failures += check_phase(&stats, POET_PHASE_ESTIMATE, ITERATIONS / PERIOD);
+  failures += check_phase(&stats, POET_PHASE_XUP, ITERATIONS / PERIOD);
+  failures += check_phase(&stats, POET_PHASE_TRANSLATE, ITERATIONS / PERIOD);
+  failures += check_phase(&stats, POET_PHASE_LOG, ITERATIONS / PERIOD);
+  failures += check_phase(&stats, POET_PHASE_APPLY, 0);
+  if (stats.ns_per_tick <= 0.0) {
+    fprintf(stderr, "Tick rate was not measured\n");
+    failures++;
+  }
+
+  // re-enabling starts over
+  if (poet_set_stats(state, 1) || poet_get_stats(state, &stats) ||
+      stats.phases[POET_PHASE_ESTIMATE].count != 0) {
+    fprintf(stderr, "Stats were not reset\n");
+    failures++;
+  }
+  if (poet_set_stats(state, 0) || poet_get_stats(state, &stats) == 0) {
+    fprintf(stderr, "Stats were not disabled\n");
+    failures++;
+  }
+  poet_destroy(state);
+  free(states);
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
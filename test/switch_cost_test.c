@@ -0,0 +1,139 @@
+/**
+ * Verify that switching costs make translation prefer staying in one state
+ * over a slightly cheaper pair of states, with both the hull and n^2 searches.
+ * Includes poet.c directly to test its static functions.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+#define PERIOD 20
+#define STAY_ID 2
+
+// an idle state at id 0, partnered with id 1; id 2 is not on the convex hull
+static const char* CONTROL_CONFIG = "config/control_config_switch_cost";
+
+static const real_t TARGET = CONST(1.5);
+static const real_t WORKLOAD = CONST(0.01);
+
+static real_t switch_sec = CONST(0.0);
+
+static real_t get_switch_cost(const void* states, unsigned int from_id,
+                              unsigned int to_id) {
+  (void) states;
+  return from_id == to_id ? R_ZERO : switch_sec;
+}
+
+static int check_translation(poet_state* state, int n2, int expect_stay,
+                             const char* name) {
+  state->scs.u = TARGET;
+  if (n2) {
+    translate_n2_with_time(state, WORKLOAD, 0);
+  } else {
+    translate_hull_with_time(state, WORKLOAD, 0);
+  }
+  printf("%-20s %-4s (%d, %d) low_state_iters=%d cost=%f\n", name,
+         n2 ? "n2" : "hull", state->lower_id, state->upper_id,
+         state->low_state_iters, real_to_db(state->cost_estimate));
+  if (expect_stay != (state->lower_id == STAY_ID && state->upper_id == STAY_ID)) {
+    fprintf(stderr, "%s: %s chose (%d, %d)\n", name, n2 ? "n2" : "hull",
+            state->lower_id, state->upper_id);
+    return 1;
+  }
+  return 0;
+}
+
+static int test_translation(void) {
+  poet_control_state_t* states;
+  unsigned int nstates;
+  int failures = 0;
+  int n2;
+  poet_state* state;
+
+  if (get_control_states(CONTROL_CONFIG, &states, &nstates)) {
+    return 1;
+  }
+  state = poet_init(CONST(1.0), PERFORMANCE, nstates, states, NULL, NULL,
+                    NULL, PERIOD, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  for (n2 = 0; n2 <= 1; n2++) {
+    // switching between states 1 and 3 is cheapest when switches are free
+    failures += check_translation(state, n2, 0, "no switch cost");
+    if (poet_set_switch_cost(state, get_switch_cost, NULL)) {
+      perror("poet_set_switch_cost");
+      return 1;
+    }
+    switch_sec = CONST(0.0001);
+    failures += check_translation(state, n2, 0, "small switch cost");
+    // two 10 ms switches per period outweigh the pair's lower cost
+    switch_sec = CONST(0.01);
+    failures += check_translation(state, n2, 1, "large switch cost");
+    poet_set_switch_cost(state, NULL, NULL);
+    failures += check_translation(state, n2, 0, "switch cost removed");
+  }
+  poet_destroy(state);
+  free(states);
+  return failures;
+}
+
+static int check_cpu_switch_cost(const poet_cpu_switch_cost* cost,
+                                 unsigned int from_id,
+                                 unsigned int to_id,
+                                 real_t expected) {
+  real_t sec = get_cpu_switch_cost(cost, from_id, to_id);
+  if (sec < expected || sec > expected) {
+    fprintf(stderr, "Switch from %u to %u: expected %f s, got %f s\n", from_id, to_id,
+            real_to_db(expected), real_to_db(sec));
+    return 1;
+  }
+  return 0;
+}
+
+static int test_cpu_switch_cost(void) {
+  poet_cpu_state_t states[5];
+  poet_cpu_table* table;
+  poet_cpu_switch_cost cost;
+  int failures = 0;
+
+  snprintf(states[0].core_mask, POET_LEN_CORE_MASK, "0x1");
+  snprintf(states[0].freqs, POET_LEN_FREQS, "1000000");
+  snprintf(states[1].core_mask, POET_LEN_CORE_MASK, "0x1");
+  snprintf(states[1].freqs, POET_LEN_FREQS, "2000000");
+  snprintf(states[2].core_mask, POET_LEN_CORE_MASK, "0x3");
+  snprintf(states[2].freqs, POET_LEN_FREQS, "2000000,2000000");
+  // the same state as 2, written differently
+  snprintf(states[3].core_mask, POET_LEN_CORE_MASK, "0x03");
+  snprintf(states[3].freqs, POET_LEN_FREQS, "2000000,2000000,-");
+  snprintf(states[4].core_mask, POET_LEN_CORE_MASK, "0x3");
+  snprintf(states[4].freqs, POET_LEN_FREQS, "1000000,1000000");
+  table = cpu_table_init(states, 5);
+  if (table == NULL) {
+    perror("cpu_table_init");
+    return 1;
+  }
+  cost.table = table;
+  cost.core_switch_sec = CONST(0.001);
+  cost.freq_switch_sec = CONST(0.0001);
+
+  failures += check_cpu_switch_cost(&cost, 0, 0, R_ZERO);
+  failures += check_cpu_switch_cost(&cost, 0, 1, cost.freq_switch_sec);
+  failures += check_cpu_switch_cost(&cost, 2, 3, R_ZERO);
+  // frequencies that don't matter in the new state are not changed
+  failures += check_cpu_switch_cost(&cost, 2, 1, cost.core_switch_sec);
+  failures += check_cpu_switch_cost(&cost, 1, 4, cost.core_switch_sec + cost.freq_switch_sec);
+  cpu_table_destroy(table);
+  return failures;
+}
+
+int main(void) {
+  int failures = test_translation() + test_cpu_switch_cost();
+  if (failures) {
+    fprintf(stderr, "%d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
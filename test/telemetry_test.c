@@ -0,0 +1,139 @@
+/**
+ * Verify that a reader thread only gets complete telemetry records while the
+ * controller is publishing, and that the ring holds the latest records.
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "poet.h"
+#include "poet_config.h"
+#include "poet_math.h"
+#include "../src/poet_telemetry.h"
+
+#define PERIOD 1
+#define NUM_SLOTS 16
+#define NUM_RECORDS 200000
+
+static const char* CONTROL_CONFIG = "../config/default/control_config";
+
+typedef struct {
+  const char* path;
+  volatile int done;
+  unsigned long long read;
+  unsigned long long skipped;
+  int failures;
+} reader_state;
+
+// the performance reported for each iteration, so records can be checked
+static real_t get_perf(unsigned long id) {
+  return int_to_real(id % 1000 + 1);
+}
+
+static void* reader(void* arg) {
+  reader_state* rs = (reader_state*) arg;
+  size_t size;
+  uint64_t next = 0;
+  uint64_t head;
+  real_t expected;
+  poet_record record;
+  const poet_telemetry_header* header = poet_telemetry_open(rs->path, &size);
+  if (header == NULL) {
+    rs->failures++;
+    return NULL;
+  }
+  while (!rs->done) {
+    switch (poet_telemetry_read(header, next, &record)) {
+      case 0:
+        // with a period of 1, record n is for iteration n + 1
+        expected = get_perf(record.tag);
+        if (record.tag != next + 1 ||
+            memcmp(&record.act_rate, &expected, sizeof(expected))) {
+          fprintf(stderr, "Record %llu: torn or wrong record with tag %lu\n",
+                  (unsigned long long) next, record.tag);
+          rs->failures++;
+        }
+        rs->read++;
+        next++;
+        break;
+      case 1:
+        head = poet_telemetry_get_head(header);
+        rs->skipped += head - NUM_SLOTS + 1 - next;
+        next = head - NUM_SLOTS + 1;
+        break;
+      default:
+        break;
+    }
+  }
+  poet_telemetry_close(header, size);
+  return NULL;
+}
+
+int main(void) {
+  char path[] = "/tmp/bard_telemetry_test_XXXXXX";
+  unsigned int nstates;
+  unsigned long i;
+  int fd;
+  size_t size;
+  uint64_t index;
+  poet_record record;
+  pthread_t thread;
+  reader_state rs;
+  poet_control_state_t* cstates;
+  poet_state* state;
+  const poet_telemetry_header* header;
+
+  if (get_control_states(CONTROL_CONFIG, &cstates, &nstates)) {
+    return 1;
+  }
+  fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  close(fd);
+  state = poet_init(CONST(1.0), PERFORMANCE, nstates, cstates, NULL, NULL, NULL,
+                    PERIOD, 0, NULL);
+  if (state == NULL || poet_set_telemetry(state, path, NUM_SLOTS)) {
+    perror("poet_init or poet_set_telemetry");
+    return 1;
+  }
+
+  rs.path = path;
+  rs.done = 0;
+  rs.read = 0;
+  rs.skipped = 0;
+  rs.failures = 0;
+  if (pthread_create(&thread, NULL, reader, &rs)) {
+    perror("pthread_create");
+    return 1;
+  }
+  // the first decision is made on the second iteration
+  for (i = 0; i <= NUM_RECORDS; i++) {
+    poet_apply_control(state, i, get_perf(i), CONST(1.0));
+  }
+  rs.done = 1;
+  pthread_join(thread, NULL);
+  printf("Reader got %llu records and skipped %llu overwritten records\n",
+         rs.read, rs.skipped);
+
+  // the ring must hold the last NUM_SLOTS records
+  header = poet_telemetry_open(path, &size);
+  if (header == NULL || poet_telemetry_get_head(header) != NUM_RECORDS) {
+    fprintf(stderr, "Unexpected number of published records\n");
+    return 1;
+  }
+  for (index = NUM_RECORDS - NUM_SLOTS; index < NUM_RECORDS; index++) {
+    if (poet_telemetry_read(header, index, &record) || record.tag != index + 1) {
+      fprintf(stderr, "Record %llu missing from ring\n", (unsigned long long) index);
+      rs.failures++;
+    }
+  }
+  poet_telemetry_close(header, size);
+  poet_destroy(state);
+  free(cstates);
+  unlink(path);
+  return rs.failures ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+/**
+ * Check that all pair evaluation kernels supported on this CPU choose the
+ * same states as the scalar kernel, and compare their speed.
+ *
+ * Usage: translate_kernel_bench [repetitions]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "poet.h"
+#include "poet_config.h"
+#include "../src/poet_kernels.h"
+
+#define MAX_KERNELS 8
+#define NUM_TARGETS 64
+#define PERIOD 20
+#define NUM_SYNTHETIC_STATES 1000
+
+static const char* ODROID_CONTROL_CONFIG = "../config/examples/ODROIDXU3/control_config_stream";
+
+static inline uint64_t get_time(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  // must use a const or cast a literal - using a simple literal can overflow!
+  const uint64_t ONE_BILLION = 1000000000;
+  return ts.tv_sec * ONE_BILLION + ts.tv_nsec;
+}
+
+/*
+ * Run the kernel for every target and upper state.
+ * Stores chosen ids and costs if provided, returns the number of kernel calls.
+ */
+static unsigned int run_kernel(const poet_kernel* kernel,
+                           const real_t* xup,
+                           const real_t* xup_cost,
+                           unsigned int nstates,
+                           int maximize,
+                           int* ids,
+                           real_t* costs) {
+  unsigned int t;
+  unsigned int i;
+  unsigned int n = 0;
+  real_t umax = xup[0];
+  int best_id;
+  real_t best_cost;
+  for (i = 1; i < nstates; i++) {
+    if (xup[i] > umax) {
+      umax = xup[i];
+    }
+  }
+  for (t = 0; t < NUM_TARGETS; t++) {
+    real_t target = CONST(1.0) + (umax - CONST(1.0)) / NUM_TARGETS * t;
+    for (i = 0; i < nstates; i++) {
+      if (xup[i] < target) {
+        continue;
+      }
+      best_cost = maximize ? CONST(0.0) : (real_t) 0x7FFFFFFF;
+      kernel->find_best_lower(xup, xup_cost, nstates, xup[i], xup_cost[i],
+                              target, int_to_real(PERIOD), maximize,
+                              &best_id, &best_cost);
+      if (ids != NULL) {
+        ids[n] = best_id;
+        costs[n] = best_cost;
+      }
+      n++;
+    }
+  }
+  return n;
+}
+
+static int bench_table(const char* name,
+                       const poet_control_state_t* cstates,
+                       unsigned int nstates,
+                       unsigned int reps) {
+  const poet_kernel* kernels[MAX_KERNELS];
+  unsigned int nkernels = poet_kernel_get_all(kernels, MAX_KERNELS);
+  unsigned int k;
+  unsigned int r;
+  unsigned int i;
+  int maximize;
+  int failures = 0;
+  unsigned int calls = 0;
+  unsigned int n;
+  unsigned int scalar_n;
+  uint64_t start;
+  double scalar_ns = 0;
+  double ns;
+  size_t max_results = (size_t) NUM_TARGETS * nstates;
+  real_t* xup = malloc(nstates * sizeof(real_t));
+  real_t* xup_cost = malloc(nstates * sizeof(real_t));
+  int* ids = malloc(max_results * sizeof(int));
+  real_t* costs = malloc(max_results * sizeof(real_t));
+  int* scalar_ids = malloc(max_results * sizeof(int));
+  real_t* scalar_costs = malloc(max_results * sizeof(real_t));
+  if (!xup || !xup_cost || !ids || !costs || !scalar_ids || !scalar_costs) {
+    perror("malloc");
+    exit(1);
+  }
+
+  for (maximize = 0; maximize <= 1; maximize++) {
+    // PERFORMANCE tables are ordered by speedup, POWER by cost
+    for (i = 0; i < nstates; i++) {
+      xup[i] = maximize ? cstates[i].cost : cstates[i].speedup;
+      xup_cost[i] = maximize ? cstates[i].speedup : cstates[i].cost;
+    }
+    scalar_n = run_kernel(kernels[0], xup, xup_cost, nstates, maximize,
+                          scalar_ids, scalar_costs);
+    for (k = 0; k < nkernels; k++) {
+      // verify - results must be bit-identical to the scalar kernel
+      run_kernel(kernels[k], xup, xup_cost, nstates, maximize, ids, costs);
+      for (n = 0; n < scalar_n; n++) {
+        if (ids[n] != scalar_ids[n] ||
+            memcmp(&costs[n], &scalar_costs[n], sizeof(real_t))) {
+          fprintf(stderr, "%s: %s kernel chose %d, scalar chose %d\n",
+                  name, kernels[k]->name, ids[n], scalar_ids[n]);
+          failures++;
+          break;
+        }
+      }
+      // time
+      start = get_time();
+      for (r = 0; r < reps; r++) {
+        calls = run_kernel(kernels[k], xup, xup_cost, nstates, maximize, NULL, NULL);
+      }
+      ns = (double) (get_time() - start) / ((double) calls * nstates * reps);
+      if (k == 0) {
+        scalar_ns = ns;
+      }
+      printf("%-12s %-12s %-6s %8.3f ns/pair %6.2fx\n", name,
+             maximize ? "POWER" : "PERFORMANCE", kernels[k]->name, ns,
+             scalar_ns / ns);
+    }
+  }
+
+  free(xup);
+  free(xup_cost);
+  free(ids);
+  free(costs);
+  free(scalar_ids);
+  free(scalar_costs);
+  return failures;
+}
+
+int main(int argc, char** argv) {
+  unsigned int reps = argc > 1 ? (unsigned int) atoi(argv[1]) : 100;
+  unsigned int nstates;
+  unsigned int i;
+  double speedup = 1.0;
+  double cost = 1.0;
+  int failures = 0;
+  poet_control_state_t* cstates;
+
+  if (reps == 0) {
+    reps = 1;
+  }
+  printf("Fastest kernel on this CPU: %s\n", poet_kernel_select()->name);
+
+  if (get_control_states(ODROID_CONTROL_CONFIG, &cstates, &nstates)) {
+    return 1;
+  }
+  failures += bench_table("ODROIDXU3", cstates, nstates, reps);
+  free(cstates);
+
+  cstates = malloc(NUM_SYNTHETIC_STATES * sizeof(poet_control_state_t));
+  if (cstates == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  srand(0);
+  for (i = 0; i < NUM_SYNTHETIC_STATES; i++) {
+    cstates[i].id = i;
+    cstates[i].speedup = CONST(speedup);
+    cstates[i].cost = CONST(cost);
+    cstates[i].idle_partner_id = 0;
+    speedup += (rand() % 1000) / 50000.0;
+    cost += (rand() % 1000) / 100000.0;
+  }
+  failures += bench_table("synthetic", cstates, NUM_SYNTHETIC_STATES, reps);
+  free(cstates);
+
+  if (failures) {
+    fprintf(stderr, "%d kernel mismatches\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,247 @@
+/**
+ * Verify that the convex hull translation chooses schedules as good as the
+ * exhaustive n^2 search, except for what rounding low_state_iters gains the
+ * n^2 choice or costs the hull choice.
+ * Includes poet.c directly to test its static functions.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/poet.c"
+#include "poet_config.h"
+
+#define PERIOD 20
+#define NUM_TARGETS 500
+#define NUM_SYNTHETIC_STATES 200
+// rounding gains the n^2 choice at most this share of its cost on the configs
+#define MAX_RELATIVE_LOSS 0.05
+#ifdef FIXED_POINT
+  // Q16 error in the cost of a period
+  #define ROUNDING_EPSILON 0.01
+#else
+  #define ROUNDING_EPSILON 0.000001
+#endif
+
+static const char* CONTROL_CONFIGS[] = {
+  "../config/default/control_config",
+  "../config/examples/ODROIDXU3/control_config_blackscholes",
+  "../config/examples/ODROIDXU3/control_config_stream",
+  "../config/examples/ODROIDXU3/control_config_x264_native",
+  "../config/examples/SVT11226CXB/control_config_blackscholes",
+  "../config/examples/SVT11226CXB/control_config_stream",
+  "../config/examples/SVT11226CXB/control_config_x264_native",
+};
+
+// random states with an idle state at id 0, partnered with id 1
+static poet_control_state_t* make_synthetic_states(unsigned int n) {
+  unsigned int i;
+  double speedup = 1.0;
+  double cost = 1.0;
+  poet_control_state_t* states = malloc(n * sizeof(poet_control_state_t));
+  if (states == NULL) {
+    return NULL;
+  }
+  states[0].id = 0;
+  states[0].speedup = R_ZERO;
+  states[0].cost = CONST(0.25);
+  states[0].idle_partner_id = 1;
+  for (i = 1; i < n; i++) {
+    states[i].id = i;
+    states[i].speedup = CONST(speedup);
+    states[i].cost = CONST(cost);
+    states[i].idle_partner_id = 0;
+    speedup += (rand() % 1000) / 5000.0;
+    cost += (rand() % 1000) / 10000.0;
+  }
+  return states;
+}
+
+// rounding low_state_iters moves at most half an iteration between the states
+// of a pair; pairs with an idle state always spend one iteration in it
+static double get_pair_slack(const xup_table* table, const translation* t) {
+  double slack;
+  if (table->xup[t->lower_id] < R_ONE) {
+    return 0.0;
+  }
+  slack = real_to_db(table->xup_cost[t->lower_id]) / real_to_db(table->xup[t->lower_id]) -
+          real_to_db(table->xup_cost[t->upper_id]) / real_to_db(table->xup[t->upper_id]);
+  return (slack < 0 ? -slack : slack) / 2;
+}
+
+// before rounding the hull pair is optimal, so it may only lose what rounding
+// gains the n^2 choice plus what it costs the hull choice
+static double get_rounding_slack(const xup_table* table,
+                                 const translation* n2,
+                                 const translation* hull) {
+  return get_pair_slack(table, n2) + get_pair_slack(table, hull) + ROUNDING_EPSILON;
+}
+
+static int compare_translations(poet_control_state_t* cstates,
+                                unsigned int nstates,
+                                poet_tradeoff_type_t constraint,
+                                const char* name) {
+  unsigned int i;
+  unsigned int w;
+  int failures = 0;
+  double loss;
+  double slack;
+  double max_loss = 0;
+  double max_slack = 0;
+  const real_t workloads[] = { CONST(0.001), CONST(0.1), CONST(1.0) };
+  translation n2;
+  translation hull;
+
+  poet_state* state = poet_init(CONST(1.0), constraint, nstates, cstates,
+                                NULL, NULL, NULL, PERIOD, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return 1;
+  }
+  calc_xup_state* xs = constraint == POWER ? &state->pcs : &state->scs;
+
+  for (w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+    for (i = 0; i <= NUM_TARGETS; i++) {
+      real_t target = xs->umin + (xs->umax - xs->umin) / NUM_TARGETS * i;
+      xs->u = target;
+      translate_n2_with_time(state, workloads[w], 0);
+      n2.cost = state->cost_estimate;
+      n2.lower_id = state->lower_id;
+      n2.upper_id = state->upper_id;
+      xs->u = target;
+      translate_hull_with_time(state, workloads[w], 0);
+      hull.cost = state->cost_estimate;
+      hull.lower_id = state->lower_id;
+      hull.upper_id = state->upper_id;
+
+      if ((n2.lower_id < 0) != (hull.lower_id < 0)) {
+        fprintf(stderr, "%s: target %f: n2 lower_id=%d, hull lower_id=%d\n",
+                name, real_to_db(target), n2.lower_id, hull.lower_id);
+        failures++;
+        continue;
+      }
+      if (n2.lower_id < 0) {
+        // neither can achieve the target
+        continue;
+      }
+      // how much worse the hull choice is - POWER maximizes
+      loss = real_to_db(hull.cost) - real_to_db(n2.cost);
+      if (constraint == POWER) {
+        loss = -loss;
+      }
+      slack = get_rounding_slack(state->table, &n2, &hull);
+      if (loss > max_loss) {
+        max_loss = loss;
+        max_slack = slack;
+      }
+      if (loss > slack || loss > MAX_RELATIVE_LOSS * real_to_db(n2.cost) + ROUNDING_EPSILON) {
+        fprintf(stderr, "%s: target %f: n2 (%d, %d) cost=%f, hull (%d, %d) cost=%f\n",
+                name, real_to_db(target), n2.lower_id, n2.upper_id, real_to_db(n2.cost),
+                hull.lower_id, hull.upper_id, real_to_db(hull.cost));
+        failures++;
+      }
+    }
+  }
+  printf("%-60s %-11s max loss: %f (allowed: %f)\n", name,
+         constraint == POWER ? "POWER" : "PERFORMANCE", max_loss, max_slack);
+  poet_destroy(state);
+  return failures;
+}
+
+// cache hits must reuse the result computed for the first key in each quanta
+static int test_translation_cache(poet_control_state_t* cstates,
+                                  unsigned int nstates) {
+  unsigned int i;
+  unsigned long long hits;
+  unsigned long long misses;
+  int failures = 0;
+  translation uncached;
+
+  poet_state* state = poet_init(CONST(1.0), PERFORMANCE, nstates, cstates,
+                                NULL, NULL, NULL, PERIOD, 0, NULL);
+  if (state == NULL || poet_set_translation_cache(state, 64, CONST(0.01), CONST(0.01))) {
+    perror("poet_init or poet_set_translation_cache");
+    return 1;
+  }
+  for (i = 0; i < NUM_TARGETS; i++) {
+    state->scs.u = state->scs.umin + (state->scs.umax - state->scs.umin) / NUM_TARGETS * i;
+    translate_hull_with_time(state, CONST(0.1), 0);
+    uncached.lower_id = state->lower_id;
+    uncached.upper_id = state->upper_id;
+    uncached.cost = state->cost_estimate;
+    // the first translation may miss, the second must hit
+    translate(state, CONST(0.1), 0);
+    translate(state, CONST(0.1), 0);
+    if (state->lower_id != uncached.lower_id || state->upper_id != uncached.upper_id) {
+      fprintf(stderr, "translation cache: target %f: expected (%d, %d), got (%d, %d)\n",
+              real_to_db(state->scs.u), uncached.lower_id, uncached.upper_id,
+              state->lower_id, state->upper_id);
+      failures++;
+    }
+  }
+  poet_get_translation_cache_stats(state, &hits, &misses);
+  printf("translation cache: %llu hits, %llu misses\n", hits, misses);
+  if (hits < NUM_TARGETS || hits + misses != 2 * NUM_TARGETS) {
+    fprintf(stderr, "translation cache: unexpected hit/miss counts\n");
+    failures++;
+  }
+  poet_destroy(state);
+  return failures;
+}
+
+// unknown constraints are rejected instead of indexing past the xup tables
+static int test_invalid_constraint(poet_control_state_t* cstates,
+                                   unsigned int nstates) {
+  int failures = 0;
+  poet_state* state = poet_init(CONST(1.0), (poet_tradeoff_type_t) 2, nstates, cstates,
+                                NULL, NULL, NULL, PERIOD, 0, NULL);
+  if (state != NULL || errno != EINVAL) {
+    fprintf(stderr, "poet_init accepted an unknown constraint\n");
+    poet_destroy(state);
+    failures++;
+  }
+  state = poet_init(CONST(1.0), POWER, nstates, cstates, NULL, NULL, NULL, PERIOD, 0, NULL);
+  if (state == NULL) {
+    perror("poet_init");
+    return failures + 1;
+  }
+  poet_set_constraint_type(state, (poet_tradeoff_type_t) 2, CONST(2.0));
+  if (state->constraint != POWER || state->table != &state->tables[POWER]) {
+    fprintf(stderr, "poet_set_constraint_type accepted an unknown constraint\n");
+    failures++;
+  }
+  poet_destroy(state);
+  return failures;
+}
+
+int main(void) {
+  unsigned int i;
+  unsigned int nstates;
+  poet_control_state_t* cstates;
+  int failures = 0;
+
+  for (i = 0; i < sizeof(CONTROL_CONFIGS) / sizeof(CONTROL_CONFIGS[0]); i++) {
+    if (get_control_states(CONTROL_CONFIGS[i], &cstates, &nstates)) {
+      return 1;
+    }
+    failures += compare_translations(cstates, nstates, PERFORMANCE, CONTROL_CONFIGS[i]);
+    failures += compare_translations(cstates, nstates, POWER, CONTROL_CONFIGS[i]);
+    free(cstates);
+  }
+
+  srand(0);
+  cstates = make_synthetic_states(NUM_SYNTHETIC_STATES);
+  if (cstates == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  failures += compare_translations(cstates, NUM_SYNTHETIC_STATES, PERFORMANCE, "synthetic");
+  failures += compare_translations(cstates, NUM_SYNTHETIC_STATES, POWER, "synthetic");
+  failures += test_translation_cache(cstates, NUM_SYNTHETIC_STATES);
+  failures += test_invalid_constraint(cstates, NUM_SYNTHETIC_STATES);
+  free(cstates);
+
+  if (failures) {
+    fprintf(stderr, "%d translation mismatches\n", failures);
+    return 1;
+  }
+  return 0;
+}